@@ -0,0 +1,113 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <functional>
+
+#include "utils/SequenceSlotTable.h"
+#include "utils/ConcurrentHashMap.h"
+
+/**
+ * Request callback table contention: many threads send requests, one dispatcher thread completes them,
+ * as with SessionManager::mQueryCallbacks. Compares SequenceSlotTable with the mutex protected map it replaced.
+ * Usage: sequence_slot_table_bench [senders] [requests per sender]
+ */
+
+using Callback = std::function<void(int)>;
+
+struct BenchResult {
+    double seconds = 0;
+    uint64_t checksum = 0;
+};
+
+template<typename Put, typename Remove>
+static BenchResult run(Put &&put, Remove &&remove, int senderCount, int requestsPerSender) {
+    std::atomic_uint64_t sequence = 1;
+    uint64_t total = uint64_t(senderCount) * uint64_t(requestsPerSender);
+    uint64_t checksum = 0;
+    auto startTime = std::chrono::steady_clock::now();
+    // completes the requests in the order they were numbered, the way responses mostly arrive
+    std::thread dispatcher([&]() {
+        uint64_t next = 1;
+        while (next <= total) {
+            Callback callback;
+            if (remove(next, callback)) {
+                callback(int(next & 0xff));
+                next++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    std::vector<std::thread> senders;
+    senders.reserve(size_t(senderCount));
+    for (int i = 0; i < senderCount; i++) {
+        senders.emplace_back([&]() {
+            for (int j = 0; j < requestsPerSender; j++) {
+                uint64_t requestId = sequence.fetch_add(1);
+                put(requestId, Callback([&checksum, requestId](int value) {
+                    // only the dispatcher thread runs the callbacks
+                    checksum += requestId ^ uint64_t(value);
+                }));
+            }
+        });
+    }
+    for (auto &sender: senders) {
+        sender.join();
+    }
+    dispatcher.join();
+    BenchResult result;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    result.checksum = checksum;
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    int senderCount = argc > 1 ? atoi(argv[1]) : 16;
+    int requestsPerSender = argc > 2 ? atoi(argv[2]) : 100000;
+    if (senderCount < 1 || requestsPerSender < 1) {
+        fprintf(stderr, "usage: %s [senders] [requests per sender]\n", argv[0]);
+        return 1;
+    }
+    double requestCount = double(senderCount) * requestsPerSender;
+    printf("%d senders, %d requests each, %u hardware threads\n", senderCount, requestsPerSender,
+           std::thread::hardware_concurrency());
+
+    utils::SequenceSlotTable<Callback> table(16384);
+    auto slotResult = run(
+            [&table](uint64_t requestId, Callback &&callback) {
+                table.put(requestId, std::move(callback));
+            },
+            [&table](uint64_t requestId, Callback &callback) {
+                return table.remove(requestId, callback);
+            },
+            senderCount, requestsPerSender);
+    printf("SequenceSlotTable: %.3f s, %.0f requests/s, %zu overflowed at the end\n", slotResult.seconds,
+           requestCount / slotResult.seconds, table.overflowSize());
+
+    ConcurrentHashMap<uint64_t, Callback> map;
+    auto mapResult = run(
+            [&map](uint64_t requestId, Callback &&callback) {
+                map.put(requestId, std::move(callback));
+            },
+            [&map](uint64_t requestId, Callback &callback) {
+                return map.remove(requestId, callback);
+            },
+            senderCount, requestsPerSender);
+    printf("ConcurrentHashMap: %.3f s, %.0f requests/s\n", mapResult.seconds, requestCount / mapResult.seconds);
+
+    if (slotResult.checksum != mapResult.checksum) {
+        fprintf(stderr, "checksum mismatch: %llu != %llu\n", (unsigned long long) slotResult.checksum,
+                (unsigned long long) mapResult.checksum);
+        return 1;
+    }
+    printf("speedup: %.2fx\n", mapResult.seconds / slotResult.seconds);
+    return 0;
+}
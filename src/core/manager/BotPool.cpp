@@ -0,0 +1,451 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+#include "RateLimiter.h"
+#include "utils/log/Log.h"
+#include "utils/SyncUtils.h"
+
+#include "BotPool.h"
+
+static constexpr const char *LOG_TAG = "BotPool";
+
+namespace td_api = td::td_api;
+
+namespace core {
+
+struct BotPool::Action {
+    int64_t chatId = 0;
+    std::function<td_api::object_ptr<td_api::Function>()> requestFactory;
+    std::function<void(ClientSession *, td_api::object_ptr<td_api::Object>)> callback;
+    ClientSession::RequestOptions options;
+    // the bots the action has been sent through, in order
+    std::vector<int32_t> tried;
+    // the rate limit error of the last bot, handed to the callback if there is no bot left to fail over to
+    std::shared_ptr<ClientSession> lastSession;
+    td_api::object_ptr<td_api::Object> lastError;
+};
+
+void BotPool::addBot(std::shared_ptr<ClientSession> session) {
+    if (session == nullptr) {
+        throw std::invalid_argument("session must not be null");
+    }
+    auto bot = std::make_shared<Bot>();
+    bot->session = std::move(session);
+    int32_t clientId = bot->session->getTdLibObjectId();
+    std::scoped_lock lock(mMutex);
+    if (!mBots.emplace(clientId, std::move(bot)).second) {
+        throw std::logic_error("session " + std::to_string(clientId) + " is already in the pool");
+    }
+}
+
+void BotPool::removeBot(int32_t clientId) {
+    std::scoped_lock lock(mMutex);
+    if (mBots.erase(clientId) == 0) {
+        return;
+    }
+    for (auto it = mChatAdmins.begin(); it != mChatAdmins.end();) {
+        auto &admins = it->second;
+        admins.erase(std::remove(admins.begin(), admins.end(), clientId), admins.end());
+        if (admins.empty()) {
+            it = mChatAdmins.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void BotPool::setAdmin(int32_t clientId, int64_t chatId, bool isAdmin) {
+    std::scoped_lock lock(mMutex);
+    setAdminLocked(clientId, chatId, isAdmin);
+}
+
+void BotPool::setAdminLocked(int32_t clientId, int64_t chatId, bool isAdmin) {
+    if (mBots.find(clientId) == mBots.end()) {
+        return;
+    }
+    auto &admins = mChatAdmins[chatId];
+    auto it = std::find(admins.begin(), admins.end(), clientId);
+    if (isAdmin && it == admins.end()) {
+        admins.push_back(clientId);
+    } else if (!isAdmin && it != admins.end()) {
+        admins.erase(it);
+    }
+    if (admins.empty()) {
+        mChatAdmins.erase(chatId);
+    }
+}
+
+void BotPool::refreshChat(int64_t chatId, std::function<void()> onDone) {
+    std::vector<std::shared_ptr<ClientSession>> sessions;
+    {
+        std::scoped_lock lock(mMutex);
+        for (const auto &[clientId, bot]: mBots) {
+            if (bot->session->getUserId() != 0) {
+                sessions.push_back(bot->session);
+            }
+        }
+    }
+    if (sessions.empty()) {
+        if (onDone) {
+            onDone();
+        }
+        return;
+    }
+    struct Refresh {
+        std::atomic_size_t remaining;
+        std::function<void()> onDone;
+    };
+    auto refresh = std::make_shared<Refresh>();
+    refresh->remaining = sessions.size();
+    refresh->onDone = std::move(onDone);
+    for (const auto &session: sessions) {
+        int32_t clientId = session->getTdLibObjectId();
+        auto request = td_api::make_object<td_api::getChatMember>(
+                chatId, td_api::make_object<td_api::messageSenderUser>(session->getUserId()));
+        auto callback = [this, clientId, chatId, refresh](TdResult<td_api::chatMember> result) {
+            if (result.isError()) {
+                LOGW("failed to get the status of bot %d in chat %ld: %s", clientId, chatId,
+                     result.getErrorMessage().c_str());
+                setAdmin(clientId, chatId, false);
+            } else {
+                setAdmin(clientId, chatId, isAdminStatus(result->status_.get()));
+            }
+            if (refresh->remaining.fetch_sub(1) == 1 && refresh->onDone) {
+                refresh->onDone();
+            }
+        };
+        try {
+            session->execute(std::move(request), std::move(callback));
+        } catch (const std::exception &e) {
+            LOGW("failed to ask bot %d about chat %ld: %s", clientId, chatId, e.what());
+            if (refresh->remaining.fetch_sub(1) == 1 && refresh->onDone) {
+                refresh->onDone();
+            }
+        }
+    }
+}
+
+bool BotPool::deferUntilRefreshed(const std::shared_ptr<Action> &action) {
+    int64_t chatId = action->chatId;
+    {
+        std::scoped_lock lock(mMutex);
+        if (mChatAdmins.find(chatId) != mChatAdmins.end()) {
+            // an admin became known in the meantime
+            return false;
+        }
+        auto deferred = mDeferredActions.find(chatId);
+        if (deferred != mDeferredActions.end()) {
+            // a refresh is already running
+            deferred->second.push_back(action);
+            return true;
+        }
+        int64_t now = int64_t(utils::getCurrentTimeMillis());
+        auto lastRefresh = mRefreshTimes.find(chatId);
+        if (lastRefresh != mRefreshTimes.end() && now - lastRefresh->second < kRefreshIntervalMillis) {
+            return false;
+        }
+        // forget chats which were refreshed long ago, so that the map does not grow with every chat ever seen
+        for (auto it = mRefreshTimes.begin(); it != mRefreshTimes.end();) {
+            if (now - it->second >= kRefreshIntervalMillis) {
+                it = mRefreshTimes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        mRefreshTimes[chatId] = now;
+        mDeferredActions[chatId].push_back(action);
+    }
+    LOGD("no known admin of chat %ld, refreshing it", chatId);
+    refreshChat(chatId, [this, chatId]() {
+        std::vector<std::shared_ptr<Action>> actions;
+        {
+            std::scoped_lock lock(mMutex);
+            auto it = mDeferredActions.find(chatId);
+            if (it != mDeferredActions.end()) {
+                actions = std::move(it->second);
+                mDeferredActions.erase(it);
+            }
+        }
+        for (const auto &deferred: actions) {
+            send(deferred);
+        }
+    });
+    return true;
+}
+
+bool BotPool::isResponsibleFor(int32_t clientId, int64_t chatId) const {
+    std::scoped_lock lock(mMutex);
+    auto admins = mChatAdmins.find(chatId);
+    if (admins == mChatAdmins.end()) {
+        return true;
+    }
+    int32_t responsible = 0;
+    bool found = false;
+    for (int32_t adminId: admins->second) {
+        auto it = mBots.find(adminId);
+        if (it == mBots.end() || !it->second->session->isAuthorized()) {
+            continue;
+        }
+        if (!found || adminId < responsible) {
+            responsible = adminId;
+            found = true;
+        }
+    }
+    // no admin is authorized right now, let every bot react rather than none
+    return !found || responsible == clientId;
+}
+
+void BotPool::execute(int64_t chatId, std::function<td_api::object_ptr<td_api::Function>()> requestFactory,
+                      std::function<void(ClientSession *, td_api::object_ptr<td_api::Object>)> callback,
+                      const ClientSession::RequestOptions &options) {
+    if (!requestFactory) {
+        throw std::invalid_argument("request factory must not be null");
+    }
+    auto action = std::make_shared<Action>();
+    action->chatId = chatId;
+    action->requestFactory = std::move(requestFactory);
+    action->callback = std::move(callback);
+    action->options = options;
+    action->options.chatId = chatId;
+    mRoutedCount.fetch_add(1, std::memory_order_relaxed);
+    send(action);
+}
+
+std::shared_ptr<BotPool::Bot> BotPool::pickBot(int64_t chatId, const std::vector<int32_t> &tried, int &retryAfterSeconds,
+                                               bool &isLastCandidate) {
+    retryAfterSeconds = -1;
+    isLastCandidate = true;
+    std::scoped_lock lock(mMutex);
+    auto admins = mChatAdmins.find(chatId);
+    if (admins == mChatAdmins.end()) {
+        return nullptr;
+    }
+    int64_t now = int64_t(utils::getCurrentTimeMillis());
+    std::shared_ptr<Bot> best;
+    int64_t bestLoad = 0;
+    size_t candidateCount = 0;
+    for (int32_t clientId: admins->second) {
+        if (std::find(tried.begin(), tried.end(), clientId) != tried.end()) {
+            continue;
+        }
+        auto it = mBots.find(clientId);
+        if (it == mBots.end() || !it->second->session->isAuthorized()) {
+            continue;
+        }
+        auto &bot = it->second;
+        if (auto floodWait = bot->floodWaitUntilMillis.find(chatId); floodWait != bot->floodWaitUntilMillis.end()) {
+            if (floodWait->second > now) {
+                int seconds = int((floodWait->second - now + 999) / 1000);
+                retryAfterSeconds = retryAfterSeconds < 0 ? seconds : std::min(retryAfterSeconds, seconds);
+                continue;
+            }
+            bot->floodWaitUntilMillis.erase(floodWait);
+        }
+        candidateCount++;
+        int64_t load = getLoad(*bot);
+        if (best == nullptr || load < bestLoad) {
+            best = bot;
+            bestLoad = load;
+        }
+    }
+    isLastCandidate = candidateCount <= 1;
+    return best;
+}
+
+void BotPool::send(const std::shared_ptr<Action> &action) {
+    int retryAfterSeconds;
+    bool isLastCandidate;
+    auto bot = pickBot(action->chatId, action->tried, retryAfterSeconds, isLastCandidate);
+    if (bot == nullptr && action->tried.empty() && retryAfterSeconds < 0 && deferUntilRefreshed(action)) {
+        return;
+    }
+    if (bot == nullptr) {
+        mUnavailableCount.fetch_add(1, std::memory_order_relaxed);
+        if (action->lastError != nullptr) {
+            action->callback(action->lastSession.get(), std::move(action->lastError));
+        } else if (retryAfterSeconds >= 0) {
+            // same format as Telegram, so that RateLimiter::parseRetryAfterSeconds understands it
+            action->callback(nullptr, td_api::make_object<td_api::error>(
+                    ClientSession::kRateLimitedErrorCode, "Too Many Requests: retry after " + std::to_string(retryAfterSeconds)));
+        } else {
+            action->callback(nullptr, td_api::make_object<td_api::error>(
+                    kNoEligibleBotErrorCode, "No bot of the pool is an admin of the chat"));
+        }
+        return;
+    }
+    if (!action->tried.empty()) {
+        mFailoverCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    action->tried.push_back(bot->session->getTdLibObjectId());
+    bot->outstandingCount.fetch_add(1, std::memory_order_relaxed);
+    bot->routedCount.fetch_add(1, std::memory_order_relaxed);
+    ClientSession::RequestOptions options = action->options;
+    if (!isLastCandidate) {
+        // another bot can take the action right away, that beats waiting for this bot's rate limiter
+        options.rateLimitPolicy = ClientSession::RateLimitPolicy::DROP;
+    }
+    bot->session->execute(action->requestFactory(), [this, action, bot](td_api::object_ptr<td_api::Object> object) {
+        onResponse(action, bot, std::move(object));
+    }, options);
+}
+
+void BotPool::onResponse(const std::shared_ptr<Action> &action, const std::shared_ptr<Bot> &bot,
+                         td_api::object_ptr<td_api::Object> object) {
+    bot->outstandingCount.fetch_sub(1, std::memory_order_relaxed);
+    if (object != nullptr && object->get_id() == td_api::error::ID) {
+        const auto &error = static_cast<const td_api::error &>(*object);
+        int retryAfterSeconds = RateLimiter::parseRetryAfterSeconds(error.code_, error.message_);
+        if (retryAfterSeconds >= 0) {
+            mFloodWaitCount.fetch_add(1, std::memory_order_relaxed);
+            std::scoped_lock lock(mMutex);
+            bot->floodWaitUntilMillis[action->chatId] = int64_t(utils::getCurrentTimeMillis()) + int64_t(retryAfterSeconds) * 1000;
+        }
+        if (retryAfterSeconds >= 0 || error.code_ == ClientSession::kRateLimitedErrorCode) {
+            action->lastSession = bot->session;
+            action->lastError = std::move(object);
+            send(action);
+            return;
+        }
+    }
+    action->callback(bot->session.get(), std::move(object));
+}
+
+int64_t BotPool::getLoad(const Bot &bot) {
+    // the flow controller also counts the requests sent through the pool, so take the larger of the two
+    auto stats = bot.session->getFlowControlStatistics();
+    return std::max(bot.outstandingCount.load(std::memory_order_relaxed), int64_t(stats.outstandingCount))
+           + int64_t(stats.queueDepth);
+}
+
+bool BotPool::isAdminStatus(const td_api::ChatMemberStatus *status) {
+    return status != nullptr && (status->get_id() == td_api::chatMemberStatusAdministrator::ID
+                                 || status->get_id() == td_api::chatMemberStatusCreator::ID);
+}
+
+std::vector<std::shared_ptr<ClientSession>> BotPool::getEligibleBots(int64_t chatId) const {
+    std::vector<std::pair<int64_t, std::shared_ptr<ClientSession>>> bots;
+    {
+        std::scoped_lock lock(mMutex);
+        auto admins = mChatAdmins.find(chatId);
+        if (admins == mChatAdmins.end()) {
+            return {};
+        }
+        int64_t now = int64_t(utils::getCurrentTimeMillis());
+        for (int32_t clientId: admins->second) {
+            auto it = mBots.find(clientId);
+            if (it == mBots.end() || !it->second->session->isAuthorized()) {
+                continue;
+            }
+            const auto &bot = *it->second;
+            auto floodWait = bot.floodWaitUntilMillis.find(chatId);
+            if (floodWait != bot.floodWaitUntilMillis.end() && floodWait->second > now) {
+                continue;
+            }
+            bots.emplace_back(getLoad(bot), bot.session);
+        }
+    }
+    std::stable_sort(bots.begin(), bots.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.first < rhs.first;
+    });
+    std::vector<std::shared_ptr<ClientSession>> result;
+    result.reserve(bots.size());
+    for (auto &[load, session]: bots) {
+        result.push_back(std::move(session));
+    }
+    return result;
+}
+
+std::vector<BotPool::BotState> BotPool::getBotStates() const {
+    std::scoped_lock lock(mMutex);
+    std::vector<BotState> states;
+    states.reserve(mBots.size());
+    for (const auto &[clientId, bot]: mBots) {
+        BotState state;
+        state.clientId = clientId;
+        state.outstandingCount = bot->outstandingCount.load(std::memory_order_relaxed);
+        state.routedCount = bot->routedCount.load(std::memory_order_relaxed);
+        states.push_back(state);
+    }
+    for (const auto &[chatId, admins]: mChatAdmins) {
+        for (int32_t clientId: admins) {
+            for (auto &state: states) {
+                if (state.clientId == clientId) {
+                    state.adminChatCount++;
+                }
+            }
+        }
+    }
+    return states;
+}
+
+BotPool::Statistics BotPool::getStatistics() const {
+    Statistics stats;
+    stats.routedCount = mRoutedCount.load(std::memory_order_relaxed);
+    stats.failoverCount = mFailoverCount.load(std::memory_order_relaxed);
+    stats.floodWaitCount = mFloodWaitCount.load(std::memory_order_relaxed);
+    stats.unavailableCount = mUnavailableCount.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<int32_t> BotPool::getInterestedUpdateIds() const {
+    return {td_api::updateChatMember::ID, td_api::updateSupergroup::ID, td_api::updateBasicGroup::ID};
+}
+
+void BotPool::onStatusUpdate(int32_t clientId, int64_t chatId, const td_api::ChatMemberStatus *status) {
+    if (status == nullptr) {
+        return;
+    }
+    bool isAdmin = isAdminStatus(status);
+    std::scoped_lock lock(mMutex);
+    if (mBots.find(clientId) == mBots.end()) {
+        return;
+    }
+    auto admins = mChatAdmins.find(chatId);
+    bool wasAdmin = admins != mChatAdmins.end()
+                    && std::find(admins->second.begin(), admins->second.end(), clientId) != admins->second.end();
+    if (wasAdmin != isAdmin) {
+        LOGD("bot %d is %s admin of chat %ld", clientId, isAdmin ? "an" : "not an", chatId);
+        setAdminLocked(clientId, chatId, isAdmin);
+    }
+}
+
+bool BotPool::onUpdate(int32_t clientId, td_api::Object &update) {
+    // the groups carry the status of the bot itself, TDLib sends them for every known group on startup
+    if (update.get_id() == td_api::updateSupergroup::ID) {
+        const auto *supergroup = static_cast<const td_api::updateSupergroup &>(update).supergroup_.get();
+        if (supergroup != nullptr) {
+            onStatusUpdate(clientId, kSupergroupChatIdBase - supergroup->id_, supergroup->status_.get());
+        }
+        return false;
+    }
+    if (update.get_id() == td_api::updateBasicGroup::ID) {
+        const auto *basicGroup = static_cast<const td_api::updateBasicGroup &>(update).basic_group_.get();
+        if (basicGroup != nullptr) {
+            onStatusUpdate(clientId, -basicGroup->id_, basicGroup->status_.get());
+        }
+        return false;
+    }
+    const auto &chatMember = static_cast<const td_api::updateChatMember &>(update);
+    const auto *member = chatMember.new_chat_member_.get();
+    if (member == nullptr || member->member_id_ == nullptr || member->member_id_->get_id() != td_api::messageSenderUser::ID) {
+        return false;
+    }
+    int64_t memberUserId = static_cast<const td_api::messageSenderUser &>(*member->member_id_).user_id_;
+    std::scoped_lock lock(mMutex);
+    auto it = mBots.find(clientId);
+    // only the status of the bot itself matters, not the members it sees joining or leaving
+    if (it == mBots.end() || it->second->session->getUserId() != memberUserId) {
+        return false;
+    }
+    bool isAdmin = isAdminStatus(member->status_.get());
+    LOGI("bot %d is %s admin of chat %ld", clientId, isAdmin ? "now an" : "no longer an", chatMember.chat_id_);
+    setAdminLocked(clientId, chatMember.chat_id_, isAdmin);
+    return false;
+}
+
+}
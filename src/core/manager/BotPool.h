@@ -0,0 +1,196 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_BOTPOOL_H
+#define NEOGROUPCAPTCHABOT_BOTPOOL_H
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include <td/telegram/td_api.h>
+
+#include "ClientSession.h"
+#include "UpdateInterceptor.h"
+
+namespace core {
+
+/**
+ * Spreads the actions on a chat over several bots which are admins of it, so that the per-bot limits of Telegram
+ * add up instead of capping the throughput of a single bot, e.g. during a raid.
+ * An action goes to the eligible bot with the fewest outstanding requests, a bot is eligible if it is authorized,
+ * an admin of the chat and not waiting out a FLOOD_WAIT for the chat.
+ * If the bot is rate limited, locally or by Telegram, the action fails over to the next eligible bot.
+ * The pool learns which bots are admins where from the updateSupergroup and updateBasicGroup updates TDLib sends
+ * for every known group on startup and from the updateChatMember updates of the bots, so it must be added to the
+ * SessionManager as an update interceptor, and from setAdmin and refreshChat. An action on a chat the pool knows
+ * no admin of waits for refreshChat, at most once per kRefreshIntervalMillis per chat.
+ * The pool must outlive the actions sent through it, which is the case once it is registered as an interceptor.
+ * This class is thread safe.
+ */
+class BotPool : public UpdateInterceptor {
+public:
+    // error code of the synthetic td_api::error if no bot of the pool is an admin of the chat
+    static constexpr int32_t kNoEligibleBotErrorCode = 503;
+    // how long a chat without a known admin is not asked about again
+    static constexpr int64_t kRefreshIntervalMillis = 60 * 1000;
+
+    struct Statistics {
+        uint64_t routedCount = 0;
+        // attempts sent to another bot because the previous one was rate limited
+        uint64_t failoverCount = 0;
+        uint64_t floodWaitCount = 0;
+        // actions which found no bot to send them, because none is an admin or all are rate limited
+        uint64_t unavailableCount = 0;
+    };
+
+    struct BotState {
+        int32_t clientId = 0;
+        // requests sent through the pool which have no response yet
+        int64_t outstandingCount = 0;
+        uint64_t routedCount = 0;
+        size_t adminChatCount = 0;
+    };
+
+    BotPool() = default;
+
+    /**
+     * Add a bot to the pool, it becomes eligible for the chats it is known to be an admin of.
+     * @param session the bot session
+     */
+    void addBot(std::shared_ptr<ClientSession> session);
+
+    void removeBot(int32_t clientId);
+
+    /**
+     * Tell the pool whether a bot is an admin of a chat, e.g. from a configuration file.
+     * @param clientId the TDLib client id of the bot
+     * @param chatId the chat id
+     * @param isAdmin whether the bot may act on the chat
+     */
+    void setAdmin(int32_t clientId, int64_t chatId, bool isAdmin);
+
+    /**
+     * Ask every bot of the pool for its member status in a chat and update the admins of the chat.
+     * @param chatId the chat id
+     * @param onDone called once every bot has answered, on the dispatcher thread of the last one, may be null
+     */
+    void refreshChat(int64_t chatId, std::function<void()> onDone = nullptr);
+
+    /**
+     * Whether a bot is the one of the pool which should react to an event in a chat, so that an event seen by
+     * every bot of the chat is handled once. The reaction itself should still be sent through execute.
+     * That is the authorized admin with the lowest client id, or every bot if the chat has no known admin.
+     * @param clientId the TDLib client id of the bot which saw the event
+     * @param chatId the chat id
+     */
+    [[nodiscard]] bool isResponsibleFor(int32_t clientId, int64_t chatId) const;
+
+    /**
+     * Send an action on a chat through the least loaded eligible bot.
+     * If the bot is rate limited the action is created again and sent through the next eligible bot,
+     * the callback sees the rate limit error only if every eligible bot is rate limited.
+     * The callback is called on the dispatcher thread of the bot which sent the action,
+     * or on the calling thread if there is no eligible bot.
+     * @param chatId the chat the action is about
+     * @param requestFactory creates the request, it is called once per attempt as td_api objects can't be copied
+     * @param callback the response callback
+     * @param options the options of each attempt, the chat id is set to chatId
+     */
+    void execute(int64_t chatId, std::function<td::td_api::object_ptr<td::td_api::Function>()> requestFactory,
+                 std::function<void(ClientSession *, td::td_api::object_ptr<td::td_api::Object>)> callback,
+                 const ClientSession::RequestOptions &options = {});
+
+    /**
+     * Typed variant of execute, the result type is derived from the function the factory creates.
+     */
+    template<typename Factory, typename Callback,
+            typename F = typename detail::ObjectPtrElement<std::invoke_result_t<Factory &>>::type>
+    requires TdFunction<F> && std::is_invocable_v<Callback &, ClientSession *, TdResult<TdReturnType<F>>>
+    void execute(int64_t chatId, Factory requestFactory, Callback callback, const ClientSession::RequestOptions &options = {}) {
+        execute(chatId,
+                [requestFactory = std::move(requestFactory)]() mutable {
+                    return td::td_api::object_ptr<td::td_api::Function>(requestFactory());
+                },
+                [callback = std::move(callback)](ClientSession *session, td::td_api::object_ptr<td::td_api::Object> object) mutable {
+                    callback(session, TdResult<TdReturnType<F>>(std::move(object)));
+                }, options);
+    }
+
+    /**
+     * Get the bots which may act on a chat right now, least loaded first.
+     */
+    [[nodiscard]] std::vector<std::shared_ptr<ClientSession>> getEligibleBots(int64_t chatId) const;
+
+    [[nodiscard]] std::vector<BotState> getBotStates() const;
+
+    [[nodiscard]] Statistics getStatistics() const;
+
+    [[nodiscard]] std::vector<int32_t> getInterestedUpdateIds() const override;
+
+    bool onUpdate(int32_t clientId, td::td_api::Object &update) override;
+
+private:
+    // the chat id of supergroup N is kSupergroupChatIdBase - N, the chat id of basic group N is -N
+    static constexpr int64_t kSupergroupChatIdBase = -1000000000000LL;
+
+    struct Bot {
+        std::shared_ptr<ClientSession> session;
+        std::atomic_int64_t outstandingCount = 0;
+        std::atomic_uint64_t routedCount = 0;
+        // guarded by the pool mutex
+        std::unordered_map<int64_t, int64_t> floodWaitUntilMillis;
+    };
+
+    struct Action;
+
+    /**
+     * Pick the least loaded eligible bot which has not been tried for the action yet.
+     * @param retryAfterSeconds set to the shortest FLOOD_WAIT left of the skipped bots, -1 if none was skipped
+     * @param isLastCandidate set to whether no other bot would be left to fail over to
+     * @return the bot, or null if there is none
+     */
+    std::shared_ptr<Bot> pickBot(int64_t chatId, const std::vector<int32_t> &tried, int &retryAfterSeconds,
+                                 bool &isLastCandidate);
+
+    void send(const std::shared_ptr<Action> &action);
+
+    void onResponse(const std::shared_ptr<Action> &action, const std::shared_ptr<Bot> &bot,
+                    td::td_api::object_ptr<td::td_api::Object> object);
+
+    void setAdminLocked(int32_t clientId, int64_t chatId, bool isAdmin);
+
+    /**
+     * Hold an action on a chat without a known admin until the chat is refreshed.
+     * @return true if the action is held, false if the chat was refreshed recently
+     */
+    bool deferUntilRefreshed(const std::shared_ptr<Action> &action);
+
+    void onStatusUpdate(int32_t clientId, int64_t chatId, const td::td_api::ChatMemberStatus *status);
+
+    static int64_t getLoad(const Bot &bot);
+
+    static bool isAdminStatus(const td::td_api::ChatMemberStatus *status);
+
+    mutable std::mutex mMutex;
+    std::unordered_map<int32_t, std::shared_ptr<Bot>> mBots;
+    // chat id -> client ids of the bots which are admins of the chat
+    std::unordered_map<int64_t, std::vector<int32_t>> mChatAdmins;
+    // chat id -> when the chat was last refreshed because no admin of it was known
+    std::unordered_map<int64_t, int64_t> mRefreshTimes;
+    // chat id -> actions waiting for the refresh of the chat
+    std::unordered_map<int64_t, std::vector<std::shared_ptr<Action>>> mDeferredActions;
+    std::atomic_uint64_t mRoutedCount = 0;
+    std::atomic_uint64_t mFailoverCount = 0;
+    std::atomic_uint64_t mFloodWaitCount = 0;
+    std::atomic_uint64_t mUnavailableCount = 0;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_BOTPOOL_H
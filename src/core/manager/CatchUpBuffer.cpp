@@ -0,0 +1,87 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <stdexcept>
+
+#include "CatchUpBuffer.h"
+
+namespace td_api = td::td_api;
+
+namespace core {
+
+CatchUpBuffer::CatchUpBuffer(Policy policy) : mPolicy(policy) {
+    if (mPolicy.maxMessagesPerChat == 0) {
+        throw std::invalid_argument("maxMessagesPerChat must be positive");
+    }
+}
+
+static bool isAddMembers(const td_api::object_ptr<td_api::message> &message) {
+    return message->content_ != nullptr && message->content_->get_id() == td_api::messageChatAddMembers::ID;
+}
+
+void CatchUpBuffer::add(td_api::object_ptr<td_api::message> message) {
+    if (message == nullptr) {
+        throw std::invalid_argument("message must not be null");
+    }
+    mStatistics.receivedCount++;
+    if (message->date_ < mPolicy.staleBefore) {
+        mStatistics.staleCount++;
+        return;
+    }
+    auto [it, inserted] = mChats.try_emplace(message->chat_id_);
+    if (inserted) {
+        mChatOrder.push_back(message->chat_id_);
+    }
+    auto &messages = it->second;
+    if (isAddMembers(message)) {
+        // there is at most one buffered join per chat, fold it into the new one
+        for (auto previous = messages.begin(); previous != messages.end(); ++previous) {
+            if (isAddMembers(*previous)) {
+                auto &from = static_cast<td_api::messageChatAddMembers &>(*(*previous)->content_).member_user_ids_;
+                auto &to = static_cast<td_api::messageChatAddMembers &>(*message->content_).member_user_ids_;
+                to.insert(to.begin(), from.begin(), from.end());
+                messages.erase(previous);
+                mStatistics.mergedJoinCount++;
+                break;
+            }
+        }
+    }
+    messages.push_back(std::move(message));
+    if (messages.size() > mPolicy.maxMessagesPerChat) {
+        // drop the oldest message, but keep the join, the members still need to be handled
+        auto oldest = messages.begin();
+        if (isAddMembers(*oldest) && messages.size() > 1) {
+            ++oldest;
+        }
+        messages.erase(oldest);
+        mStatistics.trimmedCount++;
+    }
+}
+
+void CatchUpBuffer::drain(const Consumer &consumer) {
+    for (int64_t chatId: mChatOrder) {
+        auto &messages = mChats[chatId];
+        while (!messages.empty()) {
+            auto message = std::move(messages.front());
+            messages.pop_front();
+            mStatistics.deliveredCount++;
+            consumer(std::move(message));
+        }
+    }
+    mStatistics.chatCount += mChatOrder.size();
+    mChatOrder.clear();
+    mChats.clear();
+}
+
+const CatchUpBuffer::Policy &CatchUpBuffer::getPolicy() const noexcept {
+    return mPolicy;
+}
+
+CatchUpBuffer::Statistics CatchUpBuffer::getStatistics() const noexcept {
+    Statistics statistics = mStatistics;
+    statistics.chatCount += mChatOrder.size();
+    return statistics;
+}
+
+}
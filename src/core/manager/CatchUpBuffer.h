@@ -0,0 +1,79 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_CATCHUPBUFFER_H
+#define NEOGROUPCAPTCHABOT_CATCHUPBUFFER_H
+
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include <td/telegram/td_api.h>
+
+namespace core {
+
+/**
+ * Holds the new messages a session receives while TDLib replays the backlog after a restart,
+ * i.e. before the connection state becomes ready, and hands out only what is still worth handling.
+ * The messages are grouped by chat, stale messages are dropped as they arrive without being handled or logged,
+ * join messages of a chat are merged into one and only the join and the last messages of a chat are kept.
+ * This class is not thread safe, it is used on the dispatcher thread of its session.
+ */
+class CatchUpBuffer {
+public:
+    struct Policy {
+        // messages sent before this unix time are dropped, 0 to keep messages of any age
+        int32_t staleBefore = 0;
+        // how many messages of a chat are kept, the older ones except the join are dropped
+        size_t maxMessagesPerChat = 32;
+    };
+
+    struct Statistics {
+        uint64_t receivedCount = 0;
+        uint64_t staleCount = 0;
+        uint64_t trimmedCount = 0;
+        uint64_t mergedJoinCount = 0;
+        uint64_t deliveredCount = 0;
+        size_t chatCount = 0;
+    };
+
+    using Consumer = std::function<void(td::td_api::object_ptr<td::td_api::message>)>;
+
+    explicit CatchUpBuffer(Policy policy);
+
+    CatchUpBuffer(const CatchUpBuffer &) = delete;
+
+    CatchUpBuffer &operator=(const CatchUpBuffer &) = delete;
+
+    /**
+     * Buffer a message, or drop it right away if it is stale.
+     * If the message adds members to a chat, the members added by earlier buffered messages of the chat
+     * are moved into it and the earlier messages are dropped, so the chat sees a single join.
+     * @param message the message, must not be null
+     */
+    void add(td::td_api::object_ptr<td::td_api::message> message);
+
+    /**
+     * Hand out the buffered messages and empty the buffer.
+     * The chats are drained in the order they first appeared, the messages of a chat in the order they arrived.
+     * @param consumer called with every buffered message
+     */
+    void drain(const Consumer &consumer);
+
+    [[nodiscard]] const Policy &getPolicy() const noexcept;
+
+    [[nodiscard]] Statistics getStatistics() const noexcept;
+
+private:
+    Policy mPolicy;
+    std::vector<int64_t> mChatOrder;
+    std::unordered_map<int64_t, std::deque<td::td_api::object_ptr<td::td_api::message>>> mChats;
+    Statistics mStatistics;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_CATCHUPBUFFER_H
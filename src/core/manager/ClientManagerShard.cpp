@@ -0,0 +1,276 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+
+#include "SessionManager.h"
+#include "utils/log/Log.h"
+
+#include "ClientManagerShard.h"
+
+static constexpr const char *LOG_TAG = "ClientManagerShard";
+
+namespace core {
+
+ClientManagerShard::ClientManagerShard(SessionManager *sessionManager, int index, int maxReceiveBatchSize,
+                                       std::unique_ptr<TdTransport> transport)
+        : mSessionManager(sessionManager), mIndex(index), mMaxReceiveBatchSize(std::max(1, maxReceiveBatchSize)),
+          mTransport(std::move(transport)) {
+    if (mTransport == nullptr) {
+        throw std::invalid_argument("transport must not be null");
+    }
+}
+
+ClientManagerShard::~ClientManagerShard() {
+    stop();
+}
+
+TdTransport *ClientManagerShard::getTransport() const noexcept {
+    return mTransport.get();
+}
+
+int ClientManagerShard::getIndex() const noexcept {
+    return mIndex;
+}
+
+int ClientManagerShard::getSessionCount() const noexcept {
+    return mSessionCount.load(std::memory_order_relaxed);
+}
+
+int32_t ClientManagerShard::createClientId() {
+    int32_t id = mTransport->createClientId();
+    mSessionCount.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+void ClientManagerShard::start() {
+    std::scoped_lock lock(mStartMutex);
+    if (mWorkerThread != 0) {
+        return;
+    }
+    mLooperRunning = true;
+    // start the dispatcher first, so that the receive thread always has a consumer
+    int rc = pthread_create(&mDispatcherThread, nullptr,
+                            reinterpret_cast<void *(*)(void *)>(&ClientManagerShard::runDispatcher), this);
+    if (rc != 0) {
+        throw std::runtime_error("Failed to create dispatcher thread: error code " + std::to_string(rc));
+    }
+    rc = pthread_create(&mWorkerThread, nullptr,
+                        reinterpret_cast<void *(*)(void *)>(&ClientManagerShard::runLooper), this);
+    if (rc != 0) {
+        throw std::runtime_error("Failed to create worker thread: error code " + std::to_string(rc));
+    }
+    LOGD("shard %d started", mIndex);
+}
+
+void ClientManagerShard::stop() {
+    std::scoped_lock lock(mStartMutex);
+    if (mWorkerThread == 0) {
+        return;
+    }
+    mLooperRunning = false;
+    mTransport->interruptReceive();
+    {
+        std::scoped_lock dispatchLock(mDispatchMutex);
+        mDispatchCondition.notify_all();
+        mReceiverCondition.notify_all();
+    }
+    pthread_join(mWorkerThread, nullptr);
+    pthread_join(mDispatcherThread, nullptr);
+    mWorkerThread = 0;
+    mDispatcherThread = 0;
+}
+
+void ClientManagerShard::runLooper(ClientManagerShard *shard) {
+    auto *transport = shard->getTransport();
+    while (shard->mLooperRunning) {
+        auto resp = transport->receive(300);
+        if (resp.object == nullptr) {
+            continue;
+        }
+        // drain whatever else is ready without waiting, then wake the dispatcher once for the whole batch
+        int batchSize = 0;
+        do {
+            shard->enqueueResponse(std::move(resp));
+            batchSize++;
+            if (batchSize >= shard->mMaxReceiveBatchSize) {
+                break;
+            }
+            resp = transport->receive(0);
+        } while (resp.object != nullptr);
+        shard->recordBatchSize(batchSize);
+        shard->wakeDispatcher();
+    }
+}
+
+void ClientManagerShard::recordBatchSize(int batchSize) {
+    int bucket = 0;
+    while (bucket < kBatchHistogramBuckets - 1 && (batchSize >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+    mReceiveBatchSizeHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+    mReceiveBatchCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ClientManagerShard::wakeDispatcher() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mDispatcherParked) {
+        std::scoped_lock lock(mDispatchMutex);
+        mDispatchCondition.notify_one();
+    }
+}
+
+void ClientManagerShard::enqueueResponse(td::ClientManager::Response &&response) {
+    mReceivedCount.fetch_add(1, std::memory_order_relaxed);
+    if (!mResponseQueue.offer(std::move(response))) {
+        // the dispatcher can't keep up, let it drain the batch so far and block until there is room
+        wakeDispatcher();
+        auto stallStart = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mDispatchMutex);
+        mReceiverParked = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!mResponseQueue.offer(std::move(response))) {
+            if (!mLooperRunning) {
+                mReceiverParked = false;
+                return;
+            }
+            mReceiverCondition.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        mReceiverParked = false;
+        lock.unlock();
+        auto stallMicros = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - stallStart).count());
+        mReceiverStallCount.fetch_add(1, std::memory_order_relaxed);
+        mReceiverStallTimeMicros.fetch_add(stallMicros, std::memory_order_relaxed);
+        if (stallMicros > 1000000) {
+            LOGW("Receive thread of shard %d stalled for %llu ms, dispatcher is too slow",
+                 mIndex, (unsigned long long) (stallMicros / 1000));
+        }
+    }
+    size_t depth = mResponseQueue.size();
+    if (depth > mMaxQueueDepth.load(std::memory_order_relaxed)) {
+        mMaxQueueDepth.store(depth, std::memory_order_relaxed);
+    }
+}
+
+void ClientManagerShard::runDispatcher(ClientManagerShard *shard) {
+    td::ClientManager::Response response = {};
+    while (shard->mLooperRunning) {
+        if (shard->mResponseQueue.poll(response)) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (shard->mReceiverParked) {
+                std::scoped_lock lock(shard->mDispatchMutex);
+                shard->mReceiverCondition.notify_one();
+            }
+            auto start = std::chrono::steady_clock::now();
+            shard->mSessionManager->dispatchResponse(response);
+            response.object.reset();
+            auto micros = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+            if (micros > shard->mMaxDispatchTimeMicros.load(std::memory_order_relaxed)) {
+                shard->mMaxDispatchTimeMicros.store(micros, std::memory_order_relaxed);
+            }
+        } else {
+            // nothing to dispatch, park until the receive thread hands over a response
+            // wake up every timer tick if there are timers to expire
+            auto timeout = std::chrono::milliseconds(shard->mPendingTimerCount != 0 ? kTimerTickMillis : 100);
+            std::unique_lock<std::mutex> lock(shard->mDispatchMutex);
+            shard->mDispatcherParked = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (shard->mResponseQueue.isEmpty() && shard->mLooperRunning) {
+                shard->mDispatchCondition.wait_for(lock, timeout);
+            }
+            shard->mDispatcherParked = false;
+        }
+        shard->expireTimers();
+    }
+}
+
+uint64_t ClientManagerShard::currentTimerTick() {
+    auto millis = uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    return millis / kTimerTickMillis;
+}
+
+void ClientManagerShard::scheduleDeadline(uint64_t requestId, int timeoutMillis) {
+    TimerEntry entry;
+    entry.requestId = requestId;
+    scheduleTimer(timeoutMillis, std::move(entry));
+}
+
+void ClientManagerShard::scheduleTask(int delayMillis, std::function<void()> task) {
+    if (!task) {
+        return;
+    }
+    TimerEntry entry;
+    entry.task = std::move(task);
+    scheduleTimer(delayMillis, std::move(entry));
+}
+
+void ClientManagerShard::scheduleTimer(int delayMillis, TimerEntry entry) {
+    // round up, a timer must never fire early
+    uint64_t ticks = (uint64_t(std::max(0, delayMillis)) + kTimerTickMillis - 1) / kTimerTickMillis;
+    uint64_t expireTick = currentTimerTick() + ticks;
+    bool wasEmpty;
+    {
+        std::scoped_lock lock(mTimerMutex);
+        wasEmpty = mTimers.isEmpty();
+        mTimers.schedule(expireTick, std::move(entry));
+        mPendingTimerCount.store(mTimers.size(), std::memory_order_relaxed);
+    }
+    if (wasEmpty) {
+        // the dispatcher parks for longer than a tick while there are no timers
+        wakeDispatcher();
+    }
+}
+
+void ClientManagerShard::expireTimers() {
+    uint64_t nowTick = currentTimerTick();
+    // at most one check per tick, and none at all if there is nothing to expire
+    if (mPendingTimerCount.load(std::memory_order_relaxed) == 0
+        || nowTick < mNextTimerCheckTick.load(std::memory_order_relaxed)) {
+        return;
+    }
+    mNextTimerCheckTick.store(nowTick + 1, std::memory_order_relaxed);
+    {
+        std::scoped_lock lock(mTimerMutex);
+        mTimers.advance(nowTick, [this](TimerEntry &&entry) {
+            mExpiredTimers.emplace_back(std::move(entry));
+        });
+        mPendingTimerCount.store(mTimers.size(), std::memory_order_relaxed);
+    }
+    // run the timers without holding the lock, they may schedule new ones
+    for (auto &entry: mExpiredTimers) {
+        if (entry.task) {
+            entry.task();
+        } else {
+            mSessionManager->onRequestDeadline(entry.requestId);
+        }
+    }
+    mExpiredTimers.clear();
+}
+
+ClientManagerShard::LooperStatistics ClientManagerShard::getStatistics() const {
+    LooperStatistics stats;
+    stats.shardIndex = mIndex;
+    stats.sessionCount = getSessionCount();
+    stats.queueDepth = mResponseQueue.size();
+    stats.queueCapacity = mResponseQueue.capacity();
+    stats.maxQueueDepth = mMaxQueueDepth.load(std::memory_order_relaxed);
+    stats.receivedCount = mReceivedCount.load(std::memory_order_relaxed);
+    stats.receiveBatchCount = mReceiveBatchCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < kBatchHistogramBuckets; i++) {
+        stats.receiveBatchSizeHistogram[i] = mReceiveBatchSizeHistogram[i].load(std::memory_order_relaxed);
+    }
+    stats.receiverStallCount = mReceiverStallCount.load(std::memory_order_relaxed);
+    stats.receiverStallTimeMicros = mReceiverStallTimeMicros.load(std::memory_order_relaxed);
+    stats.maxDispatchTimeMicros = mMaxDispatchTimeMicros.load(std::memory_order_relaxed);
+    stats.pendingTimerCount = mPendingTimerCount.load(std::memory_order_relaxed);
+    return stats;
+}
+
+}
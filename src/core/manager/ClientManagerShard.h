@@ -0,0 +1,177 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_CLIENTMANAGERSHARD_H
+#define NEOGROUPCAPTCHABOT_CLIENTMANAGERSHARD_H
+
+#include <array>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <pthread.h>
+#include <condition_variable>
+
+#include <td/telegram/Client.h>
+
+#include "utils/SpscRingBuffer.h"
+#include "utils/TimingWheel.h"
+#include "TdTransport.h"
+
+namespace core {
+
+class SessionManager;
+
+/**
+ * One TDLib transport, normally a td::ClientManager, together with its own receive thread and dispatcher thread.
+ * Sessions are bound to the shard they were created on for their whole lifetime.
+ */
+class ClientManagerShard {
+public:
+    // bucket i counts receive batches with a size in [2^i, 2^(i+1)), the last bucket is open-ended
+    static constexpr int kBatchHistogramBuckets = 12;
+
+    struct LooperStatistics {
+        int shardIndex = 0;
+        int sessionCount = 0;
+        // responses currently waiting for the dispatcher
+        size_t queueDepth = 0;
+        size_t queueCapacity = 0;
+        size_t maxQueueDepth = 0;
+        uint64_t receivedCount = 0;
+        uint64_t receiveBatchCount = 0;
+        std::array<uint64_t, kBatchHistogramBuckets> receiveBatchSizeHistogram = {};
+        // how often and how long the receive thread was blocked because the queue was full
+        uint64_t receiverStallCount = 0;
+        uint64_t receiverStallTimeMicros = 0;
+        // the slowest single dispatchResponse call
+        uint64_t maxDispatchTimeMicros = 0;
+        // timers which have not expired yet: delayed tasks and request deadlines,
+        // including the deadlines of already completed requests
+        size_t pendingTimerCount = 0;
+    };
+
+    ClientManagerShard() = delete;
+
+    /**
+     * @param sessionManager the owner
+     * @param index the index of this shard
+     * @param maxReceiveBatchSize the maximum number of responses drained from TDLib before they are handed to the dispatcher
+     * @param transport the transport of this shard
+     */
+    explicit ClientManagerShard(SessionManager *sessionManager, int index, int maxReceiveBatchSize,
+                                std::unique_ptr<TdTransport> transport);
+
+    ~ClientManagerShard();
+
+    ClientManagerShard(const ClientManagerShard &) = delete;
+
+    ClientManagerShard &operator=(const ClientManagerShard &) = delete;
+
+    [[nodiscard]] TdTransport *getTransport() const noexcept;
+
+    [[nodiscard]] int getIndex() const noexcept;
+
+    [[nodiscard]] int getSessionCount() const noexcept;
+
+    /**
+     * Create a new TDLib client id on this shard and account it to the shard load.
+     * Client ids are unique across all td::ClientManager instances in the process.
+     */
+    int32_t createClientId();
+
+    /**
+     * Start the receive and dispatcher threads, does nothing if they are already running.
+     */
+    void start();
+
+    /**
+     * Stop and join the receive and dispatcher threads.
+     */
+    void stop();
+
+    /**
+     * Track a deadline for a request sent on this shard.
+     * When the deadline passes, the dispatcher thread asks the SessionManager to time out the request,
+     * which is a no-op if the request has been completed in the meantime.
+     * @param requestId the request id
+     * @param timeoutMillis the timeout in milliseconds, must be positive
+     */
+    void scheduleDeadline(uint64_t requestId, int timeoutMillis);
+
+    /**
+     * Run a task on the dispatcher thread of this shard after a delay.
+     * The task should be short, e.g. hand work over to an executor.
+     * @param delayMillis the delay in milliseconds
+     * @param task the task
+     */
+    void scheduleTask(int delayMillis, std::function<void()> task);
+
+    [[nodiscard]] LooperStatistics getStatistics() const;
+
+private:
+    // resolution of request deadlines and delayed tasks
+    static constexpr uint64_t kTimerTickMillis = 10;
+
+    // either a request deadline or a delayed task
+    struct TimerEntry {
+        uint64_t requestId = 0;
+        std::function<void()> task;
+    };
+
+    static uint64_t currentTimerTick();
+
+    void scheduleTimer(int delayMillis, TimerEntry entry);
+
+    void expireTimers();
+
+    static void runLooper(ClientManagerShard *shard);
+
+    static void runDispatcher(ClientManagerShard *shard);
+
+    void enqueueResponse(td::ClientManager::Response &&response);
+
+    void wakeDispatcher();
+
+    void recordBatchSize(int batchSize);
+
+    static constexpr size_t kResponseQueueCapacity = 4096;
+
+    SessionManager *mSessionManager;
+    const int mIndex;
+    const int mMaxReceiveBatchSize;
+    std::unique_ptr<TdTransport> mTransport;
+    std::mutex mStartMutex;
+    pthread_t mWorkerThread = 0;
+    pthread_t mDispatcherThread = 0;
+    std::atomic_bool mLooperRunning = false;
+    std::atomic_int mSessionCount = 0;
+    // responses handed from the receive thread to the dispatcher thread
+    utils::SpscRingBuffer<td::ClientManager::Response> mResponseQueue =
+            utils::SpscRingBuffer<td::ClientManager::Response>(kResponseQueueCapacity);
+    std::mutex mDispatchMutex;
+    std::condition_variable mDispatchCondition;
+    std::condition_variable mReceiverCondition;
+    std::atomic_bool mDispatcherParked = false;
+    std::atomic_bool mReceiverParked = false;
+    std::atomic_size_t mMaxQueueDepth = 0;
+    std::atomic_uint64_t mReceivedCount = 0;
+    std::atomic_uint64_t mReceiveBatchCount = 0;
+    std::array<std::atomic_uint64_t, kBatchHistogramBuckets> mReceiveBatchSizeHistogram = {};
+    std::atomic_uint64_t mReceiverStallCount = 0;
+    std::atomic_uint64_t mReceiverStallTimeMicros = 0;
+    std::atomic_uint64_t mMaxDispatchTimeMicros = 0;
+    mutable std::mutex mTimerMutex;
+    utils::TimingWheel<TimerEntry> mTimers = utils::TimingWheel<TimerEntry>(currentTimerTick());
+    std::atomic_size_t mPendingTimerCount = 0;
+    std::atomic_uint64_t mNextTimerCheckTick = 0;
+    // dispatcher thread only
+    std::vector<TimerEntry> mExpiredTimers;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_CLIENTMANAGERSHARD_H
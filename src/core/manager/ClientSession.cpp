@@ -2,21 +2,44 @@
 // Created by kinit on 2022-02-18.
 //
 #include <iostream>
+#include <stdexcept>
 
 #include "SessionManager.h"
 #include "utils/log/Log.h"
 #include "utils/SyncUtils.h"
+#include "utils/metrics/MetricsRegistry.h"
+#include "utils/log/LogSampler.h"
 
 #include "ClientSession.h"
 
 static constexpr const auto LOG_TAG = "ClientSession";
 
 namespace td_api = td::td_api;
-using utils::async;
-using utils::Thread;
 
 namespace core {
 
+// the updates below arrive at the rate of the chat traffic, only a sample of them is logged, shared by all sessions
+static utils::LogSampler sUpdateOptionLog(LOG_TAG, "updateOption");
+static utils::LogSampler sUpdateUserLog(LOG_TAG, "updateUser");
+static utils::LogSampler sUpdateNewChatLog(LOG_TAG, "updateNewChat");
+static utils::LogSampler sUnhandledMessageLog(LOG_TAG, "unhandled updateNewMessage");
+static utils::LogSampler sUpdateSupergroupLog(LOG_TAG, "updateSupergroup");
+static utils::LogSampler sUpdateBasicGroupLog(LOG_TAG, "updateBasicGroup");
+static utils::LogSampler sUpdateDeleteMessagesLog(LOG_TAG, "updateDeleteMessages");
+static utils::LogSampler sUpdateMessageSendSucceededLog(LOG_TAG, "updateMessageSendSucceeded");
+
+static utils::metrics::Counter &getCoalescedRequestCounter() {
+    static auto &counter = utils::metrics::MetricsRegistry::getInstance().counter(
+            "ngcb_coalesced_requests_total", "Reads which shared the response of an identical read in flight");
+    return counter;
+}
+
+static utils::metrics::Counter &getCoalescerSentRequestCounter() {
+    static auto &counter = utils::metrics::MetricsRegistry::getInstance().counter(
+            "ngcb_coalescable_sent_requests_total", "Reads which could have been coalesced but were sent");
+    return counter;
+}
+
 static std::string optionValueToString(const td_api::object_ptr<td_api::OptionValue> &option_value) {
     if (option_value == nullptr) {
         return "<null>";
@@ -142,217 +165,466 @@ static std::string messageToString(const td_api::message *msg) {
     return result;
 }
 
-ClientSession::ClientSession(SessionManager *sessionManager, int32_t id, const TdLibParameters &param)
-        : mSessionManager(sessionManager), mTdLibParameters(param), mTdLibObjectId(id) {}
+ClientSession::ClientSession(SessionManager *sessionManager, int32_t id, const TdLibParameters &param,
+                             std::optional<CatchUpBuffer::Policy> catchUpPolicy)
+        : mSessionManager(sessionManager), mTdLibParameters(param), mTdLibObjectId(id) {
+    if (catchUpPolicy.has_value()) {
+        mCatchUpBuffer = std::make_unique<CatchUpBuffer>(*catchUpPolicy);
+        mCatchingUp = true;
+    }
+    mCoroutineExecutor = [sessionManager](std::function<void()> task) {
+        sessionManager->getExecutors().execute(std::move(task));
+    };
+}
 
 int ClientSession::getTdLibObjectId() const {
     return mTdLibObjectId;
 }
 
-void ClientSession::execute(td::td_api::object_ptr<td::td_api::Function> request,
-                            std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback) {
-    mSessionManager->sendRequestWithClientId(mTdLibObjectId, std::move(request), std::move(callback));
+int64_t ClientSession::getUserId() const noexcept {
+    return mUserId;
 }
 
-void ClientSession::execute(td::td_api::object_ptr<td::td_api::Function> request, nullptr_t) {
-    mSessionManager->sendRequestWithClientId(mTdLibObjectId, std::move(request), nullptr);
+void ClientSession::execute(td::td_api::object_ptr<td::td_api::Function> request,
+                            std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback, int timeoutMillis) {
+    RequestOptions options;
+    options.timeoutMillis = timeoutMillis;
+    execute(std::move(request), std::move(callback), options);
 }
 
-void ClientSession::terminate() {
-    mSessionManager->terminateSession(getTdLibObjectId());
+void ClientSession::execute(td::td_api::object_ptr<td::td_api::Function> request,
+                            std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback,
+                            const RequestOptions &options) {
+    if (request != nullptr && callback) {
+        if (auto key = RequestCoalescer::getKey(*request); key.has_value()) {
+            uint64_t token = 0;
+            if (mCoalescer.join(*key, callback, token, options.timeoutMillis)) {
+                getCoalescedRequestCounter().increment();
+                // a queued request keeps its own timeout, even if the one in flight has a longer one
+                if (options.timeoutMillis > 0) {
+                    mSessionManager->postDelayed(mTdLibObjectId, options.timeoutMillis, [this, key = *key, token]() {
+                        mCoalescer.expire(key, token);
+                    });
+                }
+                return;
+            }
+            getCoalescerSentRequestCounter().increment();
+            callback = [this, key = *key, token, callback = std::move(callback)](td::td_api::object_ptr<td::td_api::Object> object) {
+                mCoalescer.complete(key, token, std::move(object), callback);
+            };
+            try {
+                // if the response is lost, the requests queued behind this one fail on the shard timer
+                int deadlineMillis = options.timeoutMillis > 0 ? options.timeoutMillis
+                                                               : RequestCoalescer::kDefaultMaxInFlightMillis;
+                mSessionManager->postDelayed(mTdLibObjectId, deadlineMillis, [this, key = *key, token]() {
+                    mCoalescer.expire(key, token);
+                });
+                executeUncoalesced(std::move(request), std::move(callback), options);
+            } catch (const std::exception &e) {
+                // release the requests queued behind this one, the caller gets the exception
+                mCoalescer.complete(*key, token, td::td_api::make_object<td::td_api::error>(500, e.what()), nullptr);
+                throw;
+            }
+            return;
+        }
+    }
+    executeUncoalesced(std::move(request), std::move(callback), options);
 }
 
-void ClientSession::onTerminate() {
-    // nothing
+void ClientSession::executeUncoalesced(td::td_api::object_ptr<td::td_api::Function> request,
+                                       std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback,
+                                       const RequestOptions &options) {
+    if (request != nullptr && options.chatId == 0) {
+        // the caller did not say, so the global and per-chat limits still apply to e.g. sendMessage
+        int64_t chatId = getRequestChatId(*request);
+        if (chatId != 0) {
+            RequestOptions chatOptions = options;
+            chatOptions.chatId = chatId;
+            executeUncoalesced(std::move(request), std::move(callback), chatOptions);
+            return;
+        }
+    }
+    if (request != nullptr && mRateLimiter.isLimited(request->get_id(), options.chatId)) {
+        executeRateLimited(std::move(request), std::move(callback), options);
+        return;
+    }
+    executeWithFlowControl(std::move(request), std::move(callback), options);
 }
 
-bool ClientSession::handleUpdate(td::td_api::object_ptr<td::td_api::Object> update) {
-    if (update == nullptr) {
-        return false;
-    }
-    int32_t updateType = update->get_id();
-    switch (updateType) {
-        case td_api::updateAuthorizationState::ID: {
-            auto updateAuthState = td_api::move_object_as<td_api::updateAuthorizationState>(std::move(update));
-            auto state = std::move(updateAuthState->authorization_state_);
-            return handleUpdateAuthorizationState(std::move(state));
-        }
-        case td_api::updateOption::ID: {
-            auto updateOption = td_api::move_object_as<td_api::updateOption>(std::move(update));
-            std::string name = updateOption->name_;
-            auto value = std::move(updateOption->value_);
-            handleUpdateOption(name, value);
-            return true;
-        }
-        case td_api::updateConnectionState::ID: {
-            auto updateConnectionState = td_api::move_object_as<td_api::updateConnectionState>(std::move(update));
-            if (updateConnectionState->state_ != nullptr) {
-                auto state = std::move(updateConnectionState->state_);
-                handleUpdateConnectionState(state->get_id());
+void ClientSession::executeRateLimited(td::td_api::object_ptr<td::td_api::Function> request,
+                                       std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback,
+                                       const RequestOptions &options) {
+    int32_t methodId = request->get_id();
+    bool mergeable = options.rateLimitPolicy == RateLimitPolicy::MERGE && options.mergeKey != 0;
+    std::shared_ptr<DelayedRequest> delayedRequest;
+    int64_t delayMicros;
+    {
+        std::unique_lock<std::mutex> mergeLock(mMergeMutex, std::defer_lock);
+        if (mergeable) {
+            mergeLock.lock();
+            auto it = mMergeableRequests.find(options.mergeKey);
+            if (it != mMergeableRequests.end()) {
+                // take over the slot of the waiting request, the replaced one is completed
+                auto &waiting = *it->second;
+                std::swap(waiting.request, request);
+                std::swap(waiting.callback, callback);
+                waiting.options = options;
+                mergeLock.unlock();
+                mRateLimiter.recordMerged();
+                if (callback) {
+                    callback(td::td_api::make_object<td::td_api::error>(kRequestMergedErrorCode, "Merged into a later request"));
+                }
+                return;
             }
-            return true;
-        }
-        case td_api::updateAnimationSearchParameters::ID: {
-            LOGD("updateAnimationSearchParameters not implemented");
-            return true;
-        }
-        case td_api::updateSelectedBackground::ID: {
-            LOGD("updateSelectedBackground not implemented");
-            return true;
-        }
-        case td_api::updateChatThemes::ID: {
-            LOGD("updateChatThemes not implemented");
-            return true;
-        }
-        case td_api::updateDiceEmojis::ID: {
-            LOGD("updateDiceEmojis not implemented");
-            return true;
-        }
-        case td_api::updateRecentStickers::ID: {
-            LOGD("updateRecentStickers not implemented");
-            return true;
-        }
-        case td_api::updateHavePendingNotifications::ID: {
-            LOGI("TODO: updateHavePendingNotifications not implemented");
-            return true;
-        }
-        case td_api::updateChatFilters::ID: {
-            LOGW("TODO: updateChatFilters not implemented");
-            return true;
-        }
-        case td_api::updateChatActionBar::ID: {
-            LOGW("TODO: updateChatActionBar not implemented");
-            return true;
-        }
-        case td_api::updateChatTitle::ID: {
-            LOGW("TODO: updateChatTitle not implemented");
-            return true;
-        }
-        case td_api::updateScopeNotificationSettings::ID: {
-            LOGI("TODO: updateScopeNotificationSettings not implemented");
-            return true;
-        }
-        case td_api::updateChatMessageTtl::ID: {
-            LOGI("TODO: updateChatMessageTtl not implemented");
-            return true;
-        }
-        case td_api::updateReactions::ID: {
-            LOGW("TODO: updateReactions not implemented");
-            return true;
-        }
-        case td_api::updateMessageContent::ID: {
-            LOGW("TODO: updateMessageContent not implemented");
-            return true;
-        }
-        case td_api::updateMessageEdited::ID: {
-            LOGW("TODO: updateMessageEdited not implemented");
-            return true;
-        }
-        case td_api::updateChatLastMessage::ID: {
-            return true;
-        }
-        case td_api::updateChatReadInbox::ID: {
-            LOGI("TODO: updateChatReadInbox not implemented");
-            return true;
-        }
-        case td_api::updateChatReadOutbox::ID: {
-            LOGI("TODO: updateChatReadOutbox not implemented");
-            return true;
-        }
-        case td_api::updateChatNotificationSettings::ID: {
-            LOGI("TODO: updateChatNotificationSettings not implemented");
-            return true;
-        }
-        case td_api::updateChatPosition::ID: {
-            return true;
-        }
-        case td_api::updateSupergroupFullInfo::ID: {
-            LOGW("TODO: updateSupergroupFullInfo not implemented");
-            return true;
         }
-        case td_api::updateChatUnreadMentionCount::ID: {
-            LOGW("TODO: updateChatUnreadMentionCount not implemented");
-            return true;
-        }
-        case td_api::updateMessageMentionRead::ID: {
-            LOGD("updateMessageMentionRead not implemented");
-            return true;
-        }
-        case td_api::updateMessageIsPinned::ID: {
-            return true;
-        }
-        case td_api::updateChatVideoChat::ID: {
-            LOGW("TODO: updateChatVideoChat not implemented");
-            return true;
-        }
-        case td_api::updateUserStatus::ID: {
-            return true;
-        }
-        case td_api::updateChatAction::ID: {
-            return true;
+        delayMicros = mRateLimiter.acquire(methodId, options.chatId, options.rateLimitPolicy != RateLimitPolicy::DROP);
+        if (delayMicros > 0) {
+            delayedRequest = std::make_shared<DelayedRequest>();
+            delayedRequest->request = std::move(request);
+            delayedRequest->callback = std::move(callback);
+            delayedRequest->options = options;
+            if (mergeable) {
+                mMergeableRequests[options.mergeKey] = delayedRequest;
+            }
         }
-        case td_api::updateUserFullInfo::ID: {
-            LOGW("TODO: updateUserFullInfo not implemented");
-            return true;
+    }
+    if (delayMicros == RateLimiter::kRejected) {
+        if (callback) {
+            callback(td::td_api::make_object<td::td_api::error>(kRateLimitedErrorCode, "Rate limit exceeded"));
         }
-        case td_api::updateChatAvailableReactions::ID: {
-            LOGI("TODO: updateChatAvailableReactions not implemented");
-            return true;
+        return;
+    }
+    if (delayMicros == 0) {
+        executeWithFlowControl(std::move(request), std::move(callback), options);
+        return;
+    }
+    // round up, the timer must not fire before the tokens are there
+    int delayMillis = int((delayMicros + 999) / 1000);
+    mSessionManager->postDelayed(mTdLibObjectId, delayMillis, [this, delayedRequest]() {
+        const auto &options = delayedRequest->options;
+        if (options.rateLimitPolicy == RateLimitPolicy::MERGE && options.mergeKey != 0) {
+            std::scoped_lock lock(mMergeMutex);
+            auto it = mMergeableRequests.find(options.mergeKey);
+            if (it != mMergeableRequests.end() && it->second == delayedRequest) {
+                mMergeableRequests.erase(it);
+            }
         }
-        case td_api::updateChatUnreadReactionCount::ID: {
-            return true;
+        // no one can merge into the request any more, so it is safe to take it apart without the lock
+        executeWithFlowControl(std::move(delayedRequest->request), std::move(delayedRequest->callback), delayedRequest->options);
+    });
+}
+
+void ClientSession::executeWithFlowControl(td::td_api::object_ptr<td::td_api::Function> request,
+                                           std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback,
+                                           const RequestOptions &options) {
+    if (!mFlowController.isEnabled()) {
+        mSessionManager->sendRequestWithClientId(mTdLibObjectId, std::move(request), std::move(callback), options.timeoutMillis);
+        return;
+    }
+    // the slot is returned when the response arrives, even if nobody is interested in the response
+    int64_t chatId = options.chatId;
+    int timeoutMillis = options.timeoutMillis;
+    std::function<void(td::td_api::object_ptr<td::td_api::Object>)> releasingCallback =
+            [this, chatId, callback = std::move(callback)](td::td_api::object_ptr<td::td_api::Object> result) {
+                mFlowController.release(chatId);
+                if (callback) {
+                    callback(std::move(result));
+                }
+            };
+    if (mFlowController.tryAcquire(chatId)) {
+        try {
+            mSessionManager->sendRequestWithClientId(mTdLibObjectId, std::move(request), std::move(releasingCallback), timeoutMillis);
+        } catch (...) {
+            // the callback will never run, so it can't return the slot
+            mFlowController.release(chatId);
+            throw;
         }
-        case td_api::updateChatMessageSender::ID: {
-            LOGW("TODO: updateChatMessageSender not implemented");
-            return true;
+        return;
+    }
+    // std::function must be copyable, td_api objects are not
+    auto pendingRequest = std::make_shared<td::td_api::object_ptr<td::td_api::Function>>(std::move(request));
+    mFlowController.enqueue(chatId, options.priority, [this, chatId, timeoutMillis, pendingRequest,
+            releasingCallback = std::move(releasingCallback)]() mutable {
+        try {
+            mSessionManager->sendRequestWithClientId(mTdLibObjectId, std::move(*pendingRequest),
+                                                     std::move(releasingCallback), timeoutMillis);
+        } catch (const std::exception &e) {
+            LOGE("Failed to send queued request: %s", e.what());
+            mFlowController.release(chatId);
         }
-        case td_api::updateMessageInteractionInfo::ID: {
-            LOGD("TODO: updateMessageInteractionInfo not implemented");
-            return true;
+    });
+}
+
+void ClientSession::execute(td::td_api::object_ptr<td::td_api::Function> request, nullptr_t) {
+    // through the rate limiter and flow control like every other request
+    execute(std::move(request), std::function<void(td::td_api::object_ptr<td::td_api::Object>)>(), RequestOptions());
+}
+
+void ClientSession::setFlowControlLimits(int maxOutstanding, int maxOutstandingPerChat) {
+    mFlowController.setLimits(maxOutstanding, maxOutstandingPerChat);
+}
+
+ClientSession::FlowControlStatistics ClientSession::getFlowControlStatistics() const {
+    return mFlowController.getStatistics();
+}
+
+void ClientSession::executeWithRetry(std::function<td::td_api::object_ptr<td::td_api::Function>()> requestFactory,
+                                     std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback,
+                                     const RequestOptions &options, int maxRetries) {
+    if (!requestFactory) {
+        throw std::invalid_argument("request factory must not be null");
+    }
+    auto state = std::make_shared<RetryState>();
+    state->requestFactory = std::move(requestFactory);
+    state->callback = std::move(callback);
+    state->options = options;
+    state->maxRetries = std::max(0, maxRetries);
+    sendRetryAttempt(state);
+}
+
+void ClientSession::sendRetryAttempt(const std::shared_ptr<RetryState> &state) {
+    auto request = state->requestFactory();
+    int32_t methodId = request->get_id();
+    execute(std::move(request), [this, state, methodId](td::td_api::object_ptr<td::td_api::Object> result) {
+        if (result != nullptr && result->get_id() == td_api::error::ID) {
+            const auto *error = static_cast<const td_api::error *>(result.get());
+            int retryAfter = RateLimiter::parseRetryAfterSeconds(error->code_, error->message_);
+            if (retryAfter >= 0) {
+                // keep the rest of the traffic of the chat or method away for the advertised window
+                mRateLimiter.pause(methodId, state->options.chatId, int64_t(retryAfter) * 1000);
+                bool retry = state->attempt < state->maxRetries && retryAfter <= kMaxRetryAfterSeconds;
+                mRateLimiter.recordFloodWait(retryAfter, retry);
+                if (retry) {
+                    state->attempt++;
+                    LOGW("FLOOD_WAIT %d s for method %d chat %ld, retry %d/%d",
+                         retryAfter, methodId, state->options.chatId, state->attempt, state->maxRetries);
+                    mSessionManager->postDelayed(mTdLibObjectId, retryAfter * 1000, [this, state]() {
+                        sendRetryAttempt(state);
+                    });
+                    return;
+                }
+                LOGW("FLOOD_WAIT %d s for method %d chat %ld, giving up after %d retries",
+                     retryAfter, methodId, state->options.chatId, state->attempt);
+            }
         }
-        case td_api::updateUser::ID: {
-            auto updateUser = td_api::move_object_as<td_api::updateUser>(std::move(update));
-            handleUpdateUser(std::move(updateUser->user_));
-            return true;
+        if (state->callback) {
+            state->callback(std::move(result));
         }
-        case td_api::updateNewChat::ID: {
-            auto updateNewChat = td_api::move_object_as<td_api::updateNewChat>(std::move(update));
-            handleUpdateNewChat(std::move(updateNewChat->chat_));
-            return true;
+    }, state->options);
+}
+
+void ClientSession::setRateLimits(const RateLimiter::Config &config) {
+    mRateLimiter.setConfig(config);
+}
+
+ClientSession::RateLimitStatistics ClientSession::getRateLimitStatistics() const {
+    return mRateLimiter.getStatistics();
+}
+
+ClientSession::CoalescingStatistics ClientSession::getCoalescingStatistics() const {
+    return mCoalescer.getStatistics();
+}
+
+void ClientSession::executeGroup(std::vector<td::td_api::object_ptr<td::td_api::Function>> requests,
+                                 std::function<void(std::vector<td::td_api::object_ptr<td::td_api::Object>>)> callback,
+                                 bool failFast, int timeoutMillis) {
+    RequestOptions options;
+    options.timeoutMillis = timeoutMillis;
+    executeGroup(std::move(requests), std::move(callback), failFast, options);
+}
+
+void ClientSession::executeGroup(std::vector<td::td_api::object_ptr<td::td_api::Function>> requests,
+                                 std::function<void(std::vector<td::td_api::object_ptr<td::td_api::Object>>)> callback,
+                                 bool failFast, const RequestOptions &options) {
+    auto group = std::make_shared<DelayedGroup>();
+    group->requests = std::move(requests);
+    group->callback = std::move(callback);
+    group->failFast = failFast;
+    group->options = options;
+    if (options.chatId == 0) {
+        // only if every member is about the same chat
+        int64_t chatId = 0;
+        for (const auto &request: group->requests) {
+            int64_t requestChatId = request != nullptr ? getRequestChatId(*request) : 0;
+            if (requestChatId == 0 || (chatId != 0 && requestChatId != chatId)) {
+                chatId = 0;
+                break;
+            }
+            chatId = requestChatId;
         }
-        case td_api::updateNewMessage::ID: {
-            auto updateNewMessage = td_api::move_object_as<td_api::updateNewMessage>(std::move(update));
-            handleUpdateNewMessage(std::move(updateNewMessage->message_));
-            return true;
+        group->options.chatId = chatId;
+    }
+    std::vector<int32_t> limitedMethodIds;
+    for (const auto &request: group->requests) {
+        if (request != nullptr && mRateLimiter.isLimited(request->get_id(), group->options.chatId)) {
+            limitedMethodIds.push_back(request->get_id());
         }
-        case td_api::updateBasicGroup::ID: {
-            auto updateBasicGroup = td_api::move_object_as<td_api::updateBasicGroup>(std::move(update));
-            handleUpdateBasicGroup(std::move(updateBasicGroup->basic_group_));
-            return true;
+    }
+    int64_t delayMicros = 0;
+    if (!limitedMethodIds.empty()) {
+        // all or nothing, a rejected group takes no tokens
+        delayMicros = mRateLimiter.acquire(limitedMethodIds, group->options.chatId,
+                                           options.rateLimitPolicy != RateLimitPolicy::DROP);
+    }
+    if (delayMicros == RateLimiter::kRejected) {
+        if (group->callback) {
+            std::vector<td::td_api::object_ptr<td::td_api::Object>> results(group->requests.size());
+            for (auto &result: results) {
+                result = td::td_api::make_object<td::td_api::error>(kRateLimitedErrorCode, "Rate limit exceeded");
+            }
+            group->callback(std::move(results));
         }
-        case td_api::updateSupergroup::ID: {
-            auto updateSupergroup = td_api::move_object_as<td_api::updateSupergroup>(std::move(update));
-            handleUpdateSupergroup(std::move(updateSupergroup->supergroup_));
-            return true;
+        return;
+    }
+    if (delayMicros == 0) {
+        executeGroupWithFlowControl(group);
+        return;
+    }
+    // round up, the timer must not fire before the tokens are there
+    int delayMillis = int((delayMicros + 999) / 1000);
+    mSessionManager->postDelayed(mTdLibObjectId, delayMillis, [this, group]() {
+        executeGroupWithFlowControl(group);
+    });
+}
+
+void ClientSession::executeGroupWithFlowControl(const std::shared_ptr<DelayedGroup> &group) {
+    if (!mFlowController.isEnabled()) {
+        mSessionManager->sendRequestGroup(mTdLibObjectId, std::move(group->requests), std::move(group->callback),
+                                          group->failFast, group->options.timeoutMillis);
+        return;
+    }
+    // every member holds a slot, they are returned once the last member is answered or timed out
+    int64_t chatId = group->options.chatId;
+    size_t count = group->requests.size();
+    auto send = [this, chatId, count, group]() {
+        try {
+            mSessionManager->sendRequestGroup(mTdLibObjectId, std::move(group->requests), std::move(group->callback),
+                                              group->failFast, group->options.timeoutMillis,
+                                              [this, chatId, count]() {
+                                                  mFlowController.release(chatId, count);
+                                              });
+        } catch (...) {
+            // nothing is called back if the group could not be sent
+            mFlowController.release(chatId, count);
+            throw;
         }
-        case td_api::updateDeleteMessages::ID: {
-            auto updateDeleteMessages = td_api::move_object_as<td_api::updateDeleteMessages>(std::move(update));
-            handleUpdateDeleteMessages(std::move(updateDeleteMessages));
-            return true;
+    };
+    if (mFlowController.tryAcquire(chatId, count)) {
+        send();
+        return;
+    }
+    mFlowController.enqueue(chatId, group->options.priority, [send = std::move(send)]() {
+        try {
+            send();
+        } catch (const std::exception &e) {
+            LOGE("Failed to send queued request group: %s", e.what());
         }
-        case td_api::updateMessageSendSucceeded::ID: {
-            auto updateMessageSendSucceeded = td_api::move_object_as<td_api::updateMessageSendSucceeded>(std::move(update));
-            handleUpdateMessageSendSucceeded(std::move(updateMessageSendSucceeded));
-            return true;
+    }, count);
+}
+
+ClientSession::RequestAwaiter::RequestAwaiter(ClientSession *session, td::td_api::object_ptr<td::td_api::Function> request,
+                                             int timeoutMillis)
+        : mSession(session), mRequest(std::move(request)), mTimeoutMillis(timeoutMillis) {}
+
+void ClientSession::RequestAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    // the coroutine may be resumed on another thread before execute() returns, don't touch this afterwards
+    ClientSession *session = mSession;
+    session->execute(std::move(mRequest), [this, session, handle](td_api::object_ptr<td_api::Object> result) {
+        mResult = std::move(result);
+        session->resumeOnExecutor(handle);
+    }, mTimeoutMillis);
+}
+
+void ClientSession::DelayAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    ClientSession *session = mSession;
+    session->mSessionManager->postDelayed(session->mTdLibObjectId, mDelayMillis, [session, handle]() {
+        session->resumeOnExecutor(handle);
+    });
+}
+
+ClientSession::RequestAwaiter ClientSession::request(td::td_api::object_ptr<td::td_api::Function> request, int timeoutMillis) {
+    return {this, std::move(request), timeoutMillis};
+}
+
+ClientSession::DelayAwaiter ClientSession::delay(int delayMillis) {
+    return {this, delayMillis};
+}
+
+void ClientSession::postDelayed(int delayMillis, std::function<void()> task) {
+    mSessionManager->postDelayed(mTdLibObjectId, delayMillis, [this, task = std::move(task)]() mutable {
+        mCoroutineExecutor(std::move(task));
+    });
+}
+
+void ClientSession::setCoroutineExecutor(utils::Executor executor) {
+    if (!executor) {
+        throw std::invalid_argument("executor must not be null");
+    }
+    mCoroutineExecutor = std::move(executor);
+}
+
+void ClientSession::resumeOnExecutor(std::coroutine_handle<> handle) {
+    mCoroutineExecutor([handle]() {
+        handle.resume();
+    });
+}
+
+void ClientSession::terminate() {
+    mSessionManager->terminateSession(getTdLibObjectId());
+}
+
+void ClientSession::onTerminate() {
+    // nothing
+}
+
+bool ClientSession::handleUpdate(td::td_api::object_ptr<td::td_api::Object> update) {
+    if (update == nullptr) {
+        return false;
+    }
+    return mSessionManager->getUpdateRouter().dispatch(this, *update);
+}
+
+void ClientSession::registerUpdateSubscribers(UpdateRouter::Builder &builder) {
+    builder.subscribe<td_api::updateAuthorizationState>([](ClientSession *session, td_api::updateAuthorizationState &update) {
+        session->handleUpdateAuthorizationState(update.authorization_state_.get());
+    });
+    builder.subscribe<td_api::updateOption>([](ClientSession *session, td_api::updateOption &update) {
+        session->handleUpdateOption(update.name_, update.value_);
+    });
+    builder.subscribe<td_api::updateConnectionState>([](ClientSession *session, td_api::updateConnectionState &update) {
+        if (update.state_ != nullptr) {
+            session->handleUpdateConnectionState(update.state_->get_id());
         }
-        default: {
-            LOGE("Unknown update: id = %d", updateType);
-            return false;
+    });
+    builder.subscribe<td_api::updateUser>([](ClientSession *session, td_api::updateUser &update) {
+        session->handleUpdateUser(update.user_.get());
+    });
+    builder.subscribe<td_api::updateNewChat>([](ClientSession *session, td_api::updateNewChat &update) {
+        session->handleUpdateNewChat(update.chat_.get());
+    });
+    builder.subscribe<td_api::updateNewMessage>([](ClientSession *session, td_api::updateNewMessage &update) {
+        if (session->mCatchUpBuffer != nullptr && update.message_ != nullptr && !update.message_->is_outgoing_) {
+            // handled when the connection is ready, later subscribers see a null message
+            session->mCatchUpBuffer->add(std::move(update.message_));
+            return;
         }
-    }
+        session->handleUpdateNewMessage(update.message_.get());
+    });
+    builder.subscribe<td_api::updateBasicGroup>([](ClientSession *session, td_api::updateBasicGroup &update) {
+        session->handleUpdateBasicGroup(update.basic_group_.get());
+    });
+    builder.subscribe<td_api::updateSupergroup>([](ClientSession *session, td_api::updateSupergroup &update) {
+        session->handleUpdateSupergroup(update.supergroup_.get());
+    });
+    builder.subscribe<td_api::updateDeleteMessages>([](ClientSession *session, td_api::updateDeleteMessages &update) {
+        session->handleUpdateDeleteMessages(&update);
+    });
+    builder.subscribe<td_api::updateMessageSendSucceeded>([](ClientSession *session, td_api::updateMessageSendSucceeded &update) {
+        session->handleUpdateMessageSendSucceeded(&update);
+    });
 }
 
-bool ClientSession::handleUpdateAuthorizationState(td::td_api::object_ptr<td::td_api::AuthorizationState> object) {
+bool ClientSession::handleUpdateAuthorizationState(const td::td_api::AuthorizationState *object) {
     if (object == nullptr) {
         return false;
     }
@@ -369,80 +641,39 @@ bool ClientSession::handleUpdateAuthorizationState(td::td_api::object_ptr<td::td
             return true;
         }
         case td_api::authorizationStateWaitPhoneNumber::ID: {
-            // check if we already have bot token
-            if (mAuthState == AuthorizationState::INITIALIZATION) {
-                // if we have access token, try to use it
-                if (!mAuthBotToken.empty()) {
-                    // send bot token
-                    LOGD("try auth with bot token");
-                    execute(td_api::make_object<td_api::checkAuthenticationBotToken>(mAuthBotToken), [this](auto result) {
-                        if (result->get_id() == td_api::error::ID) {
-                            auto error = td_api::move_object_as<td_api::error>(result);
-                            LOGE("Error checking authentication bot token: %s", error->message_.c_str());
-                            mAuthState = AuthorizationState::BAD_TOKEN;
-                        } else {
-                            if (result->get_id() == td_api::ok::ID) {
-                                auto ok = td_api::move_object_as<td_api::ok>(result);
-                                LOGD("auth success");
-                                mAuthState = AuthorizationState::AUTHORIZED;
-                            } else {
-                                LOGE("Unexpected result checking authentication bot token: %d", result->get_id());
-                                mAuthState = AuthorizationState::BAD_TOKEN;
-                            }
-                        }
-                    });
-                    mAuthBotToken.clear();
-                    mAuthState = AuthorizationState::WAIT_RESPONSE;
-                } else if (!mAuthUserPhone.empty()) {
-                    // send phone number
-                    LOGD("try auth with phone number");
-                    auto authSettings = td_api::make_object<td_api::phoneNumberAuthenticationSettings>(false, false, false, false, std::vector<std::string>());
-                    auto request = td_api::make_object<td_api::setAuthenticationPhoneNumber>(mAuthUserPhone, std::move(authSettings));
-                    execute(std::move(request), [](auto resp) {
-                        int32_t result = resp->get_id();
-                        if (result == td_api::ok::ID) {
-                            return;
-                        }
-                        LOGD("setAuthenticationPhoneNumber: %d", result);
-                        if (resp->get_id() == td_api::error::ID) {
-                            auto error = td_api::move_object_as<td_api::error>(resp);
-                            LOGE("setAuthenticationPhoneNumber error: %s", error->message_.c_str());
-                        }
-                    });
-                    mAuthBotToken.clear();
-                    mAuthState = AuthorizationState::WAIT_RESPONSE;
+            // use the credentials if logIn* was called before TDLib asked for them
+            std::string botToken;
+            std::string phoneNumber;
+            {
+                std::scoped_lock lock(mAuthCredentialMutex);
+                botToken.swap(mAuthBotToken);
+                if (botToken.empty()) {
+                    phoneNumber.swap(mAuthUserPhone);
                 }
-                return true;
-            } else {
-                mAuthState = AuthorizationState::WAIT_TOKEN;
+                bool hasCredential = !botToken.empty() || !phoneNumber.empty();
+                setAuthorizationState(hasCredential ? AuthorizationState::WAIT_RESPONSE : AuthorizationState::WAIT_TOKEN);
+            }
+            if (!botToken.empty()) {
+                sendBotToken(botToken);
+            } else if (!phoneNumber.empty()) {
+                sendPhoneNumber(phoneNumber);
             }
             return true;
         }
         case td_api::authorizationStateReady::ID: {
-            mAuthState = AuthorizationState::AUTHORIZED;
+            setAuthorizationState(AuthorizationState::AUTHORIZED);
             LOGI("Authorization success");
             // TODO: 2022-02-20 check if we are user or bot, only set if we are user
-            async([this]() {
-                Thread::sleep(3000);
-                // set user offline after 3 seconds
-                auto request = td_api::make_object<td_api::setOption>("online", td_api::make_object<td_api::optionValueBoolean>(false));
-                execute(std::move(request), [](auto resp) {
-                    int32_t result = resp->get_id();
-                    if (result == td_api::ok::ID) {
-                        LOGI("setOption('online', false) success");
-                        return;
-                    }
-                    LOGD("setOption: %d", result);
-                    if (resp->get_id() == td_api::error::ID) {
-                        auto error = td_api::move_object_as<td_api::error>(resp);
-                        LOGE("setOption error: %s", error->message_.c_str());
-                    }
-                });
-            });
+            setOfflineAfterDelay(3000).detach();
+            return true;
+        }
+        case td_api::authorizationStateClosed::ID: {
+            LOGI("Authorization closed");
+            setAuthorizationState(AuthorizationState::CLOSED);
             return true;
         }
         case td_api::authorizationStateWaitCode::ID: {
-            mAuthState = AuthorizationState::WAIT_CODE;
+            setAuthorizationState(AuthorizationState::WAIT_CODE);
             LOGW("Authorization waiting code");
             // run on another thread
             SessionManager::getInstance().getExecutors().execute([this]() {
@@ -455,23 +686,16 @@ bool ClientSession::handleUpdateAuthorizationState(td::td_api::object_ptr<td::td
                 code.erase(std::remove(code.begin(), code.end(), '\n'), code.end());
                 if (code.empty()) {
                     LOGE("Empty code, aborting");
-                    mAuthState = AuthorizationState::WAIT_TOKEN;
+                    setAuthorizationState(AuthorizationState::WAIT_TOKEN);
                     return true;
                 }
-                execute(td_api::make_object<td_api::checkAuthenticationCode>(code), [this, code](auto result) {
-                    if (result->get_id() == td_api::error::ID) {
-                        auto error = td_api::move_object_as<td_api::error>(result);
-                        LOGE("Error checking authentication code: %s", error->message_.c_str());
-                        mAuthState = AuthorizationState::BAD_TOKEN;
+                execute(td_api::make_object<td_api::checkAuthenticationCode>(code), [this, code](TdResult<td_api::ok> result) {
+                    if (result.isError()) {
+                        LOGE("Error checking authentication code: %s", result.getError().message_.c_str());
+                        setAuthorizationState(AuthorizationState::BAD_TOKEN);
                     } else {
-                        if (result->get_id() == td_api::ok::ID) {
-                            auto ok = td_api::move_object_as<td_api::ok>(result);
-                            LOGD("send code '%s' success", code.c_str());
-                            mAuthState = AuthorizationState::WAIT_RESPONSE;
-                        } else {
-                            LOGE("Unexpected result checking authentication code: %d", result->get_id());
-                            mAuthState = AuthorizationState::BAD_TOKEN;
-                        }
+                        LOGD("send code '%s' success", code.c_str());
+                        setAuthorizationState(AuthorizationState::WAIT_RESPONSE);
                     }
                 });
                 return true;
@@ -479,7 +703,7 @@ bool ClientSession::handleUpdateAuthorizationState(td::td_api::object_ptr<td::td
             return true;
         }
         case td_api::authorizationStateWaitPassword::ID: {
-            mAuthState = AuthorizationState::WAIT_PASSWORD;
+            setAuthorizationState(AuthorizationState::WAIT_PASSWORD);
             LOGW("Authorization waiting password");
             // run on another thread
             SessionManager::getInstance().getExecutors().execute([this]() {
@@ -490,23 +714,16 @@ bool ClientSession::handleUpdateAuthorizationState(td::td_api::object_ptr<td::td
                 password.erase(std::remove(password.begin(), password.end(), '\n'), password.end());
                 if (password.empty()) {
                     LOGE("Empty password, aborting");
-                    mAuthState = AuthorizationState::WAIT_TOKEN;
+                    setAuthorizationState(AuthorizationState::WAIT_TOKEN);
                     return true;
                 }
-                execute(td_api::make_object<td_api::checkAuthenticationPassword>(password), [this, password](auto result) {
-                    if (result->get_id() == td_api::error::ID) {
-                        auto error = td_api::move_object_as<td_api::error>(result);
-                        LOGE("Error checking authentication password: %s", error->message_.c_str());
-                        mAuthState = AuthorizationState::BAD_TOKEN;
+                execute(td_api::make_object<td_api::checkAuthenticationPassword>(password), [this, password](TdResult<td_api::ok> result) {
+                    if (result.isError()) {
+                        LOGE("Error checking authentication password: %s", result.getError().message_.c_str());
+                        setAuthorizationState(AuthorizationState::BAD_TOKEN);
                     } else {
-                        if (result->get_id() == td_api::ok::ID) {
-                            auto ok = td_api::move_object_as<td_api::ok>(result);
-                            LOGD("send password <length=%d> success", int(password.size()));
-                            mAuthState = AuthorizationState::WAIT_RESPONSE;
-                        } else {
-                            LOGE("Unexpected result checking authentication password: %d", result->get_id());
-                            mAuthState = AuthorizationState::BAD_TOKEN;
-                        }
+                        LOGD("send password <length=%d> success", int(password.size()));
+                        setAuthorizationState(AuthorizationState::WAIT_RESPONSE);
                     }
                 });
                 return true;
@@ -523,7 +740,7 @@ bool ClientSession::handleUpdateAuthorizationState(td::td_api::object_ptr<td::td
 void ClientSession::handleUpdateOption(const std::string &name, const td_api::object_ptr<td_api::OptionValue> &object) {
     if (name == "my_id" && object->get_id() == td_api::optionValueInteger::ID) {
         mUserId = static_cast<const td_api::optionValueInteger *>(object.get())->value_;
-        LOGD("my_id = %ld", mUserId);
+        LOGD("my_id = %ld", mUserId.load());
     } else if (name == "authorization_date" && object->get_id() == td_api::optionValueInteger::ID) {
         mAuthorizationDate = static_cast<const td_api::optionValueInteger *>(object.get())->value_;
         LOGD("authorization_date = %ld", mAuthorizationDate);
@@ -533,7 +750,20 @@ void ClientSession::handleUpdateOption(const std::string &name, const td_api::ob
         mServerTimeDeltaSeconds = serverTimeSeconds - localTimeSeconds;
         LOGD("server time delta = %ld", mServerTimeDeltaSeconds);
     } else {
-        LOGI("ignore update option: %s = %s", name.c_str(), optionValueToString(object).c_str());
+        LOG_SAMPLED(sUpdateOptionLog, Log::Level::INFO, "ignore update option: %s = %s", name.c_str(),
+                    optionValueToString(object).c_str());
+    }
+}
+
+utils::Task<> ClientSession::setOfflineAfterDelay(int delayMillis) {
+    co_await delay(delayMillis);
+    // set user offline after the delay
+    auto result = co_await request(td_api::make_object<td_api::setOption>(
+            "online", td_api::make_object<td_api::optionValueBoolean>(false)));
+    if (result.isError()) {
+        LOGE("setOption error: %s", result.getError().message_.c_str());
+    } else {
+        LOGI("setOption('online', false) success");
     }
 }
 
@@ -546,15 +776,27 @@ void ClientSession::logInWithBotToken(const std::string &botToken) {
         LOGE("bot token is empty");
         return;
     }
-    if (mAuthState == AuthorizationState::AUTHORIZED) {
-        LOGE("already authorized");
-        return;
+    bool sendNow = false;
+    bool isInitializing = false;
+    {
+        // either TDLib already asked for the credentials, or it will find them when it does, not neither
+        std::scoped_lock lock(mAuthCredentialMutex);
+        if (mAuthState == AuthorizationState::AUTHORIZED) {
+            LOGE("already authorized");
+            return;
+        }
+        if (mAuthState == AuthorizationState::WAIT_TOKEN || mAuthState == AuthorizationState::BAD_TOKEN) {
+            setAuthorizationState(AuthorizationState::WAIT_RESPONSE);
+            sendNow = true;
+        } else {
+            mAuthBotToken = botToken;
+            isInitializing = mAuthState == AuthorizationState::INITIALIZATION;
+        }
     }
-    mAuthBotToken = botToken;
-    if (mAuthState == AuthorizationState::WAIT_TOKEN || mAuthState == AuthorizationState::BAD_TOKEN) {
-        LOGD("try auth with bot token");
-        execute(td_api::make_object<td_api::checkAuthenticationBotToken>(mAuthBotToken), SessionManager::logIfResponseError);
-        mAuthState = AuthorizationState::WAIT_RESPONSE;
+    if (sendNow) {
+        sendBotToken(botToken);
+    } else if (isInitializing) {
+        startTdLib();
     }
 }
 
@@ -563,32 +805,58 @@ void ClientSession::logInWithPhoneNumber(const std::string &phoneNumber) {
         LOGE("phone number is empty");
         return;
     }
-    if (mAuthState == AuthorizationState::AUTHORIZED) {
-        LOGE("already authorized");
-        return;
+    bool sendNow = false;
+    bool isInitializing = false;
+    {
+        std::scoped_lock lock(mAuthCredentialMutex);
+        if (mAuthState == AuthorizationState::AUTHORIZED) {
+            LOGE("already authorized");
+            return;
+        }
+        if (mAuthState == AuthorizationState::WAIT_TOKEN || mAuthState == AuthorizationState::BAD_TOKEN) {
+            setAuthorizationState(AuthorizationState::WAIT_RESPONSE);
+            sendNow = true;
+        } else {
+            mAuthUserPhone = phoneNumber;
+            isInitializing = mAuthState == AuthorizationState::INITIALIZATION;
+        }
     }
-    mAuthUserPhone = phoneNumber;
-    if (mAuthState == AuthorizationState::WAIT_TOKEN || mAuthState == AuthorizationState::BAD_TOKEN) {
-        LOGD("try auth with phone number");
-        auto authSettings = td_api::make_object<td_api::phoneNumberAuthenticationSettings>(false, false, false, false, std::vector<std::string>());
-        auto request = td_api::make_object<td_api::setAuthenticationPhoneNumber>(phoneNumber, std::move(authSettings));
-        execute(std::move(request), [](auto resp) {
-            int32_t result = resp->get_id();
-            if (result == td_api::ok::ID) {
-                return;
-            }
-            LOGD("setAuthenticationPhoneNumber: %d", result);
-            if (resp->get_id() == td_api::error::ID) {
-                auto error = td_api::move_object_as<td_api::error>(resp);
-                LOGE("setAuthenticationPhoneNumber error: %s", error->message_.c_str());
-            }
-        });
-        mAuthState = AuthorizationState::WAIT_RESPONSE;
-    } else if (mAuthState == AuthorizationState::INITIALIZATION) {
-        sendTdLibParameters();
+    if (sendNow) {
+        sendPhoneNumber(phoneNumber);
+    } else if (isInitializing) {
+        startTdLib();
     }
 }
 
+void ClientSession::startTdLib() {
+    // TDLib creates the instance of a client id on its first request, only then it asks for the parameters
+    execute(td_api::make_object<td_api::getOption>("version"), nullptr);
+}
+
+void ClientSession::sendBotToken(const std::string &botToken) {
+    LOGD("try auth with bot token");
+    execute(td_api::make_object<td_api::checkAuthenticationBotToken>(botToken), [this](TdResult<td_api::ok> result) {
+        if (result.isError()) {
+            LOGE("Error checking authentication bot token: %s", result.getError().message_.c_str());
+            setAuthorizationState(AuthorizationState::BAD_TOKEN);
+        } else {
+            LOGD("auth success");
+            setAuthorizationState(AuthorizationState::AUTHORIZED);
+        }
+    });
+}
+
+void ClientSession::sendPhoneNumber(const std::string &phoneNumber) {
+    LOGD("try auth with phone number");
+    auto authSettings = td_api::make_object<td_api::phoneNumberAuthenticationSettings>(false, false, false, false, std::vector<std::string>());
+    auto request = td_api::make_object<td_api::setAuthenticationPhoneNumber>(phoneNumber, std::move(authSettings));
+    execute(std::move(request), [](TdResult<td_api::ok> result) {
+        if (result.isError()) {
+            LOGE("setAuthenticationPhoneNumber error: %s", result.getError().message_.c_str());
+        }
+    });
+}
+
 void ClientSession::handleUpdateConnectionState(int32_t state) {
     switch (state) {
         case td_api::connectionStateWaitingForNetwork::ID: {
@@ -609,6 +877,7 @@ void ClientSession::handleUpdateConnectionState(int32_t state) {
         }
         case td_api::connectionStateReady::ID: {
             LOGI("ConnectionState: ready");
+            finishCatchUp();
             break;
         }
         default: {
@@ -622,13 +891,77 @@ ClientSession::AuthorizationState ClientSession::getAuthorizationState() const {
     return mAuthState;
 }
 
-void ClientSession::handleUpdateUser(td::td_api::object_ptr<td::td_api::user> user) {
-    if (user) {
-        mUser = std::move(user);
-        std::string referenceName = mUser->username_;
-        std::string name = mUser->first_name_;
-        if (!mUser->last_name_.empty()) {
-            name += " " + mUser->last_name_;
+bool ClientSession::isAuthorizationSettled(AuthorizationState state) noexcept {
+    return state == AuthorizationState::AUTHORIZED || state == AuthorizationState::BAD_TOKEN
+           || state == AuthorizationState::CLOSED;
+}
+
+int64_t ClientSession::getRequestChatId(const td::td_api::Function &request) noexcept {
+    switch (request.get_id()) {
+        case td::td_api::sendMessage::ID: {
+            return static_cast<const td::td_api::sendMessage &>(request).chat_id_;
+        }
+        case td::td_api::deleteMessages::ID: {
+            return static_cast<const td::td_api::deleteMessages &>(request).chat_id_;
+        }
+        case td::td_api::setChatMemberStatus::ID: {
+            return static_cast<const td::td_api::setChatMemberStatus &>(request).chat_id_;
+        }
+        case td::td_api::banChatMember::ID: {
+            return static_cast<const td::td_api::banChatMember &>(request).chat_id_;
+        }
+        default: {
+            return 0;
+        }
+    }
+}
+
+void ClientSession::setAuthorizationState(AuthorizationState state) {
+    std::vector<AuthorizationListener> listeners;
+    {
+        // under the lock, so that a listener is either called here or sees the settled state when it is added
+        std::scoped_lock lock(mAuthListenerMutex);
+        mAuthState = state;
+        if (isAuthorizationSettled(state)) {
+            listeners.swap(mAuthListeners);
+        }
+    }
+    for (auto &listener: listeners) {
+        listener(this, state);
+    }
+}
+
+void ClientSession::whenAuthorizationSettled(AuthorizationListener listener) {
+    if (!listener) {
+        throw std::invalid_argument("listener must not be null");
+    }
+    AuthorizationState state;
+    {
+        std::scoped_lock lock(mAuthListenerMutex);
+        state = mAuthState;
+        if (!isAuthorizationSettled(state)) {
+            mAuthListeners.emplace_back(std::move(listener));
+            return;
+        }
+    }
+    listener(this, state);
+}
+
+std::future<ClientSession::AuthorizationState> ClientSession::getAuthorizationFuture() {
+    auto promise = std::make_shared<std::promise<AuthorizationState>>();
+    auto future = promise->get_future();
+    whenAuthorizationSettled([promise](ClientSession *, AuthorizationState state) {
+        promise->set_value(state);
+    });
+    return future;
+}
+
+void ClientSession::handleUpdateUser(const td::td_api::user *user) {
+    if (user && sUpdateUserLog.shouldLog()) {
+        std::string referenceName = user->username_;
+        std::string name = user->first_name_;
+        if (!user->last_name_.empty()) {
+            name += " " + user->last_name_;
         }
         std::string info = name;
         if (!referenceName.empty()) {
@@ -636,7 +969,7 @@ void ClientSession::handleUpdateUser(td::td_api::object_ptr<td::td_api::user> us
         }
         LOGI("User: %s", info.c_str());
         LOGI("User: id = %ld, is_fake = %d, is_verified = %d, is_support = %d",
-             mUser->id_, mUser->is_fake_, mUser->is_verified_, mUser->is_support_);
+             user->id_, user->is_fake_, user->is_verified_, user->is_support_);
     }
 }
 
@@ -650,15 +983,15 @@ uint64_t ClientSession::getServerTimeMillis() const {
     return currentTime + mServerTimeDeltaSeconds * 1000;
 }
 
-void ClientSession::handleUpdateNewChat(td::td_api::object_ptr<td::td_api::chat> chat) {
+void ClientSession::handleUpdateNewChat(const td::td_api::chat *chat) {
     if (chat) {
-        LOGI("New chat: id = %ld, title = %s", chat->id_, chat->title_.c_str());
+        LOG_SAMPLED(sUpdateNewChatLog, Log::Level::INFO, "New chat: id = %ld, title = %s", chat->id_, chat->title_.c_str());
     }
 }
 
-void ClientSession::handleUpdateNewMessage(td::td_api::object_ptr<td::td_api::message> message) {
+void ClientSession::handleUpdateNewMessage(const td::td_api::message *message) {
     if (message) {
-        td::td_api::message *msg = message.get();
+        const td::td_api::message *msg = message;
         if (msg->is_outgoing_) {
             // we don't need to handle outgoing messages
             return;
@@ -668,20 +1001,22 @@ void ClientSession::handleUpdateNewMessage(td::td_api::object_ptr<td::td_api::me
             handled = mMessageHandler.get()->operator()(this, msg);
         }
         if (!handled) {
-            LOGI("Unhandled message: %s", messageToString(message.get()).c_str());
+            LOG_SAMPLED(sUnhandledMessageLog, Log::Level::INFO, "Unhandled message: %s", messageToString(message).c_str());
         }
     }
 }
 
-void ClientSession::handleUpdateSupergroup(td::td_api::object_ptr<td::td_api::supergroup> supergroup) {
+void ClientSession::handleUpdateSupergroup(const td::td_api::supergroup *supergroup) {
     if (supergroup) {
-        LOGI("Supergroup: id = %ld, ref_name = %s", supergroup->id_, supergroup->username_.c_str());
+        LOG_SAMPLED(sUpdateSupergroupLog, Log::Level::INFO, "Supergroup: id = %ld, ref_name = %s",
+                    supergroup->id_, supergroup->username_.c_str());
     }
 }
 
-void ClientSession::handleUpdateBasicGroup(td::td_api::object_ptr<td::td_api::basicGroup> basicGroup) {
+void ClientSession::handleUpdateBasicGroup(const td::td_api::basicGroup *basicGroup) {
     if (basicGroup) {
-        LOGI("BasicGroup: id = %ld, upgraded_to_supergroup_id = %ld", basicGroup->id_, basicGroup->upgraded_to_supergroup_id_);
+        LOG_SAMPLED(sUpdateBasicGroupLog, Log::Level::INFO, "BasicGroup: id = %ld, upgraded_to_supergroup_id = %ld",
+                    basicGroup->id_, basicGroup->upgraded_to_supergroup_id_);
     }
 }
 
@@ -693,8 +1028,29 @@ void ClientSession::setMessageHandler(ClientSession::MessageHandler messageHandl
     mMessageHandler = std::make_unique<ClientSession::MessageHandler>(std::move(messageHandler));
 }
 
-void ClientSession::handleUpdateDeleteMessages(td::td_api::object_ptr<td::td_api::updateDeleteMessages> update) {
-    if (update) {
+bool ClientSession::isCatchingUp() const noexcept {
+    return mCatchingUp.load(std::memory_order_acquire);
+}
+
+void ClientSession::finishCatchUp() {
+    if (mCatchUpBuffer == nullptr) {
+        return;
+    }
+    // clear the buffer first, the handlers see a session which is no longer catching up
+    auto buffer = std::move(mCatchUpBuffer);
+    mCatchingUp.store(false, std::memory_order_release);
+    buffer->drain([this](td_api::object_ptr<td_api::message> message) {
+        handleUpdateNewMessage(message.get());
+    });
+    auto stats = buffer->getStatistics();
+    LOGI("caught up %llu messages in %zu chats, %llu stale, %llu trimmed, %llu joins merged, %llu handled",
+         (unsigned long long) stats.receivedCount, stats.chatCount, (unsigned long long) stats.staleCount,
+         (unsigned long long) stats.trimmedCount, (unsigned long long) stats.mergedJoinCount,
+         (unsigned long long) stats.deliveredCount);
+}
+
+void ClientSession::handleUpdateDeleteMessages(const td::td_api::updateDeleteMessages *update) {
+    if (update && sUpdateDeleteMessagesLog.shouldLog()) {
         std::string messageIds;
         for (auto const &messageId: update->message_ids_) {
             messageIds += std::to_string(messageId) + ", ";
@@ -704,7 +1060,7 @@ void ClientSession::handleUpdateDeleteMessages(td::td_api::object_ptr<td::td_api
 }
 
 void ClientSession::sendTextMessage(int64_t chatId, const std::string &text, uint64_t replyId,
-                                    std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback) {
+                                    std::function<void(TdResult<td::td_api::message>)> callback) {
     td::td_api::object_ptr<td::td_api::formattedText> formattedText =
             td::td_api::make_object<td::td_api::formattedText>(text, std::vector<td::td_api::object_ptr<td::td_api::textEntity>>());
     td::td_api::object_ptr<td::td_api::InputMessageContent> inputMessage =
@@ -713,22 +1069,24 @@ void ClientSession::sendTextMessage(int64_t chatId, const std::string &text, uin
             chatId, 0, replyId,
             td::td_api::make_object<td_api::messageSendOptions>(false, false, false, nullptr),
             nullptr, std::move(inputMessage));
-    execute(std::move(request), std::move(callback));
+    RequestOptions options;
+    options.chatId = chatId;
+    execute(std::move(request), std::move(callback), options);
 }
 
 void ClientSession::sendTextMessage(int64_t chatId, const std::string &text, uint64_t replyId) {
-    sendTextMessage(chatId, text, replyId, [](td::td_api::object_ptr<td::td_api::Object> object) {
-        if (object && object->get_id() == td::td_api::error::ID) {
-            auto error = td::move_tl_object_as<td::td_api::error>(object);
-            LOGE("sendTextMessage code:%d error: %s", error->code_, error->message_.c_str());
+    sendTextMessage(chatId, text, replyId, [](TdResult<td::td_api::message> result) {
+        if (result.isError()) {
+            LOGE("sendTextMessage code:%d error: %s", result.getErrorCode(), result.getErrorMessage().c_str());
         }
     });
 }
 
-void ClientSession::handleUpdateMessageSendSucceeded(td::td_api::object_ptr<td::td_api::updateMessageSendSucceeded> update) {
+void ClientSession::handleUpdateMessageSendSucceeded(const td::td_api::updateMessageSendSucceeded *update) {
     if (update) {
-        LOGI("UpdateMessageSendSucceeded: message_id = %ld, message_thread_id = %ld",
-             update->old_message_id_, update->message_->message_thread_id_);
+        LOG_SAMPLED(sUpdateMessageSendSucceededLog, Log::Level::INFO,
+                    "UpdateMessageSendSucceeded: message_id = %ld, message_thread_id = %ld",
+                    update->old_message_id_, update->message_->message_thread_id_);
     }
 }
 
@@ -8,13 +8,27 @@
 #include <cstdint>
 
 #include <string>
+#include <vector>
 #include <cstdint>
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <functional>
+#include <future>
+#include <optional>
+#include <coroutine>
+#include <unordered_map>
 
 #include <td/telegram/td_api.h>
 
+#include "utils/coroutine/Task.h"
+#include "TdResult.h"
+#include "UpdateRouter.h"
+#include "RequestFlowController.h"
+#include "RateLimiter.h"
+#include "CatchUpBuffer.h"
+#include "RequestCoalescer.h"
+
 namespace core {
 
 class SessionManager;
@@ -41,6 +55,45 @@ public:
         bool ignore_file_names_ = true;
     };
 
+    using FlowControlStatistics = RequestFlowController::Statistics;
+    using RateLimitStatistics = RateLimiter::Statistics;
+    using CoalescingStatistics = RequestCoalescer::Statistics;
+
+    // error code of the synthetic td_api::error for requests dropped by the rate limiter
+    static constexpr int32_t kRateLimitedErrorCode = 429;
+    // error code of the synthetic td_api::error for requests replaced by a later request with the same merge key
+    static constexpr int32_t kRequestMergedErrorCode = 409;
+    // FLOOD_WAIT errors asking to wait longer than this are not retried
+    static constexpr int kMaxRetryAfterSeconds = 300;
+
+    /**
+     * What happens to a request which would exceed a rate limit.
+     */
+    enum class RateLimitPolicy {
+        // send it as soon as the limits allow
+        DELAY,
+        // complete it with a kRateLimitedErrorCode error right away
+        DROP,
+        // like DELAY, but a later request with the same merge key replaces it while it waits
+        MERGE
+    };
+
+    /**
+     * Options of a single request.
+     */
+    struct RequestOptions {
+        // the chat the request is about, counted against the per-chat cap,
+        // 0 to take it from the request if it is one of the known chat scoped functions
+        int64_t chatId = 0;
+        // requests held back by flow control are released highest priority first
+        int priority = 0;
+        // if positive, complete with a timeout error after this many milliseconds, counted from when the request is sent
+        int timeoutMillis = 0;
+        RateLimitPolicy rateLimitPolicy = RateLimitPolicy::DELAY;
+        // requests with the same non-zero key are merged under RateLimitPolicy::MERGE
+        uint64_t mergeKey = 0;
+    };
+
     enum class AuthorizationState {
         INITIALIZATION,
         WAIT_TOKEN,
@@ -52,9 +105,82 @@ public:
         CLOSED
     };
 
+    /**
+     * Awaitable returned by request(), resumes with the response object.
+     */
+    class RequestAwaiter {
+    public:
+        RequestAwaiter(ClientSession *session, td::td_api::object_ptr<td::td_api::Function> request, int timeoutMillis);
+
+        [[nodiscard]] bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle);
+
+        td::td_api::object_ptr<td::td_api::Object> await_resume() noexcept {
+            return std::move(mResult);
+        }
+
+    private:
+        ClientSession *mSession;
+        td::td_api::object_ptr<td::td_api::Function> mRequest;
+        int mTimeoutMillis;
+        td::td_api::object_ptr<td::td_api::Object> mResult;
+    };
+
+    /**
+     * Awaitable returned by the typed request(), resumes with a TdResult.
+     */
+    template<typename T>
+    class TypedRequestAwaiter {
+    public:
+        explicit TypedRequestAwaiter(RequestAwaiter awaiter) : mAwaiter(std::move(awaiter)) {}
+
+        [[nodiscard]] bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            mAwaiter.await_suspend(handle);
+        }
+
+        TdResult<T> await_resume() noexcept {
+            return TdResult<T>(mAwaiter.await_resume());
+        }
+
+    private:
+        RequestAwaiter mAwaiter;
+    };
+
+    /**
+     * Awaitable returned by delay().
+     */
+    class DelayAwaiter {
+    public:
+        DelayAwaiter(ClientSession *session, int delayMillis) : mSession(session), mDelayMillis(delayMillis) {}
+
+        [[nodiscard]] bool await_ready() const noexcept {
+            return mDelayMillis <= 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle);
+
+        void await_resume() const noexcept {}
+
+    private:
+        ClientSession *mSession;
+        int mDelayMillis;
+    };
+
     ClientSession() = delete;
 
-    explicit ClientSession(SessionManager *sessionManager, int32_t id, const TdLibParameters &param);
+    /**
+     * @param catchUpPolicy if set, the backlog replayed by TDLib before the connection state becomes ready
+     * is thinned out with this policy, see CatchUpBuffer, otherwise every message is handled as it arrives
+     */
+    explicit ClientSession(SessionManager *sessionManager, int32_t id, const TdLibParameters &param,
+                           std::optional<CatchUpBuffer::Policy> catchUpPolicy = std::nullopt);
 
     ~ClientSession() = default;
 
@@ -64,13 +190,171 @@ public:
 
     [[nodiscard]] int getTdLibObjectId() const;
 
+    /**
+     * Get the user id of the account, known once TDLib has reported the my_id option, 0 before that.
+     */
+    [[nodiscard]] int64_t getUserId() const noexcept;
+
+    /**
+     * Send a request to TDLib.
+     * @param request the request
+     * @param callback the response callback
+     * @param timeoutMillis if positive, complete the callback with a timeout error after this many milliseconds
+     */
+    void execute(td::td_api::object_ptr<td::td_api::Function> request,
+                 std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback, int timeoutMillis = 0);
+
+    /**
+     * Send a request to TDLib, subject to the rate limits and the flow control limits of this session.
+     * Requests dropped or merged by the rate limiter complete right away on the calling thread.
+     * An idempotent read, see RequestCoalescer::getKey, which is identical to one in flight is not sent,
+     * it gets a copy of the response of the one in flight, whose options such as the timeout apply to both.
+     * @param request the request
+     * @param callback the response callback
+     * @param options the chat id, priority and timeout of the request
+     */
     void execute(td::td_api::object_ptr<td::td_api::Function> request,
-                 std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback);
+                 std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback, const RequestOptions &options);
 
     void execute(td::td_api::object_ptr<td::td_api::Function> request, nullptr_t);
 
+    /**
+     * Send a request to TDLib and get a typed response, e.g.
+     * <code>execute(td_api::make_object&lt;td_api::getChat&gt;(chatId), [](TdResult&lt;td_api::chat&gt; result) {...});</code>
+     * The result type is derived from F::ReturnType at compile time.
+     * @param request the request
+     * @param callback called on the dispatcher thread with a TdResult&lt;TdReturnType&lt;F&gt;&gt;
+     * @param timeoutMillis if positive, complete the callback with a timeout error after this many milliseconds
+     */
+    template<TdFunction F, typename Callback>
+    requires std::is_invocable_v<Callback &, TdResult<TdReturnType<F>>>
+    void execute(td::td_api::object_ptr<F> request, Callback callback, int timeoutMillis = 0) {
+        RequestOptions options;
+        options.timeoutMillis = timeoutMillis;
+        execute(std::move(request), std::move(callback), options);
+    }
+
+    template<TdFunction F, typename Callback>
+    requires std::is_invocable_v<Callback &, TdResult<TdReturnType<F>>>
+    void execute(td::td_api::object_ptr<F> request, Callback callback, const RequestOptions &options) {
+        execute(td::td_api::object_ptr<td::td_api::Function>(std::move(request)),
+                [callback = std::move(callback)](td::td_api::object_ptr<td::td_api::Object> object) mutable {
+                    callback(TdResult<TdReturnType<F>>(std::move(object)));
+                }, options);
+    }
+
+    /**
+     * Send a request and send it again if it fails with a FLOOD_WAIT error, up to maxRetries times.
+     * The resend is scheduled on a timer for the advertised retry-after time, and the chat of the request,
+     * or its method if it has no chat, is paused for that long so that other traffic keeps flowing.
+     * @param requestFactory creates the request, it is called once per attempt as td_api objects can't be copied
+     * @param callback the response callback, called with the FLOOD_WAIT error once the retries are used up
+     * @param options the options of each attempt
+     * @param maxRetries the maximum number of times the request is sent again
+     */
+    void executeWithRetry(std::function<td::td_api::object_ptr<td::td_api::Function>()> requestFactory,
+                          std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback,
+                          const RequestOptions &options, int maxRetries);
+
+    /**
+     * Typed variant of executeWithRetry, the result type is derived from the function the factory creates.
+     */
+    template<typename Factory, typename Callback,
+            typename F = typename detail::ObjectPtrElement<std::invoke_result_t<Factory &>>::type>
+    requires TdFunction<F> && std::is_invocable_v<Callback &, TdResult<TdReturnType<F>>>
+    void executeWithRetry(Factory requestFactory, Callback callback, const RequestOptions &options, int maxRetries) {
+        executeWithRetry(
+                [requestFactory = std::move(requestFactory)]() mutable {
+                    return td::td_api::object_ptr<td::td_api::Function>(requestFactory());
+                },
+                [callback = std::move(callback)](td::td_api::object_ptr<td::td_api::Object> object) mutable {
+                    callback(TdResult<TdReturnType<F>>(std::move(object)));
+                }, options, maxRetries);
+    }
+
+    /**
+     * Limit the number of requests of this session which are waiting for a response.
+     * Requests over a limit are queued locally and sent as responses to earlier requests arrive.
+     * @param maxOutstanding the maximum number of outstanding requests, 0 for unlimited
+     * @param maxOutstandingPerChat the maximum number of outstanding requests per chat id, 0 for unlimited
+     */
+    void setFlowControlLimits(int maxOutstanding, int maxOutstandingPerChat = 0);
+
+    [[nodiscard]] FlowControlStatistics getFlowControlStatistics() const;
+
+    /**
+     * Set the outbound rate limits of this session, e.g. Telegram allows a bot about 30 messages per second
+     * in total and 1 per second per chat. The global and per-chat limits apply to requests with a chat id.
+     * @param config the limits
+     */
+    void setRateLimits(const RateLimiter::Config &config);
+
+    [[nodiscard]] RateLimitStatistics getRateLimitStatistics() const;
+
+    /**
+     * Get how many reads were sent and how many shared the response of an identical read in flight.
+     */
+    [[nodiscard]] CoalescingStatistics getCoalescingStatistics() const;
+
+    /**
+     * Send several independent requests at once and get a single completion with all results.
+     * The group is admitted as a whole: every member takes its rate limit tokens and the group waits for the
+     * slowest of them, then every member takes a flow control slot until the last of them is answered.
+     * Under RateLimitPolicy::DROP every member completes with a kRateLimitedErrorCode error, and no tokens are taken,
+     * if one of them would have to wait, RateLimitPolicy::MERGE is treated as DELAY.
+     * @see SessionManager::sendRequestGroup
+     */
+    void executeGroup(std::vector<td::td_api::object_ptr<td::td_api::Function>> requests,
+                      std::function<void(std::vector<td::td_api::object_ptr<td::td_api::Object>>)> callback,
+                      bool failFast, const RequestOptions &options);
+
+    void executeGroup(std::vector<td::td_api::object_ptr<td::td_api::Function>> requests,
+                      std::function<void(std::vector<td::td_api::object_ptr<td::td_api::Object>>)> callback,
+                      bool failFast = false, int timeoutMillis = 0);
+
+    /**
+     * Send a request from a coroutine, e.g.
+     * <code>auto result = co_await session->request(td_api::make_object&lt;td_api::getMe&gt;());</code>
+     * The coroutine does not hold any thread while waiting and is resumed on the coroutine executor.
+     * @param request the request
+     * @param timeoutMillis if positive, resume with a timeout error after this many milliseconds
+     */
+    [[nodiscard]] RequestAwaiter request(td::td_api::object_ptr<td::td_api::Function> request, int timeoutMillis = 0);
+
+    /**
+     * Send a request from a coroutine and get a typed response, e.g.
+     * <code>TdResult&lt;td_api::chat&gt; chat = co_await session->request(td_api::make_object&lt;td_api::getChat&gt;(chatId));</code>
+     * @param request the request
+     * @param timeoutMillis if positive, resume with a timeout error after this many milliseconds
+     */
+    template<TdFunction F>
+    [[nodiscard]] TypedRequestAwaiter<TdReturnType<F>> request(td::td_api::object_ptr<F> request, int timeoutMillis = 0) {
+        return TypedRequestAwaiter<TdReturnType<F>>(
+                RequestAwaiter(this, td::td_api::object_ptr<td::td_api::Function>(std::move(request)), timeoutMillis));
+    }
+
+    /**
+     * Suspend the calling coroutine for a while, without holding any thread.
+     * @param delayMillis the delay in milliseconds
+     */
+    [[nodiscard]] DelayAwaiter delay(int delayMillis);
+
+    /**
+     * Run a task on the coroutine executor after a delay.
+     */
+    void postDelayed(int delayMillis, std::function<void()> task);
+
+    /**
+     * Set the executor on which coroutines awaiting this session are resumed.
+     * The default executor is the thread pool of the SessionManager.
+     * This must not be called while there are coroutines waiting on this session.
+     */
+    void setCoroutineExecutor(utils::Executor executor);
+
+    void resumeOnExecutor(std::coroutine_handle<> handle);
+
     void sendTextMessage(int64_t chatId, const std::string &text, uint64_t replyId,
-                         std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback);
+                         std::function<void(TdResult<td::td_api::message>)> callback);
 
     void sendTextMessage(int64_t chatId, const std::string &text, uint64_t replyId = 0);
 
@@ -78,6 +362,24 @@ public:
 
     [[nodiscard]] AuthorizationState getAuthorizationState() const;
 
+    /**
+     * Called once the login of a session has settled, i.e. it is AUTHORIZED, BAD_TOKEN or CLOSED.
+     */
+    using AuthorizationListener = std::function<void(ClientSession *, AuthorizationState)>;
+
+    /**
+     * Get notified the next time the login settles, or right away on the calling thread if it has already settled.
+     * Otherwise the listener is called on the dispatcher thread the moment TDLib reports the state,
+     * so it should be short. Each listener is called once.
+     * @param listener the listener
+     */
+    void whenAuthorizationSettled(AuthorizationListener listener);
+
+    /**
+     * Get a future which becomes ready once the login has settled, see whenAuthorizationSettled.
+     */
+    [[nodiscard]] std::future<AuthorizationState> getAuthorizationFuture();
+
     [[nodiscard]] uint64_t getServerTimeSeconds() const;
 
     [[nodiscard]] uint64_t getServerTimeMillis() const;
@@ -86,12 +388,26 @@ public:
 
     void setMessageHandler(MessageHandler messageHandler);
 
+    /**
+     * Whether the session is still buffering the new messages of the backlog.
+     */
+    [[nodiscard]] bool isCatchingUp() const noexcept;
+
     void logInWithBotToken(const std::string &botToken);
 
     void logInWithPhoneNumber(const std::string &botToken);
 
+    /**
+     * Route an update to its subscribers.
+     * @return true if the update type has at least one subscriber
+     */
     bool handleUpdate(td::td_api::object_ptr<td::td_api::Object> update);
 
+    /**
+     * Register the subscribers every session needs, e.g. authorization and connection state.
+     */
+    static void registerUpdateSubscribers(UpdateRouter::Builder &builder);
+
     void onTerminate();
 
     void terminate();
@@ -99,38 +415,110 @@ public:
 private:
     void sendTdLibParameters();
 
-    bool handleUpdateAuthorizationState(td::td_api::object_ptr<td::td_api::AuthorizationState> object);
+    bool handleUpdateAuthorizationState(const td::td_api::AuthorizationState *object);
 
     void handleUpdateConnectionState(int32_t state);
 
-    void handleUpdateUser(td::td_api::object_ptr<td::td_api::user> user);
+    void handleUpdateUser(const td::td_api::user *user);
+
+    void handleUpdateNewChat(const td::td_api::chat *chat);
 
-    void handleUpdateNewChat(td::td_api::object_ptr<td::td_api::chat> chat);
+    void handleUpdateNewMessage(const td::td_api::message *message);
 
-    void handleUpdateNewMessage(td::td_api::object_ptr<td::td_api::message> message);
+    void finishCatchUp();
 
-    void handleUpdateBasicGroup(td::td_api::object_ptr<td::td_api::basicGroup> basicGroup);
+    void handleUpdateBasicGroup(const td::td_api::basicGroup *basicGroup);
 
-    void handleUpdateSupergroup(td::td_api::object_ptr<td::td_api::supergroup> supergroup);
+    void handleUpdateSupergroup(const td::td_api::supergroup *supergroup);
 
-    void handleUpdateDeleteMessages(td::td_api::object_ptr<td::td_api::updateDeleteMessages> update);
+    void handleUpdateDeleteMessages(const td::td_api::updateDeleteMessages *update);
 
-    void handleUpdateMessageSendSucceeded(td::td_api::object_ptr<td::td_api::updateMessageSendSucceeded> update);
+    void handleUpdateMessageSendSucceeded(const td::td_api::updateMessageSendSucceeded *update);
 
     void handleUpdateOption(const std::string &name, const td::td_api::object_ptr<td::td_api::OptionValue> &object);
 
+    utils::Task<> setOfflineAfterDelay(int delayMillis);
+
+    // a request held back by the rate limiter
+    struct DelayedRequest {
+        td::td_api::object_ptr<td::td_api::Function> request;
+        std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback;
+        RequestOptions options;
+    };
+
+    // a request group held back by the rate limiter or flow control
+    struct DelayedGroup {
+        std::vector<td::td_api::object_ptr<td::td_api::Function>> requests;
+        std::function<void(std::vector<td::td_api::object_ptr<td::td_api::Object>>)> callback;
+        bool failFast = false;
+        RequestOptions options;
+    };
+
+    struct RetryState {
+        std::function<td::td_api::object_ptr<td::td_api::Function>()> requestFactory;
+        std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback;
+        RequestOptions options;
+        int maxRetries = 0;
+        int attempt = 0;
+    };
+
+    void sendRetryAttempt(const std::shared_ptr<RetryState> &state);
+
+    void setAuthorizationState(AuthorizationState state);
+
+    void startTdLib();
+
+    void sendBotToken(const std::string &botToken);
+
+    void sendPhoneNumber(const std::string &phoneNumber);
+
+    static bool isAuthorizationSettled(AuthorizationState state) noexcept;
+
+    /**
+     * The chat a request is about, for the chat scoped functions the session sends most.
+     * @return the chat id, or 0 if the function is not known to be about a single chat
+     */
+    static int64_t getRequestChatId(const td::td_api::Function &request) noexcept;
+
+    // rate limiting and flow control, after coalescing
+    void executeUncoalesced(td::td_api::object_ptr<td::td_api::Function> request,
+                            std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback,
+                            const RequestOptions &options);
+
+    void executeRateLimited(td::td_api::object_ptr<td::td_api::Function> request,
+                            std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback,
+                            const RequestOptions &options);
+
+    void executeWithFlowControl(td::td_api::object_ptr<td::td_api::Function> request,
+                                std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback,
+                                const RequestOptions &options);
+
+    void executeGroupWithFlowControl(const std::shared_ptr<DelayedGroup> &group);
+
 private:
     SessionManager *mSessionManager = nullptr;
     TdLibParameters mTdLibParameters;
     int32_t mTdLibObjectId = 0;
-    int64_t mUserId = 0;
+    std::atomic_int64_t mUserId = 0;
     uint64_t mAuthorizationDate = 0;
     std::atomic<AuthorizationState> mAuthState = AuthorizationState::INITIALIZATION;
+    std::mutex mAuthListenerMutex;
+    std::vector<AuthorizationListener> mAuthListeners;
+    // guards the credentials and the decision whether to send them now or when TDLib asks for them
+    std::mutex mAuthCredentialMutex;
     std::string mAuthBotToken;
     std::string mAuthUserPhone;
-    td::tl_object_ptr<td::td_api::user> mUser;
     uint64_t mServerTimeDeltaSeconds = 0;
     std::unique_ptr<MessageHandler> mMessageHandler;
+    // set on construction, then only used on the dispatcher thread, null without a policy or once the catch-up is over
+    std::unique_ptr<CatchUpBuffer> mCatchUpBuffer;
+    std::atomic_bool mCatchingUp = false;
+    utils::Executor mCoroutineExecutor;
+    RequestFlowController mFlowController;
+    RateLimiter mRateLimiter;
+    RequestCoalescer mCoalescer;
+    std::mutex mMergeMutex;
+    std::unordered_map<uint64_t, std::shared_ptr<DelayedRequest>> mMergeableRequests;
 };
 
 }
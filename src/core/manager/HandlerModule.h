@@ -0,0 +1,146 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_HANDLERMODULE_H
+#define NEOGROUPCAPTCHABOT_HANDLERMODULE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <functional>
+
+#include <td/telegram/td_api.h>
+
+#include "ClientSession.h"
+
+namespace core {
+
+/**
+ * The message and update handlers of a shared object module, see HandlerModuleHost.
+ * A module talks to the bot through the ClientSession it is given, the symbols of the bot are exported
+ * by the executable, so a module must be built against the same headers with the same compiler.
+ * The host checks this with ngcbHandlerModuleLayoutHash, a module built otherwise is refused instead of
+ * crashing in the first virtual call.
+ * Handlers are called on the dispatcher threads, possibly on several threads at the same time.
+ *
+ * A module may be unloaded while requests it sent are still pending, its code stays mapped for them,
+ * but the instance is destroyed as soon as the last handler call returns, so callbacks must not use it.
+ */
+class HandlerModule {
+public:
+    HandlerModule() = default;
+
+    virtual ~HandlerModule() = default;
+
+    HandlerModule(const HandlerModule &) = delete;
+
+    HandlerModule &operator=(const HandlerModule &) = delete;
+
+    /**
+     * Called with a new message of a session which uses the modules, see ClientSession::MessageHandler.
+     * @return true if the message was handled
+     */
+    virtual bool onMessage(ClientSession *session, const td::td_api::message *message) = 0;
+
+    /**
+     * Called with an update of one of the types the host was created for, see UpdateInterceptor::onUpdate.
+     * @return true to consume the update
+     */
+    virtual bool onUpdate(int32_t clientId, td::td_api::Object &update) {
+        (void) clientId;
+        (void) update;
+        return false;
+    }
+};
+
+}
+
+/**
+ * Bumped whenever HandlerModule or NgcbHandlerModuleDescriptor change, the host refuses modules built for another one.
+ * abiVersion stays the first member of the descriptor in every version, so it can always be read.
+ */
+#define NGCB_HANDLER_MODULE_ABI_VERSION 2
+
+namespace core {
+
+/**
+ * A fingerprint of what a module shares with the host beyond the descriptor: the compiler and standard library,
+ * the sizes of the types passed across, and the TDLib schema. The version number alone catches none of these.
+ */
+constexpr uint64_t ngcbHandlerModuleLayoutHash() {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto mix = [&hash](uint64_t value) {
+        for (int i = 0; i < 8; i++) {
+            hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+        }
+    };
+    for (const char *p = __VERSION__; *p != '\0'; p++) {
+        mix(uint64_t(uint8_t(*p)));
+    }
+    mix(__cplusplus);
+#ifdef _GLIBCXX_USE_CXX11_ABI
+    mix(_GLIBCXX_USE_CXX11_ABI);
+#endif
+    mix(sizeof(void *));
+    mix(sizeof(std::string));
+    mix(sizeof(std::function<void()>));
+    mix(sizeof(std::shared_ptr<int>));
+    mix(sizeof(std::vector<int>));
+    mix(sizeof(HandlerModule));
+    mix(sizeof(ClientSession));
+    mix(sizeof(ClientSession::RequestOptions));
+    // the constructor ids are hashes of the schema lines, so they change with any field of the type
+    mix(sizeof(td::td_api::message));
+    mix(uint32_t(td::td_api::message::ID));
+    mix(uint32_t(td::td_api::messageText::ID));
+    mix(uint32_t(td::td_api::formattedText::ID));
+    mix(uint32_t(td::td_api::sendMessage::ID));
+    mix(uint32_t(td::td_api::error::ID));
+    return hash;
+}
+
+}
+
+extern "C" {
+
+/**
+ * What a module exports as ngcb_handler_module_descriptor.
+ */
+struct NgcbHandlerModuleDescriptor {
+    uint32_t abiVersion;
+    // sizeof(NgcbHandlerModuleDescriptor) of the module
+    uint32_t descriptorSize;
+    // core::ngcbHandlerModuleLayoutHash() of the module
+    uint64_t layoutHash;
+    const char *name;
+
+    core::HandlerModule *(*create)();
+
+    void (*destroy)(core::HandlerModule *module);
+};
+
+using NgcbHandlerModuleDescriptorGetter = const NgcbHandlerModuleDescriptor *(*)();
+
+}
+
+/**
+ * Define the entry point of a module, e.g. <code>NGCB_HANDLER_MODULE("echo", EchoModule)</code>.
+ * @param moduleName the name shown in the log
+ * @param ModuleClass the HandlerModule implementation, default constructible
+ */
+#define NGCB_HANDLER_MODULE(moduleName, ModuleClass) \
+    extern "C" __attribute__((visibility("default"))) const NgcbHandlerModuleDescriptor *ngcb_handler_module_descriptor() { \
+        static const NgcbHandlerModuleDescriptor descriptor = { \
+            NGCB_HANDLER_MODULE_ABI_VERSION, \
+            uint32_t(sizeof(NgcbHandlerModuleDescriptor)), \
+            core::ngcbHandlerModuleLayoutHash(), \
+            moduleName, \
+            []() -> core::HandlerModule * { return new ModuleClass(); }, \
+            [](core::HandlerModule *module) { delete module; } \
+        }; \
+        return &descriptor; \
+    }
+
+#endif //NEOGROUPCAPTCHABOT_HANDLERMODULE_H
@@ -0,0 +1,176 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "utils/auto_close_fd.h"
+#include "utils/log/Log.h"
+
+#include "HandlerModuleHost.h"
+
+static constexpr const char *LOG_TAG = "HandlerModuleHost";
+
+namespace core {
+
+static void copyFile(int from, int to) {
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t count = read(from, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            throw std::runtime_error(std::string("read module: ") + strerror(errno));
+        }
+        if (count == 0) {
+            return;
+        }
+        for (ssize_t written = 0; written < count;) {
+            ssize_t n = write(to, buffer + written, size_t(count - written));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                throw std::runtime_error(std::string("copy module: ") + strerror(errno));
+            }
+            written += n;
+        }
+    }
+}
+
+HandlerModuleHost::LoadedModule::~LoadedModule() {
+    if (instance != nullptr && destroy != nullptr) {
+        destroy(instance);
+    }
+    // the library was opened with RTLD_NODELETE, see openPrivateCopy
+    LOGI("released module %s generation %llu", info.name.c_str(), (unsigned long long) info.generation);
+}
+
+HandlerModuleHost::HandlerModuleHost(std::vector<int32_t> updateIds) : mUpdateIds(std::move(updateIds)) {}
+
+void *HandlerModuleHost::openPrivateCopy(const std::string &path) {
+    // dlopen hands out the library which is already loaded under the same name, so every load gets a name of its own,
+    // and the deployed file may be overwritten while the copy is mapped
+    static std::atomic_uint64_t sCopySequence = 0;
+    const char *tmpDir = getenv("TMPDIR");
+    std::string copyPath = std::string(tmpDir != nullptr && tmpDir[0] != '\0' ? tmpDir : "/tmp") + "/ngcb-module-"
+                           + std::to_string(getpid()) + "-" + std::to_string(++sCopySequence) + "-XXXXXX";
+    auto_close_fd source(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!source) {
+        throw std::runtime_error("open module " + path + ": " + strerror(errno));
+    }
+    auto_close_fd copy(mkostemp(copyPath.data(), O_CLOEXEC));
+    if (!copy) {
+        throw std::runtime_error("create module copy " + copyPath + ": " + strerror(errno));
+    }
+    void *handle = nullptr;
+    try {
+        copyFile(source.get(), copy.get());
+        copy.close();
+        // never unmapped: callbacks of requests sent by the module may outlive it
+        handle = dlopen(copyPath.c_str(), RTLD_NOW | RTLD_LOCAL | RTLD_NODELETE);
+    } catch (...) {
+        unlink(copyPath.c_str());
+        throw;
+    }
+    unlink(copyPath.c_str());
+    if (handle == nullptr) {
+        const char *error = dlerror();
+        throw std::runtime_error("dlopen module " + path + ": " + (error != nullptr ? error : "unknown error"));
+    }
+    return handle;
+}
+
+void HandlerModuleHost::load(const std::string &path) {
+    std::scoped_lock lock(mLoadMutex);
+    void *handle = openPrivateCopy(path);
+    auto getter = reinterpret_cast<NgcbHandlerModuleDescriptorGetter>(dlsym(handle, "ngcb_handler_module_descriptor"));
+    if (getter == nullptr) {
+        dlclose(handle);
+        throw std::runtime_error("module " + path + " does not export ngcb_handler_module_descriptor");
+    }
+    const NgcbHandlerModuleDescriptor *descriptor = getter();
+    // only abiVersion may be read before it matches, the rest of the descriptor may have another layout
+    if (descriptor == nullptr || descriptor->abiVersion != NGCB_HANDLER_MODULE_ABI_VERSION) {
+        dlclose(handle);
+        throw std::runtime_error("module " + path + " was built for another ABI version, expected "
+                                 + std::to_string(NGCB_HANDLER_MODULE_ABI_VERSION));
+    }
+    constexpr uint64_t kLayoutHash = ngcbHandlerModuleLayoutHash();
+    if (descriptor->descriptorSize != sizeof(NgcbHandlerModuleDescriptor) || descriptor->layoutHash != kLayoutHash) {
+        dlclose(handle);
+        throw std::runtime_error("module " + path + " was built with another compiler or other headers, layout hash "
+                                 + std::to_string(descriptor->layoutHash) + ", expected " + std::to_string(kLayoutHash));
+    }
+    if (descriptor->create == nullptr || descriptor->destroy == nullptr) {
+        dlclose(handle);
+        throw std::runtime_error("module " + path + " has no create or destroy function");
+    }
+    auto module = std::make_shared<LoadedModule>();
+    module->info.path = path;
+    module->info.name = descriptor->name != nullptr ? descriptor->name : "";
+    module->info.generation = mGeneration + 1;
+    module->instance = descriptor->create();
+    module->destroy = descriptor->destroy;
+    if (module->instance == nullptr) {
+        dlclose(handle);
+        throw std::runtime_error("module " + path + " failed to create its handler");
+    }
+    // closing drops only our reference, RTLD_NODELETE keeps the code mapped
+    dlclose(handle);
+    mGeneration++;
+    std::shared_ptr<LoadedModule> previous = mCurrent.exchange(module, std::memory_order_acq_rel);
+    // the previous module is destroyed here, or by the last handler call still running on it
+    previous.reset();
+    LOGI("loaded module %s generation %llu from %s", module->info.name.c_str(),
+         (unsigned long long) module->info.generation, path.c_str());
+}
+
+void HandlerModuleHost::reload() {
+    std::string path;
+    if (auto current = mCurrent.load(std::memory_order_acquire); current != nullptr) {
+        path = current->info.path;
+    }
+    if (path.empty()) {
+        throw std::runtime_error("no module loaded");
+    }
+    load(path);
+}
+
+bool HandlerModuleHost::isLoaded() const {
+    return mCurrent.load(std::memory_order_acquire) != nullptr;
+}
+
+HandlerModuleHost::ModuleInfo HandlerModuleHost::getModuleInfo() const {
+    auto current = mCurrent.load(std::memory_order_acquire);
+    return current != nullptr ? current->info : ModuleInfo();
+}
+
+ClientSession::MessageHandler HandlerModuleHost::createMessageHandler(ClientSession::MessageHandler fallback) {
+    return [this, fallback = std::move(fallback)](ClientSession *session, const td::td_api::message *message) {
+        // pinned until the call returns, a reload in the meantime does not destroy it
+        auto module = mCurrent.load(std::memory_order_acquire);
+        if (module != nullptr && module->instance->onMessage(session, message)) {
+            return true;
+        }
+        return fallback != nullptr && fallback(session, message);
+    };
+}
+
+std::vector<int32_t> HandlerModuleHost::getInterestedUpdateIds() const {
+    return mUpdateIds;
+}
+
+bool HandlerModuleHost::onUpdate(int32_t clientId, td::td_api::Object &update) {
+    auto module = mCurrent.load(std::memory_order_acquire);
+    return module != nullptr && module->instance->onUpdate(clientId, update);
+}
+
+}
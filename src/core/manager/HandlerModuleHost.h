@@ -0,0 +1,100 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_HANDLERMODULEHOST_H
+#define NEOGROUPCAPTCHABOT_HANDLERMODULEHOST_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "HandlerModule.h"
+#include "UpdateInterceptor.h"
+#include "ClientSession.h"
+
+namespace core {
+
+/**
+ * Runs the handlers of a HandlerModule loaded from a shared object, and swaps in a new build of the module
+ * without touching the sessions, so a logic change does not cost a TDLib cold start.
+ * Every handler call pins the module which is current when it starts, a reload publishes the new module atomically,
+ * calls already running finish on the old one, which is destroyed when the last of them returns.
+ * The shared object is loaded from a private copy, so the file can be replaced in place, and is never unmapped,
+ * since callbacks of requests sent by an old module may still be pending. Each reload keeps its code mapped.
+ * This class is thread safe.
+ */
+class HandlerModuleHost : public UpdateInterceptor {
+public:
+    struct ModuleInfo {
+        std::string path;
+        std::string name;
+        // 1 for the first module, incremented by every load
+        uint64_t generation = 0;
+    };
+
+    /**
+     * @param updateIds the td_api ids of the updates passed to HandlerModule::onUpdate, fixed for the lifetime of the host.
+     * The host needs to be added as an update interceptor for them, an empty vector means all updates, as for any interceptor.
+     */
+    explicit HandlerModuleHost(std::vector<int32_t> updateIds = {});
+
+    ~HandlerModuleHost() override = default;
+
+    /**
+     * Load a module and make it the current one, the previous module is released once no handler uses it.
+     * @param path the path of the shared object
+     * @throws std::runtime_error if the module can't be loaded, the current module stays in place
+     */
+    void load(const std::string &path);
+
+    /**
+     * Load the current module again from its path, e.g. after a new build was deployed.
+     * @throws std::runtime_error if no module was loaded or the module can't be loaded
+     */
+    void reload();
+
+    [[nodiscard]] bool isLoaded() const;
+
+    [[nodiscard]] ModuleInfo getModuleInfo() const;
+
+    /**
+     * Create a message handler for a session which calls the current module.
+     * @param fallback called if no module is loaded or the module did not handle the message, may be null
+     */
+    [[nodiscard]] ClientSession::MessageHandler createMessageHandler(ClientSession::MessageHandler fallback = nullptr);
+
+    [[nodiscard]] std::vector<int32_t> getInterestedUpdateIds() const override;
+
+    bool onUpdate(int32_t clientId, td::td_api::Object &update) override;
+
+private:
+    struct LoadedModule {
+        ModuleInfo info;
+        HandlerModule *instance = nullptr;
+        void (*destroy)(HandlerModule *) = nullptr;
+
+        LoadedModule() = default;
+
+        ~LoadedModule();
+
+        LoadedModule(const LoadedModule &) = delete;
+
+        LoadedModule &operator=(const LoadedModule &) = delete;
+    };
+
+    static void *openPrivateCopy(const std::string &path);
+
+    const std::vector<int32_t> mUpdateIds;
+    // serializes loads
+    mutable std::mutex mLoadMutex;
+    uint64_t mGeneration = 0;
+    std::atomic<std::shared_ptr<LoadedModule>> mCurrent;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_HANDLERMODULEHOST_H
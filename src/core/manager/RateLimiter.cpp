@@ -0,0 +1,251 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "RateLimiter.h"
+
+namespace core {
+
+void RateLimiter::setConfig(const Config &config) {
+    std::scoped_lock lock(mMutex);
+    mConfig = config;
+    for (auto it = mConfig.perMethod.begin(); it != mConfig.perMethod.end();) {
+        if (it->second.isUnlimited()) {
+            it = mConfig.perMethod.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    mGlobalBucket = {};
+    mChatBuckets.clear();
+    mMethodBuckets.clear();
+    mNextChatSweepSize = kChatBucketSweepThreshold;
+    mGlobalOrChatLimited = !mConfig.global.isUnlimited() || !mConfig.perChat.isUnlimited();
+    mMethodLimited = !mConfig.perMethod.empty();
+}
+
+bool RateLimiter::isLimited(int32_t methodId, int64_t chatId) const {
+    if (chatId != 0 && mGlobalOrChatLimited.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    if (mPausesEndMicros.load(std::memory_order_relaxed) > nowMicros()) {
+        return true;
+    }
+    if (!mMethodLimited.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    std::scoped_lock lock(mMutex);
+    return mConfig.perMethod.find(methodId) != mConfig.perMethod.end();
+}
+
+int64_t RateLimiter::nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t RateLimiter::intervalMicros(const Limit &limit) {
+    return std::max<int64_t>(1, int64_t(1000000.0 / limit.ratePerSecond));
+}
+
+int64_t RateLimiter::allowedAt(const Bucket &bucket, const Limit &limit) {
+    // a full bucket lets burst requests through at once
+    int64_t tolerance = intervalMicros(limit) * (std::max(1, limit.burst) - 1);
+    return bucket.theoreticalArrivalMicros - tolerance;
+}
+
+void RateLimiter::take(Bucket &bucket, const Limit &limit, int64_t sendTime) {
+    bucket.theoreticalArrivalMicros = std::max(bucket.theoreticalArrivalMicros, sendTime) + intervalMicros(limit);
+}
+
+int64_t RateLimiter::acquire(int32_t methodId, int64_t chatId, bool allowDelay) {
+    std::scoped_lock lock(mMutex);
+    return acquireLocked(std::span<const int32_t>(&methodId, 1), chatId, allowDelay);
+}
+
+int64_t RateLimiter::acquire(const std::vector<int32_t> &methodIds, int64_t chatId, bool allowDelay) {
+    if (methodIds.empty()) {
+        return 0;
+    }
+    std::scoped_lock lock(mMutex);
+    return acquireLocked(methodIds, chatId, allowDelay);
+}
+
+int64_t RateLimiter::acquireLocked(std::span<const int32_t> methodIds, int64_t chatId, bool allowDelay) {
+    int64_t now = nowMicros();
+    bool useGlobal = chatId != 0 && !mConfig.global.isUnlimited();
+    bool useChat = chatId != 0 && !mConfig.perChat.isUnlimited();
+    Bucket *chatBucket = nullptr;
+    if (useChat) {
+        if (mChatBuckets.size() >= mNextChatSweepSize) {
+            sweepChatBucketsLocked(now);
+        }
+        chatBucket = &mChatBuckets[chatId];
+    }
+    if (mNextPauseExpiryMicros <= now) {
+        sweepPausesLocked(now);
+    }
+    bool checkPauses = mPausesEndMicros.load(std::memory_order_relaxed) > now;
+    int64_t chatPausedUntil = checkPauses && chatId != 0 ? pausedUntilLocked(mChatPausedUntil, chatId) : 0;
+    // the buckets before the first take, restored if a later request of the batch is rejected
+    Bucket globalBefore = mGlobalBucket;
+    Bucket chatBefore = chatBucket != nullptr ? *chatBucket : Bucket();
+    std::vector<std::pair<Bucket *, Bucket>> methodBucketsBefore;
+    int64_t maxDelay = 0;
+    for (int32_t methodId: methodIds) {
+        auto methodLimit = mConfig.perMethod.find(methodId);
+        Bucket *methodBucket = methodLimit != mConfig.perMethod.end() ? &mMethodBuckets[methodId] : nullptr;
+        // the request goes out when every bucket that applies to it has a token
+        int64_t sendTime = std::max(now, chatPausedUntil);
+        if (useGlobal) {
+            sendTime = std::max(sendTime, allowedAt(mGlobalBucket, mConfig.global));
+        }
+        if (chatBucket != nullptr) {
+            sendTime = std::max(sendTime, allowedAt(*chatBucket, mConfig.perChat));
+        }
+        if (methodBucket != nullptr) {
+            sendTime = std::max(sendTime, allowedAt(*methodBucket, methodLimit->second));
+        }
+        if (checkPauses) {
+            sendTime = std::max(sendTime, pausedUntilLocked(mMethodPausedUntil, methodId));
+        }
+        if (sendTime > now && !allowDelay) {
+            mGlobalBucket = globalBefore;
+            if (chatBucket != nullptr) {
+                *chatBucket = chatBefore;
+            }
+            for (auto it = methodBucketsBefore.rbegin(); it != methodBucketsBefore.rend(); ++it) {
+                *it->first = it->second;
+            }
+            mStatistics.droppedCount += methodIds.size();
+            return kRejected;
+        }
+        if (useGlobal) {
+            take(mGlobalBucket, mConfig.global, sendTime);
+        }
+        if (chatBucket != nullptr) {
+            take(*chatBucket, mConfig.perChat, sendTime);
+        }
+        if (methodBucket != nullptr) {
+            if (!allowDelay && methodIds.size() > 1) {
+                methodBucketsBefore.emplace_back(methodBucket, *methodBucket);
+            }
+            take(*methodBucket, methodLimit->second, sendTime);
+        }
+        maxDelay = std::max(maxDelay, sendTime - now);
+    }
+    // a batch goes out together, so every request of it waits for the slowest one
+    if (maxDelay > 0) {
+        mStatistics.delayedCount += methodIds.size();
+        mStatistics.totalDelayMicros += uint64_t(maxDelay) * methodIds.size();
+        mStatistics.maxDelayMicros = std::max(mStatistics.maxDelayMicros, uint64_t(maxDelay));
+        return maxDelay;
+    }
+    mStatistics.passedCount += methodIds.size();
+    return 0;
+}
+
+void RateLimiter::sweepChatBucketsLocked(int64_t now) {
+    // a bucket whose theoretical arrival time has passed is full, which is the same as not having one
+    for (auto it = mChatBuckets.begin(); it != mChatBuckets.end();) {
+        if (it->second.theoreticalArrivalMicros <= now) {
+            it = mChatBuckets.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // sweep again once the map has doubled, so the cost stays O(1) amortized
+    mNextChatSweepSize = std::max(kChatBucketSweepThreshold, mChatBuckets.size() * 2);
+}
+
+void RateLimiter::sweepPausesLocked(int64_t now) {
+    int64_t nextExpiry = INT64_MAX;
+    int64_t end = 0;
+    auto sweep = [now, &nextExpiry, &end](auto &pauses) {
+        for (auto it = pauses.begin(); it != pauses.end();) {
+            if (it->second <= now) {
+                it = pauses.erase(it);
+            } else {
+                nextExpiry = std::min(nextExpiry, it->second);
+                end = std::max(end, it->second);
+                ++it;
+            }
+        }
+    };
+    sweep(mChatPausedUntil);
+    sweep(mMethodPausedUntil);
+    mNextPauseExpiryMicros = nextExpiry;
+    // once every pause has ended, isLimited no longer sends unlimited requests through acquire
+    mPausesEndMicros.store(end, std::memory_order_relaxed);
+}
+
+template<typename Map>
+int64_t RateLimiter::pausedUntilLocked(const Map &pauses, typename Map::key_type key) {
+    auto it = pauses.find(key);
+    return it != pauses.end() ? it->second : 0;
+}
+
+void RateLimiter::pause(int32_t methodId, int64_t chatId, int64_t durationMillis) {
+    if (durationMillis <= 0) {
+        return;
+    }
+    std::scoped_lock lock(mMutex);
+    int64_t now = nowMicros();
+    if (mNextPauseExpiryMicros <= now) {
+        sweepPausesLocked(now);
+    }
+    int64_t until = now + durationMillis * 1000;
+    int64_t &pausedUntil = chatId != 0 ? mChatPausedUntil[chatId] : mMethodPausedUntil[methodId];
+    pausedUntil = std::max(pausedUntil, until);
+    mNextPauseExpiryMicros = std::min(mNextPauseExpiryMicros, pausedUntil);
+    if (pausedUntil > mPausesEndMicros.load(std::memory_order_relaxed)) {
+        mPausesEndMicros.store(pausedUntil, std::memory_order_relaxed);
+    }
+}
+
+int RateLimiter::parseRetryAfterSeconds(int32_t errorCode, const std::string &message) {
+    if (errorCode != 429) {
+        return -1;
+    }
+    for (const char *prefix: {"retry after ", "FLOOD_WAIT_"}) {
+        const char *position = strstr(message.c_str(), prefix);
+        if (position != nullptr) {
+            char *end = nullptr;
+            long seconds = strtol(position + strlen(prefix), &end, 10);
+            if (end != position + strlen(prefix) && seconds >= 0) {
+                return int(std::min<long>(seconds, INT32_MAX));
+            }
+        }
+    }
+    return -1;
+}
+
+void RateLimiter::recordFloodWait(int retryAfterSeconds, bool retried) {
+    std::scoped_lock lock(mMutex);
+    mStatistics.floodWaitCount++;
+    mStatistics.totalFloodWaitMillis += uint64_t(std::max(0, retryAfterSeconds)) * 1000;
+    if (retried) {
+        mStatistics.retriedCount++;
+    } else {
+        mStatistics.retryExhaustedCount++;
+    }
+}
+
+void RateLimiter::recordMerged() {
+    std::scoped_lock lock(mMutex);
+    mStatistics.mergedCount++;
+}
+
+RateLimiter::Statistics RateLimiter::getStatistics() const {
+    std::scoped_lock lock(mMutex);
+    Statistics stats = mStatistics;
+    stats.chatBucketCount = mChatBuckets.size();
+    return stats;
+}
+
+}
@@ -0,0 +1,181 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_RATELIMITER_H
+#define NEOGROUPCAPTCHABOT_RATELIMITER_H
+
+#include <span>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+namespace core {
+
+/**
+ * Outbound token buckets of a session: one global, one per chat and one per td_api method.
+ * The buckets are kept as theoretical arrival times (GCRA), so a request can reserve tokens ahead of time
+ * and is told how long to wait instead of being queued here. Every call is O(1).
+ * The global and per-chat buckets apply to requests about a chat, the per-method buckets to every request
+ * of the configured methods, other requests pass through without taking the lock.
+ * A chat or a method can also be paused for a while, e.g. after Telegram asked us to wait with a FLOOD_WAIT error.
+ * This class is thread safe.
+ */
+class RateLimiter {
+public:
+    struct Limit {
+        // sustained rate, 0 for unlimited
+        double ratePerSecond = 0;
+        // how many requests may go out back to back after an idle period
+        int burst = 1;
+
+        [[nodiscard]] bool isUnlimited() const noexcept {
+            return ratePerSecond <= 0;
+        }
+    };
+
+    struct Config {
+        Limit global;
+        Limit perChat;
+        // keyed by td_api function id
+        std::unordered_map<int32_t, Limit> perMethod;
+    };
+
+    struct Statistics {
+        uint64_t passedCount = 0;
+        uint64_t delayedCount = 0;
+        uint64_t droppedCount = 0;
+        uint64_t mergedCount = 0;
+        uint64_t totalDelayMicros = 0;
+        uint64_t maxDelayMicros = 0;
+        size_t chatBucketCount = 0;
+        // FLOOD_WAIT errors seen, and what became of the requests
+        uint64_t floodWaitCount = 0;
+        uint64_t retriedCount = 0;
+        uint64_t retryExhaustedCount = 0;
+        uint64_t totalFloodWaitMillis = 0;
+    };
+
+    // returned by acquire if the request would have to wait but must not
+    static constexpr int64_t kRejected = -1;
+
+    RateLimiter() = default;
+
+    RateLimiter(const RateLimiter &) = delete;
+
+    RateLimiter &operator=(const RateLimiter &) = delete;
+
+    /**
+     * Replace the limits, the state of existing buckets is reset.
+     */
+    void setConfig(const Config &config);
+
+    /**
+     * Whether a request of the method about the chat is subject to any limit.
+     * @param methodId the td_api function id
+     * @param chatId the chat id, 0 if none
+     */
+    [[nodiscard]] bool isLimited(int32_t methodId, int64_t chatId) const;
+
+    /**
+     * Take the tokens for a request from every bucket that applies to it.
+     * @param methodId the td_api function id
+     * @param chatId the chat id, 0 if none
+     * @param allowDelay if false, nothing is taken if the request can't go out right away
+     * @return how many microseconds the request has to wait before it is sent, 0 to send it now,
+     * or kRejected if allowDelay is false and the request would have to wait
+     */
+    int64_t acquire(int32_t methodId, int64_t chatId, bool allowDelay);
+
+    /**
+     * Take the tokens for a batch of requests which are sent together, e.g. a request group.
+     * @param methodIds the td_api function ids of the requests
+     * @param chatId the chat id, 0 if none
+     * @param allowDelay if false, nothing is taken for any request if one of them can't go out right away
+     * @return how many microseconds the batch has to wait for its slowest request, 0 to send it now,
+     * or kRejected if allowDelay is false and a request would have to wait
+     */
+    int64_t acquire(const std::vector<int32_t> &methodIds, int64_t chatId, bool allowDelay);
+
+    /**
+     * Hold back every request about the chat, or of the method if there is no chat, for a while.
+     * The pause applies whether or not there is a limit configured for the chat or the method.
+     * @param methodId the td_api function id
+     * @param chatId the chat id, 0 if none
+     * @param durationMillis how long to hold back the requests
+     */
+    void pause(int32_t methodId, int64_t chatId, int64_t durationMillis);
+
+    /**
+     * Get the retry-after value of a FLOOD_WAIT error, e.g. "Too Many Requests: retry after 5" or "FLOOD_WAIT_5".
+     * @param errorCode the td_api::error code
+     * @param message the td_api::error message
+     * @return the number of seconds to wait, or -1 if the error is not a FLOOD_WAIT error
+     */
+    [[nodiscard]] static int parseRetryAfterSeconds(int32_t errorCode, const std::string &message);
+
+    /**
+     * Count a FLOOD_WAIT error.
+     * @param retryAfterSeconds the advertised wait
+     * @param retried whether the request is going to be sent again, false if it ran out of retries
+     */
+    void recordFloodWait(int retryAfterSeconds, bool retried);
+
+    /**
+     * Count a request which was merged into one that is already waiting, without taking tokens.
+     */
+    void recordMerged();
+
+    [[nodiscard]] Statistics getStatistics() const;
+
+private:
+    struct Bucket {
+        // the earliest time at which the bucket is full again
+        int64_t theoreticalArrivalMicros = 0;
+    };
+
+    // chat buckets which are full again are removed once there are this many
+    static constexpr size_t kChatBucketSweepThreshold = 4096;
+
+    static int64_t nowMicros();
+
+    static int64_t intervalMicros(const Limit &limit);
+
+    static int64_t allowedAt(const Bucket &bucket, const Limit &limit);
+
+    static void take(Bucket &bucket, const Limit &limit, int64_t sendTime);
+
+    int64_t acquireLocked(std::span<const int32_t> methodIds, int64_t chatId, bool allowDelay);
+
+    void sweepChatBucketsLocked(int64_t now);
+
+    // remove the pauses which have ended and recompute when the next one ends
+    void sweepPausesLocked(int64_t now);
+
+    // the end of the pause of the key, 0 if there is none
+    template<typename Map>
+    static int64_t pausedUntilLocked(const Map &pauses, typename Map::key_type key);
+
+    mutable std::mutex mMutex;
+    std::atomic_bool mGlobalOrChatLimited = false;
+    std::atomic_bool mMethodLimited = false;
+    // the end of the last pause, no request is held back by a pause after it
+    std::atomic_int64_t mPausesEndMicros = 0;
+    // the end of the first pause, expired pauses are swept from then on
+    int64_t mNextPauseExpiryMicros = INT64_MAX;
+    Config mConfig;
+    Bucket mGlobalBucket;
+    std::unordered_map<int64_t, Bucket> mChatBuckets;
+    std::unordered_map<int32_t, Bucket> mMethodBuckets;
+    std::unordered_map<int64_t, int64_t> mChatPausedUntil;
+    std::unordered_map<int32_t, int64_t> mMethodPausedUntil;
+    size_t mNextChatSweepSize = kChatBucketSweepThreshold;
+    Statistics mStatistics;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_RATELIMITER_H
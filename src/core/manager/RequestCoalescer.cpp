@@ -0,0 +1,208 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <algorithm>
+
+#include "utils/SyncUtils.h"
+#include "TdObjectJson.h"
+
+#include "RequestCoalescer.h"
+
+namespace td_api = td::td_api;
+
+namespace core {
+
+std::optional<RequestCoalescer::Key> RequestCoalescer::getKey(const td_api::Function &request) {
+    Key key;
+    key.functionId = request.get_id();
+    switch (request.get_id()) {
+        case td_api::getMe::ID: {
+            return key;
+        }
+        case td_api::getChat::ID: {
+            key.first = static_cast<const td_api::getChat &>(request).chat_id_;
+            return key;
+        }
+        case td_api::getChatAdministrators::ID: {
+            key.first = static_cast<const td_api::getChatAdministrators &>(request).chat_id_;
+            return key;
+        }
+        case td_api::getUser::ID: {
+            key.first = static_cast<const td_api::getUser &>(request).user_id_;
+            return key;
+        }
+        case td_api::getUserFullInfo::ID: {
+            key.first = static_cast<const td_api::getUserFullInfo &>(request).user_id_;
+            return key;
+        }
+        case td_api::getBasicGroup::ID: {
+            key.first = static_cast<const td_api::getBasicGroup &>(request).basic_group_id_;
+            return key;
+        }
+        case td_api::getBasicGroupFullInfo::ID: {
+            key.first = static_cast<const td_api::getBasicGroupFullInfo &>(request).basic_group_id_;
+            return key;
+        }
+        case td_api::getSupergroup::ID: {
+            key.first = static_cast<const td_api::getSupergroup &>(request).supergroup_id_;
+            return key;
+        }
+        case td_api::getSupergroupFullInfo::ID: {
+            key.first = static_cast<const td_api::getSupergroupFullInfo &>(request).supergroup_id_;
+            return key;
+        }
+        case td_api::getChatMember::ID: {
+            const auto &getChatMember = static_cast<const td_api::getChatMember &>(request);
+            const auto *member = getChatMember.member_id_.get();
+            if (member == nullptr) {
+                return std::nullopt;
+            }
+            key.first = getChatMember.chat_id_;
+            key.argumentType = member->get_id();
+            if (member->get_id() == td_api::messageSenderUser::ID) {
+                key.second = static_cast<const td_api::messageSenderUser *>(member)->user_id_;
+            } else if (member->get_id() == td_api::messageSenderChat::ID) {
+                key.second = static_cast<const td_api::messageSenderChat *>(member)->chat_id_;
+            } else {
+                return std::nullopt;
+            }
+            return key;
+        }
+        default: {
+            return std::nullopt;
+        }
+    }
+}
+
+size_t RequestCoalescer::KeyHash::operator()(const Key &key) const noexcept {
+    // mix the fields in one at a time with the splitmix64 finalizer
+    uint64_t h = uint64_t(uint32_t(key.functionId)) << 32 | uint32_t(key.argumentType);
+    for (uint64_t value: {uint64_t(key.first), uint64_t(key.second)}) {
+        h ^= value + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+    }
+    return size_t(h);
+}
+
+bool RequestCoalescer::join(const Key &key, Callback &callback, uint64_t &token, int timeoutMillis) {
+    std::vector<Callback> expired;
+    bool queued;
+    {
+        std::scoped_lock lock(mMutex);
+        uint64_t now = utils::getCurrentTimeMillis();
+        auto it = mInFlight.find(key);
+        if (it != mInFlight.end() && it->second.deadline <= now) {
+            // the response is not coming any more and the timer has not caught up yet, don't queue behind it
+            for (auto &waiter: it->second.waiters) {
+                expired.push_back(std::move(waiter.callback));
+            }
+            mInFlight.erase(it);
+            mExpiredCount++;
+            it = mInFlight.end();
+        }
+        if (it == mInFlight.end()) {
+            InFlight &inFlight = mInFlight[key];
+            inFlight.token = mNextToken++;
+            inFlight.deadline = now + uint64_t(timeoutMillis > 0 ? timeoutMillis : kDefaultMaxInFlightMillis);
+            token = inFlight.token;
+            mLeaderCount++;
+            queued = false;
+        } else {
+            token = mNextToken++;
+            it->second.waiters.push_back(Waiter{token, std::move(callback)});
+            mCoalescedCount++;
+            queued = true;
+        }
+    }
+    failExpired(expired);
+    return queued;
+}
+
+void RequestCoalescer::complete(const Key &key, uint64_t token, td_api::object_ptr<td_api::Object> response,
+                                const Callback &callback) {
+    std::vector<Waiter> waiters;
+    {
+        std::scoped_lock lock(mMutex);
+        auto it = mInFlight.find(key);
+        // the entry may belong to a later request if this one has expired
+        if (it != mInFlight.end() && it->second.token == token) {
+            waiters = std::move(it->second.waiters);
+            mInFlight.erase(it);
+        }
+    }
+    // encode before the original is handed out, its callback may take it apart
+    std::string encoded;
+    if (!waiters.empty() && response != nullptr) {
+        encoded = json::serializeObject(*response);
+    }
+    if (callback) {
+        callback(std::move(response));
+    }
+    for (auto &waiter: waiters) {
+        if (!waiter.callback) {
+            continue;
+        }
+        if (encoded.empty()) {
+            waiter.callback(nullptr);
+            continue;
+        }
+        auto copy = json::copyObject(encoded);
+        if (copy == nullptr) {
+            copy = td_api::make_object<td_api::error>(500, "Failed to copy the shared response");
+        }
+        waiter.callback(std::move(copy));
+    }
+}
+
+void RequestCoalescer::expire(const Key &key, uint64_t token) {
+    std::vector<Callback> expired;
+    {
+        std::scoped_lock lock(mMutex);
+        auto it = mInFlight.find(key);
+        if (it == mInFlight.end()) {
+            return;
+        }
+        auto &waiters = it->second.waiters;
+        if (it->second.token == token) {
+            for (auto &waiter: waiters) {
+                expired.push_back(std::move(waiter.callback));
+            }
+            mInFlight.erase(it);
+            mExpiredCount++;
+        } else {
+            auto waiter = std::find_if(waiters.begin(), waiters.end(), [token](const Waiter &w) {
+                return w.token == token;
+            });
+            if (waiter == waiters.end()) {
+                // already completed
+                return;
+            }
+            expired.push_back(std::move(waiter->callback));
+            waiters.erase(waiter);
+        }
+    }
+    failExpired(expired);
+}
+
+void RequestCoalescer::failExpired(std::vector<Callback> &expired) {
+    for (auto &waiter: expired) {
+        if (waiter) {
+            waiter(td_api::make_object<td_api::error>(kExpiredErrorCode, "Shared request timed out"));
+        }
+    }
+}
+
+RequestCoalescer::Statistics RequestCoalescer::getStatistics() const {
+    std::scoped_lock lock(mMutex);
+    Statistics stats;
+    stats.leaderCount = mLeaderCount;
+    stats.coalescedCount = mCoalescedCount;
+    stats.expiredCount = mExpiredCount;
+    stats.inFlightCount = mInFlight.size();
+    return stats;
+}
+
+}
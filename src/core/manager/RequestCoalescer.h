@@ -0,0 +1,141 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_REQUESTCOALESCER_H
+#define NEOGROUPCAPTCHABOT_REQUESTCOALESCER_H
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+
+#include <td/telegram/td_api.h>
+
+namespace core {
+
+/**
+ * Lets identical idempotent reads which are in flight at the same time share one TDLib request, e.g. the getChat
+ * and getChatMember calls of the handlers of a join burst.
+ * The first request of a key is sent, later identical requests wait for its response instead of being sent,
+ * each of them gets its own copy of the response, including errors and timeouts.
+ * A request in flight which is not completed by its deadline, e.g. because its response was lost,
+ * fails its waiters with a timeout error and no longer holds back later identical requests,
+ * and a waiter with a timeout of its own fails alone when it passes. The owner drives the deadlines, see expire.
+ * Only reads of a single object are coalesced, see getKey.
+ * This class is thread safe.
+ */
+class RequestCoalescer {
+public:
+    using Callback = std::function<void(td::td_api::object_ptr<td::td_api::Object>)>;
+
+    // how long a request in flight without a timeout of its own may hold back identical requests
+    static constexpr int kDefaultMaxInFlightMillis = 60 * 1000;
+    // the error code of the waiters of a request which missed its deadline
+    static constexpr int32_t kExpiredErrorCode = 408;
+
+    /**
+     * Identifies a read by its function id and arguments.
+     */
+    struct Key {
+        int32_t functionId = 0;
+        // the constructor id of a polymorphic argument, e.g. the member sender type of getChatMember
+        int32_t argumentType = 0;
+        int64_t first = 0;
+        int64_t second = 0;
+
+        bool operator==(const Key &other) const noexcept = default;
+    };
+
+    struct Statistics {
+        // requests which were sent
+        uint64_t leaderCount = 0;
+        // requests which shared the response of a request in flight
+        uint64_t coalescedCount = 0;
+        // requests in flight which missed their deadline
+        uint64_t expiredCount = 0;
+        size_t inFlightCount = 0;
+    };
+
+    RequestCoalescer() = default;
+
+    RequestCoalescer(const RequestCoalescer &) = delete;
+
+    RequestCoalescer &operator=(const RequestCoalescer &) = delete;
+
+    /**
+     * Get the key of a request if it is an idempotent read that can be coalesced.
+     * @return the key, or nothing if the request has side effects or is not worth coalescing
+     */
+    [[nodiscard]] static std::optional<Key> getKey(const td::td_api::Function &request);
+
+    /**
+     * Wait for the response of an identical request in flight, or become the one in flight.
+     * The caller is expected to call expire with the token once the deadline has passed,
+     * for the request in flight after its timeout or kDefaultMaxInFlightMillis,
+     * for a queued request only if it has a timeout of its own.
+     * @param key the key of the request
+     * @param callback the callback of the request, moved from if it is queued
+     * @param token set to the token to pass to complete and expire if the caller becomes the request in flight,
+     * or to the token to pass to expire if it is queued
+     * @param timeoutMillis the timeout of the request, if positive it is the deadline of the request in flight,
+     * otherwise kDefaultMaxInFlightMillis is
+     * @return true if the callback was queued behind a request in flight, so the request must not be sent,
+     * false if the caller has to send the request and pass the response to complete, or an error if it can't be sent
+     */
+    bool join(const Key &key, Callback &callback, uint64_t &token, int timeoutMillis = 0);
+
+    /**
+     * Fail a request whose deadline has passed with a kExpiredErrorCode error, if it is still waiting.
+     * For the request in flight, every request queued behind it fails and later identical requests are no
+     * longer held back, while the request itself completes on its own. A queued request fails alone.
+     * @param key the key of the request
+     * @param token the token from join
+     */
+    void expire(const Key &key, uint64_t token);
+
+    /**
+     * Hand the response of the request in flight to everyone waiting for it.
+     * If the request has missed its deadline in the meantime, only the callback gets the response.
+     * @param key the key of the request
+     * @param token the token from join
+     * @param response the response, the waiters get copies of it
+     * @param callback the callback of the request which was sent, gets the response itself, may be null
+     */
+    void complete(const Key &key, uint64_t token, td::td_api::object_ptr<td::td_api::Object> response,
+                  const Callback &callback);
+
+    [[nodiscard]] Statistics getStatistics() const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key &key) const noexcept;
+    };
+
+    struct Waiter {
+        uint64_t token = 0;
+        Callback callback;
+    };
+
+    struct InFlight {
+        uint64_t token = 0;
+        uint64_t deadline = 0;
+        // the requests waiting for the one in flight
+        std::vector<Waiter> waiters;
+    };
+
+    static void failExpired(std::vector<Callback> &expired);
+
+    mutable std::mutex mMutex;
+    std::unordered_map<Key, InFlight, KeyHash> mInFlight;
+    uint64_t mNextToken = 1;
+    uint64_t mLeaderCount = 0;
+    uint64_t mCoalescedCount = 0;
+    uint64_t mExpiredCount = 0;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_REQUESTCOALESCER_H
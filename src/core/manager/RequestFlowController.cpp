@@ -0,0 +1,174 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <algorithm>
+
+#include "RequestFlowController.h"
+
+namespace core {
+
+void RequestFlowController::setLimits(int maxOutstanding, int maxOutstandingPerChat) {
+    std::vector<std::function<void()>> released;
+    {
+        std::scoped_lock lock(mMutex);
+        mMaxOutstanding = std::max(0, maxOutstanding);
+        mMaxOutstandingPerChat = std::max(0, maxOutstandingPerChat);
+        mEnabled = mMaxOutstanding != 0 || mMaxOutstandingPerChat != 0;
+        // a changed per-chat cap may block or unblock any chat
+        for (auto it = mChatQueues.begin(); it != mChatQueues.end();) {
+            auto next = std::next(it);
+            updateReadyLocked(it->first, it->second);
+            it = next;
+        }
+        drainLocked(released);
+    }
+    for (auto &send: released) {
+        send();
+    }
+}
+
+bool RequestFlowController::isEnabled() const noexcept {
+    return mEnabled.load(std::memory_order_relaxed);
+}
+
+// a group larger than the cap would never fit, it goes alone instead
+static bool fits(size_t outstanding, size_t count, int cap) {
+    return cap == 0 || outstanding == 0 || outstanding + count <= size_t(cap);
+}
+
+bool RequestFlowController::hasCapacityLocked(int64_t chatId, size_t count) const {
+    return fits(mOutstandingCount, count, mMaxOutstanding) && hasChatCapacityLocked(chatId, count);
+}
+
+bool RequestFlowController::hasChatCapacityLocked(int64_t chatId, size_t count) const {
+    if (mMaxOutstandingPerChat != 0 && chatId != 0) {
+        auto it = mOutstandingPerChat.find(chatId);
+        if (it != mOutstandingPerChat.end() && !fits(it->second, count, mMaxOutstandingPerChat)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RequestFlowController::updateReadyLocked(int64_t chatId, ChatQueue &queue) {
+    if (queue.ready) {
+        mReadyChats.erase(queue.readyKey);
+        queue.ready = false;
+    }
+    if (queue.requests.empty()) {
+        mChatQueues.erase(chatId);
+        return;
+    }
+    auto first = queue.requests.begin();
+    if (hasChatCapacityLocked(chatId, first->second.count)) {
+        queue.ready = true;
+        queue.readyKey = first->first;
+        mReadyChats.emplace(first->first, chatId);
+    }
+}
+
+void RequestFlowController::acquireLocked(int64_t chatId, size_t count) {
+    mOutstandingCount += count;
+    if (chatId != 0) {
+        mOutstandingPerChat[chatId] += count;
+    }
+}
+
+bool RequestFlowController::tryAcquire(int64_t chatId, size_t count) {
+    std::scoped_lock lock(mMutex);
+    // a queued request waiting only for the total cap goes first
+    if (!mReadyChats.empty() || !hasCapacityLocked(chatId, count)) {
+        return false;
+    }
+    acquireLocked(chatId, count);
+    return true;
+}
+
+void RequestFlowController::enqueue(int64_t chatId, int priority, std::function<void()> send, size_t count) {
+    {
+        std::scoped_lock lock(mMutex);
+        if (!mReadyChats.empty() || !hasCapacityLocked(chatId, count)) {
+            QueuedRequest request;
+            request.chatId = chatId;
+            request.count = count;
+            request.enqueueTime = Clock::now();
+            request.send = std::move(send);
+            auto &queue = mChatQueues[chatId];
+            queue.requests.emplace(QueueKey{priority, mQueueSequence++}, std::move(request));
+            // the new request may be the first of its chat now
+            updateReadyLocked(chatId, queue);
+            mQueueDepth++;
+            mMaxQueueDepth = std::max(mMaxQueueDepth, mQueueDepth);
+            return;
+        }
+        acquireLocked(chatId, count);
+    }
+    send();
+}
+
+void RequestFlowController::release(int64_t chatId, size_t count) {
+    std::vector<std::function<void()>> released;
+    {
+        std::scoped_lock lock(mMutex);
+        mOutstandingCount -= std::min(mOutstandingCount, count);
+        if (chatId != 0) {
+            auto it = mOutstandingPerChat.find(chatId);
+            if (it != mOutstandingPerChat.end()) {
+                it->second -= std::min(it->second, count);
+                if (it->second == 0) {
+                    mOutstandingPerChat.erase(it);
+                }
+            }
+            // only this chat can have become unblocked by its own cap
+            if (auto queue = mChatQueues.find(chatId); queue != mChatQueues.end() && !queue->second.ready) {
+                updateReadyLocked(chatId, queue->second);
+            }
+        }
+        drainLocked(released);
+    }
+    for (auto &send: released) {
+        send();
+    }
+}
+
+void RequestFlowController::drainLocked(std::vector<std::function<void()>> &released) {
+    // release queued requests in priority order, chats still at their cap are not in the index
+    auto now = Clock::now();
+    while (!mReadyChats.empty()) {
+        int64_t chatId = mReadyChats.begin()->second;
+        auto &queue = mChatQueues.at(chatId);
+        auto first = queue.requests.begin();
+        // a group waiting for the total cap is not overtaken by smaller requests behind it
+        if (!fits(mOutstandingCount, first->second.count, mMaxOutstanding)) {
+            break;
+        }
+        acquireLocked(chatId, first->second.count);
+        recordWaitLocked(first->second, now);
+        released.emplace_back(std::move(first->second.send));
+        queue.requests.erase(first);
+        mQueueDepth--;
+        updateReadyLocked(chatId, queue);
+    }
+}
+
+void RequestFlowController::recordWaitLocked(const QueuedRequest &request, Clock::time_point now) {
+    auto micros = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(now - request.enqueueTime).count());
+    mQueuedCount++;
+    mTotalWaitMicros += micros;
+    mMaxWaitMicros = std::max(mMaxWaitMicros, micros);
+}
+
+RequestFlowController::Statistics RequestFlowController::getStatistics() const {
+    std::scoped_lock lock(mMutex);
+    Statistics stats;
+    stats.outstandingCount = mOutstandingCount;
+    stats.queueDepth = mQueueDepth;
+    stats.maxQueueDepth = mMaxQueueDepth;
+    stats.queuedCount = mQueuedCount;
+    stats.totalWaitMicros = mTotalWaitMicros;
+    stats.maxWaitMicros = mMaxWaitMicros;
+    return stats;
+}
+
+}
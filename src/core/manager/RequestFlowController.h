@@ -0,0 +1,146 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_REQUESTFLOWCONTROLLER_H
+#define NEOGROUPCAPTCHABOT_REQUESTFLOWCONTROLLER_H
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <unordered_map>
+
+namespace core {
+
+/**
+ * Caps the number of outstanding requests of a session, in total and per chat.
+ * Requests over the cap wait in a local queue per chat, ordered by priority and then by submission order,
+ * and are released as responses to earlier requests arrive.
+ * Chats whose first request is within the per-chat cap are indexed by that request, so a release only
+ * looks at the chat it belongs to and at the head of the index, not at the whole queue.
+ * This class is thread safe.
+ */
+class RequestFlowController {
+public:
+    struct Statistics {
+        // requests sent to TDLib that have no response yet
+        size_t outstandingCount = 0;
+        // requests waiting in the local queue
+        size_t queueDepth = 0;
+        size_t maxQueueDepth = 0;
+        // requests which had to wait in the queue, and how long they waited
+        uint64_t queuedCount = 0;
+        uint64_t totalWaitMicros = 0;
+        uint64_t maxWaitMicros = 0;
+    };
+
+    RequestFlowController() = default;
+
+    RequestFlowController(const RequestFlowController &) = delete;
+
+    RequestFlowController &operator=(const RequestFlowController &) = delete;
+
+    /**
+     * Set the caps, 0 means unlimited. Lowering a cap does not affect requests which are already outstanding.
+     * @param maxOutstanding the maximum number of outstanding requests
+     * @param maxOutstandingPerChat the maximum number of outstanding requests with the same chat id
+     */
+    void setLimits(int maxOutstanding, int maxOutstandingPerChat);
+
+    /**
+     * Whether any cap is set. If not, requests don't need to be accounted at all.
+     */
+    [[nodiscard]] bool isEnabled() const noexcept;
+
+    /**
+     * Take the slots for a request, or for a group of requests sent together, if there is capacity.
+     * A group larger than a cap is let through once nothing else is outstanding under that cap.
+     * @param chatId the chat the requests are about, 0 if none
+     * @param count the number of requests
+     * @return true if the slots were taken and the requests can be sent right away
+     */
+    bool tryAcquire(int64_t chatId, size_t count = 1);
+
+    /**
+     * Queue a request, or send it right away if capacity became available in the meantime.
+     * @param chatId the chat the request is about, 0 if none
+     * @param priority higher priorities are released first
+     * @param send sends the request, called once the slots have been taken for it, without holding any lock
+     * @param count the number of requests sent together by send
+     */
+    void enqueue(int64_t chatId, int priority, std::function<void()> send, size_t count = 1);
+
+    /**
+     * Return the slots of requests which have completed, which may release queued requests.
+     * @param chatId the chat id the slots were taken for
+     * @param count the number of slots
+     */
+    void release(int64_t chatId, size_t count = 1);
+
+    [[nodiscard]] Statistics getStatistics() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct QueuedRequest {
+        int64_t chatId = 0;
+        size_t count = 1;
+        Clock::time_point enqueueTime;
+        std::function<void()> send;
+    };
+
+    // higher priority first, then first come first served
+    struct QueueKey {
+        int priority;
+        uint64_t sequence;
+
+        bool operator<(const QueueKey &other) const noexcept {
+            return priority != other.priority ? priority > other.priority : sequence < other.sequence;
+        }
+    };
+
+    struct ChatQueue {
+        std::map<QueueKey, QueuedRequest> requests;
+        // whether the chat is in mReadyChats, and under which key
+        bool ready = false;
+        QueueKey readyKey{};
+    };
+
+    [[nodiscard]] bool hasCapacityLocked(int64_t chatId, size_t count) const;
+
+    [[nodiscard]] bool hasChatCapacityLocked(int64_t chatId, size_t count) const;
+
+    // index the chat by its first request if the per-chat cap lets that one go, drop the queue if it is empty
+    void updateReadyLocked(int64_t chatId, ChatQueue &queue);
+
+    void acquireLocked(int64_t chatId, size_t count);
+
+    void drainLocked(std::vector<std::function<void()>> &released);
+
+    void recordWaitLocked(const QueuedRequest &request, Clock::time_point now);
+
+    mutable std::mutex mMutex;
+    std::atomic_bool mEnabled = false;
+    int mMaxOutstanding = 0;
+    int mMaxOutstandingPerChat = 0;
+    size_t mOutstandingCount = 0;
+    std::unordered_map<int64_t, size_t> mOutstandingPerChat;
+    std::unordered_map<int64_t, ChatQueue> mChatQueues;
+    // the first request of every chat which waits only for the total cap
+    std::map<QueueKey, int64_t> mReadyChats;
+    size_t mQueueDepth = 0;
+    uint64_t mQueueSequence = 0;
+    size_t mMaxQueueDepth = 0;
+    uint64_t mQueuedCount = 0;
+    uint64_t mTotalWaitMicros = 0;
+    uint64_t mMaxWaitMicros = 0;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_REQUESTFLOWCONTROLLER_H
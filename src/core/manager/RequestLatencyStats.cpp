@@ -0,0 +1,202 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+#include "RequestLatencyStats.h"
+
+namespace core {
+
+static_assert((RequestLatencyStats::kMaxFunctions & (RequestLatencyStats::kMaxFunctions - 1)) == 0,
+              "kMaxFunctions must be a power of two");
+static_assert((RequestLatencyStats::kMaxErrorKeys & (RequestLatencyStats::kMaxErrorKeys - 1)) == 0,
+              "kMaxErrorKeys must be a power of two");
+
+static inline size_t hashKey(uint64_t key) noexcept {
+    return size_t((key * 0x9E3779B97F4A7C15uLL) >> 32);
+}
+
+RequestLatencyStats::RequestLatencyStats()
+        : mFunctions(std::make_unique<FunctionEntry[]>(kMaxFunctions)),
+          mErrors(std::make_unique<ErrorEntry[]>(kMaxErrorKeys)) {}
+
+RequestLatencyStats::~RequestLatencyStats() = default;
+
+uint64_t RequestLatencyStats::nowMicros() noexcept {
+    return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+int RequestLatencyStats::bucketOf(uint64_t micros) noexcept {
+    if (micros < 4) {
+        return int(micros);
+    }
+    // 4 linear sub-buckets per power of two
+    int msb = 63 - std::countl_zero(micros);
+    int sub = int((micros >> (msb - 2)) & 3);
+    return std::min(kHistogramBuckets - 1, (msb - 1) * 4 + sub);
+}
+
+uint64_t RequestLatencyStats::bucketUpperBound(int bucket) noexcept {
+    if (bucket < 3) {
+        return uint64_t(bucket);
+    }
+    // the lower bound of the next bucket, minus one
+    int next = bucket + 1;
+    int msb = next / 4 + 1;
+    int sub = next % 4;
+    return (uint64_t(4 + sub) << (msb - 2)) - 1;
+}
+
+RequestLatencyStats::FunctionEntry *RequestLatencyStats::findFunction(int32_t functionId) noexcept {
+    size_t mask = kMaxFunctions - 1;
+    size_t index = hashKey(uint32_t(functionId)) & mask;
+    for (size_t probe = 0; probe < kMaxFunctions; probe++) {
+        FunctionEntry &entry = mFunctions[(index + probe) & mask];
+        int32_t current = entry.functionId.load(std::memory_order_acquire);
+        if (current == functionId) {
+            return &entry;
+        }
+        if (current == 0) {
+            int32_t expected = 0;
+            if (entry.functionId.compare_exchange_strong(expected, functionId, std::memory_order_acq_rel)
+                || expected == functionId) {
+                return &entry;
+            }
+        }
+    }
+    return nullptr;
+}
+
+RequestLatencyStats::ErrorEntry *RequestLatencyStats::findError(uint64_t key) noexcept {
+    size_t mask = kMaxErrorKeys - 1;
+    size_t index = hashKey(key) & mask;
+    for (size_t probe = 0; probe < kMaxErrorKeys; probe++) {
+        ErrorEntry &entry = mErrors[(index + probe) & mask];
+        uint64_t current = entry.key.load(std::memory_order_acquire);
+        if (current == key) {
+            return &entry;
+        }
+        if (current == 0) {
+            uint64_t expected = 0;
+            if (entry.key.compare_exchange_strong(expected, key, std::memory_order_acq_rel) || expected == key) {
+                return &entry;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void RequestLatencyStats::record(int32_t functionId, uint64_t latencyMicros, int32_t errorCode) noexcept {
+    FunctionEntry *entry = functionId != 0 ? findFunction(functionId) : nullptr;
+    if (entry == nullptr) {
+        mDroppedCount.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    entry->count.fetch_add(1, std::memory_order_relaxed);
+    entry->totalMicros.fetch_add(latencyMicros, std::memory_order_relaxed);
+    entry->histogram[bucketOf(latencyMicros)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max = entry->maxMicros.load(std::memory_order_relaxed);
+    while (latencyMicros > max && !entry->maxMicros.compare_exchange_weak(max, latencyMicros, std::memory_order_relaxed)) {
+    }
+    if (errorCode != 0) {
+        entry->errorCount.fetch_add(1, std::memory_order_relaxed);
+        uint64_t key = (uint64_t(uint32_t(functionId)) << 32) | uint32_t(errorCode);
+        if (ErrorEntry *error = findError(key); error != nullptr) {
+            error->count.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            mDroppedCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+RequestLatencyStats::Snapshot RequestLatencyStats::getSnapshot() const {
+    Snapshot snapshot;
+    for (size_t i = 0; i < kMaxFunctions; i++) {
+        const FunctionEntry &entry = mFunctions[i];
+        int32_t functionId = entry.functionId.load(std::memory_order_acquire);
+        if (functionId == 0) {
+            continue;
+        }
+        FunctionLatency latency;
+        latency.functionId = functionId;
+        latency.count = entry.count.load(std::memory_order_relaxed);
+        latency.errorCount = entry.errorCount.load(std::memory_order_relaxed);
+        latency.totalMicros = entry.totalMicros.load(std::memory_order_relaxed);
+        latency.maxMicros = entry.maxMicros.load(std::memory_order_relaxed);
+        for (int bucket = 0; bucket < kHistogramBuckets; bucket++) {
+            latency.histogram[bucket] = entry.histogram[bucket].load(std::memory_order_relaxed);
+        }
+        snapshot.functions.push_back(latency);
+    }
+    for (size_t i = 0; i < kMaxErrorKeys; i++) {
+        const ErrorEntry &entry = mErrors[i];
+        uint64_t key = entry.key.load(std::memory_order_acquire);
+        if (key == 0) {
+            continue;
+        }
+        snapshot.errors.push_back({int32_t(uint32_t(key >> 32)), int32_t(uint32_t(key)),
+                                   entry.count.load(std::memory_order_relaxed)});
+    }
+    std::sort(snapshot.functions.begin(), snapshot.functions.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.count > rhs.count;
+    });
+    std::sort(snapshot.errors.begin(), snapshot.errors.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.count > rhs.count;
+    });
+    snapshot.droppedCount = mDroppedCount.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+uint64_t RequestLatencyStats::FunctionLatency::getPercentileMicros(double quantile) const noexcept {
+    uint64_t total = 0;
+    for (uint64_t bucketCount: histogram) {
+        total += bucketCount;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    auto rank = uint64_t(quantile * double(total));
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < kHistogramBuckets; bucket++) {
+        seen += histogram[bucket];
+        if (seen > rank) {
+            return std::min(bucketUpperBound(bucket), maxMicros);
+        }
+    }
+    return maxMicros;
+}
+
+std::string RequestLatencyStats::Snapshot::format() const {
+    std::string result;
+    char line[192];
+    snprintf(line, sizeof(line), "%12s %10s %8s %10s %10s %10s %10s %10s\n",
+             "function", "count", "errors", "avg us", "p50 us", "p90 us", "p99 us", "max us");
+    result += line;
+    for (const auto &function: functions) {
+        snprintf(line, sizeof(line), "%12d %10llu %8llu %10llu %10llu %10llu %10llu %10llu\n",
+                 function.functionId, (unsigned long long) function.count, (unsigned long long) function.errorCount,
+                 (unsigned long long) (function.count != 0 ? function.totalMicros / function.count : 0),
+                 (unsigned long long) function.getPercentileMicros(0.5),
+                 (unsigned long long) function.getPercentileMicros(0.9),
+                 (unsigned long long) function.getPercentileMicros(0.99),
+                 (unsigned long long) function.maxMicros);
+        result += line;
+    }
+    for (const auto &error: errors) {
+        snprintf(line, sizeof(line), "function %d error %d: %llu\n",
+                 error.functionId, error.errorCode, (unsigned long long) error.count);
+        result += line;
+    }
+    if (droppedCount != 0) {
+        snprintf(line, sizeof(line), "dropped: %llu\n", (unsigned long long) droppedCount);
+        result += line;
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,125 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_REQUESTLATENCYSTATS_H
+#define NEOGROUPCAPTCHABOT_REQUESTLATENCYSTATS_H
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace core {
+
+/**
+ * Round trip latency histograms and error counts per td_api function id.
+ * <p>
+ * Recording takes no lock: the entry of a function is found with a linear probe in a fixed size table
+ * and claimed with a CAS the first time the function is seen, after that it is only relaxed atomic increments.
+ * The histograms are log-linear, 4 buckets per power of two microseconds, so percentiles are accurate to 25%.
+ */
+class RequestLatencyStats {
+public:
+    static constexpr int kHistogramBuckets = 128;
+    // distinct function ids which can be tracked, further functions are only counted in droppedCount
+    static constexpr size_t kMaxFunctions = 128;
+    // distinct (function id, error code) pairs which can be tracked
+    static constexpr size_t kMaxErrorKeys = 256;
+
+    struct FunctionLatency {
+        int32_t functionId = 0;
+        uint64_t count = 0;
+        uint64_t errorCount = 0;
+        uint64_t totalMicros = 0;
+        uint64_t maxMicros = 0;
+        std::array<uint64_t, kHistogramBuckets> histogram = {};
+
+        /**
+         * Get the latency below which the given fraction of the requests completed.
+         * @param quantile the fraction, e.g. 0.99
+         * @return the upper bound of the bucket the quantile falls into, in microseconds
+         */
+        [[nodiscard]] uint64_t getPercentileMicros(double quantile) const noexcept;
+    };
+
+    struct ErrorCount {
+        int32_t functionId = 0;
+        int32_t errorCode = 0;
+        uint64_t count = 0;
+    };
+
+    struct Snapshot {
+        std::vector<FunctionLatency> functions;
+        std::vector<ErrorCount> errors;
+        // records which found no free entry
+        uint64_t droppedCount = 0;
+
+        /**
+         * Format as a table, one function per line followed by the error counts.
+         */
+        [[nodiscard]] std::string format() const;
+    };
+
+    RequestLatencyStats();
+
+    ~RequestLatencyStats();
+
+    RequestLatencyStats(const RequestLatencyStats &) = delete;
+
+    RequestLatencyStats &operator=(const RequestLatencyStats &) = delete;
+
+    /**
+     * Record one completed request.
+     * @param functionId the td_api constructor id of the function
+     * @param latencyMicros the round trip time
+     * @param errorCode the code of the td_api::error the request completed with, or 0 on success
+     */
+    void record(int32_t functionId, uint64_t latencyMicros, int32_t errorCode) noexcept;
+
+    /**
+     * Get a copy of the counters, the counters keep running while the copy is taken,
+     * so the fields of one function may be off by the requests completed in the meantime.
+     */
+    [[nodiscard]] Snapshot getSnapshot() const;
+
+    /**
+     * A monotonic clock in microseconds, the clock send times are taken with.
+     */
+    [[nodiscard]] static uint64_t nowMicros() noexcept;
+
+    [[nodiscard]] static int bucketOf(uint64_t micros) noexcept;
+
+    [[nodiscard]] static uint64_t bucketUpperBound(int bucket) noexcept;
+
+private:
+    struct FunctionEntry {
+        // 0 means free
+        std::atomic_int32_t functionId = 0;
+        std::atomic_uint64_t count = 0;
+        std::atomic_uint64_t errorCount = 0;
+        std::atomic_uint64_t totalMicros = 0;
+        std::atomic_uint64_t maxMicros = 0;
+        std::array<std::atomic_uint64_t, kHistogramBuckets> histogram = {};
+    };
+
+    struct ErrorEntry {
+        // function id in the high half, error code in the low half, 0 means free
+        std::atomic_uint64_t key = 0;
+        std::atomic_uint64_t count = 0;
+    };
+
+    FunctionEntry *findFunction(int32_t functionId) noexcept;
+
+    ErrorEntry *findError(uint64_t key) noexcept;
+
+    std::unique_ptr<FunctionEntry[]> mFunctions;
+    std::unique_ptr<ErrorEntry[]> mErrors;
+    std::atomic_uint64_t mDroppedCount = 0;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_REQUESTLATENCYSTATS_H
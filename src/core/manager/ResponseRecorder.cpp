@@ -0,0 +1,107 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "utils/log/Log.h"
+#include "TdObjectJson.h"
+
+#include "ResponseRecorder.h"
+
+namespace td_api = td::td_api;
+
+static constexpr const char *LOG_TAG = "ResponseRecorder";
+
+namespace core {
+
+// stdio buffer of the capture file, responses are small and arrive in bursts
+static constexpr size_t kWriteBufferSize = 1024 * 1024;
+
+ResponseRecorder::ResponseRecorder(const std::string &path) : mPath(path) {
+    mFile = fopen(path.c_str(), "ab");
+    if (mFile == nullptr) {
+        throw std::runtime_error("unable to open " + path + ": " + strerror(errno));
+    }
+    setvbuf(mFile, nullptr, _IOFBF, kWriteBufferSize);
+    // the position of a file opened for appending is its end
+    if (ftell(mFile) == 0 && fwrite(kFileMagic, sizeof(kFileMagic), 1, mFile) != 1) {
+        int err = errno;
+        fclose(mFile);
+        mFile = nullptr;
+        throw std::runtime_error("unable to write " + path + ": " + strerror(err));
+    }
+    mOpen.store(true, std::memory_order_release);
+    LOGI("recording responses to %s", path.c_str());
+}
+
+ResponseRecorder::~ResponseRecorder() {
+    close();
+}
+
+void ResponseRecorder::record(const td::ClientManager::Response &response) {
+    if (!mOpen.load(std::memory_order_acquire) || response.object == nullptr) {
+        return;
+    }
+    // encode outside of the lock, only the append is serialized
+    std::string payload = json::serializeObject(*response.object);
+    FrameHeader header = {};
+    header.payloadLength = uint32_t(payload.size());
+    header.clientId = response.client_id;
+    header.requestId = response.request_id;
+    header.timestampMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    std::scoped_lock lock(mMutex);
+    if (mFile == nullptr) {
+        return;
+    }
+    if (fwrite(&header, sizeof(header), 1, mFile) != 1
+        || (!payload.empty() && fwrite(payload.data(), payload.size(), 1, mFile) != 1)) {
+        // a short write leaves a truncated frame, the replayer stops there, so stop recording as well
+        LOGE("unable to write %s: %s, recording stopped", mPath.c_str(), strerror(errno));
+        mStatistics.failedCount++;
+        closeLocked();
+        return;
+    }
+    mStatistics.recordedCount++;
+    mStatistics.writtenBytes += sizeof(header) + payload.size();
+}
+
+void ResponseRecorder::flush() {
+    std::scoped_lock lock(mMutex);
+    if (mFile != nullptr) {
+        fflush(mFile);
+    }
+}
+
+void ResponseRecorder::close() {
+    std::scoped_lock lock(mMutex);
+    closeLocked();
+}
+
+void ResponseRecorder::closeLocked() {
+    mOpen.store(false, std::memory_order_release);
+    if (mFile != nullptr) {
+        fclose(mFile);
+        mFile = nullptr;
+        LOGI("recorded %llu responses to %s", (unsigned long long) mStatistics.recordedCount, mPath.c_str());
+    }
+}
+
+bool ResponseRecorder::isOpen() const noexcept {
+    return mOpen.load(std::memory_order_acquire);
+}
+
+const std::string &ResponseRecorder::getPath() const noexcept {
+    return mPath;
+}
+
+ResponseRecorder::Statistics ResponseRecorder::getStatistics() const {
+    std::scoped_lock lock(mMutex);
+    return mStatistics;
+}
+
+}
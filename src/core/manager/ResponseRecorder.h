@@ -0,0 +1,93 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_RESPONSERECORDER_H
+#define NEOGROUPCAPTCHABOT_RESPONSERECORDER_H
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+namespace core {
+
+/**
+ * Appends every TDLib response passing through SessionManager::dispatchResponse to a capture file,
+ * so that real traffic, e.g. a join flood, can be replayed offline with ResponseReplayer.
+ * <p>
+ * The file starts with kFileMagic, followed by one frame per response: a FrameHeader in host byte order
+ * and then payloadLength bytes of the object in the TDLib JSON encoding.
+ * td_api objects have no binary serializer, the JSON encoding is the one TDLib itself uses for td_json_client.
+ * <p>
+ * This class is thread safe, all shards may record into the same file.
+ */
+class ResponseRecorder {
+public:
+    static constexpr char kFileMagic[8] = {'N', 'G', 'C', 'B', 'R', 'E', 'C', '1'};
+
+    struct FrameHeader {
+        uint32_t payloadLength;
+        int32_t clientId;
+        uint64_t requestId;
+        // wall clock time the response was dispatched
+        int64_t timestampMicros;
+    };
+
+    static_assert(sizeof(FrameHeader) == 24, "FrameHeader must be packed");
+
+    struct Statistics {
+        uint64_t recordedCount = 0;
+        uint64_t failedCount = 0;
+        uint64_t writtenBytes = 0;
+    };
+
+    /**
+     * Open a capture file for appending, it is created if it does not exist.
+     * Throws std::runtime_error if the file can't be opened.
+     * @param path the path of the capture file
+     */
+    explicit ResponseRecorder(const std::string &path);
+
+    ~ResponseRecorder();
+
+    ResponseRecorder(const ResponseRecorder &) = delete;
+
+    ResponseRecorder &operator=(const ResponseRecorder &) = delete;
+
+    /**
+     * Append a response, this must be called before the object is moved out of the response.
+     * Does nothing once the recorder is closed.
+     */
+    void record(const td::ClientManager::Response &response);
+
+    void flush();
+
+    /**
+     * Flush and close the file, later responses are not recorded.
+     */
+    void close();
+
+    [[nodiscard]] bool isOpen() const noexcept;
+
+    [[nodiscard]] const std::string &getPath() const noexcept;
+
+    [[nodiscard]] Statistics getStatistics() const;
+
+private:
+    void closeLocked();
+
+    const std::string mPath;
+    mutable std::mutex mMutex;
+    FILE *mFile = nullptr;
+    std::atomic_bool mOpen = false;
+    Statistics mStatistics;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_RESPONSERECORDER_H
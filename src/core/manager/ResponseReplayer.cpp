@@ -0,0 +1,124 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "utils/FileMemMap.h"
+#include "utils/log/Log.h"
+#include "ResponseRecorder.h"
+#include "TdObjectJson.h"
+#include "SessionManager.h"
+
+#include "ResponseReplayer.h"
+
+static constexpr const char *LOG_TAG = "ResponseReplayer";
+
+namespace core {
+
+/**
+ * Call the consumer with the header and payload of every complete frame of a mapped capture file.
+ * @return true if the file ends in a partial frame
+ */
+template<typename Consumer>
+static bool forEachFrame(const FileMemMap &file, const std::string &path, Consumer &&consumer) {
+    const auto *data = static_cast<const uint8_t *>(file.getAddress());
+    size_t length = file.getLength();
+    constexpr size_t kMagicSize = sizeof(ResponseRecorder::kFileMagic);
+    if (length < kMagicSize || memcmp(data, ResponseRecorder::kFileMagic, kMagicSize) != 0) {
+        throw std::runtime_error(path + " is not a response capture file");
+    }
+    size_t offset = kMagicSize;
+    while (offset < length) {
+        ResponseRecorder::FrameHeader header = {};
+        if (length - offset < sizeof(header)) {
+            return true;
+        }
+        memcpy(&header, data + offset, sizeof(header));
+        offset += sizeof(header);
+        if (length - offset < header.payloadLength) {
+            return true;
+        }
+        consumer(header, reinterpret_cast<const char *>(data + offset));
+        offset += header.payloadLength;
+    }
+    return false;
+}
+
+static void mapCaptureFile(FileMemMap &file, const std::string &path) {
+    if (int err = file.mapFilePath(path.c_str()); err != 0) {
+        throw std::runtime_error("unable to map " + path + ": " + strerror(err));
+    }
+}
+
+ResponseReplayer::Result ResponseReplayer::replay(SessionManager &sessionManager, const std::string &path,
+                                                  const Options &options) {
+    using Clock = std::chrono::steady_clock;
+    FileMemMap file;
+    mapCaptureFile(file, path);
+    Result result;
+    auto startTime = Clock::now();
+    int64_t firstTimestampMicros = 0;
+    std::string payload;
+    result.truncated = forEachFrame(file, path, [&](const ResponseRecorder::FrameHeader &header, const char *frameData) {
+        result.frameCount++;
+        if (result.frameCount == 1) {
+            firstTimestampMicros = header.timestampMicros;
+        }
+        if (header.requestId != 0 && !options.includeRequestResponses) {
+            result.skippedCount++;
+            return;
+        }
+        payload.assign(frameData, header.payloadLength);
+        td::ClientManager::Response response = {};
+        response.client_id = header.clientId;
+        response.request_id = header.requestId;
+        response.object = json::deserializeObject(payload);
+        if (response.object == nullptr) {
+            result.malformedCount++;
+            return;
+        }
+        if (auto it = options.clientIdMap.find(header.clientId); it != options.clientIdMap.end()) {
+            response.client_id = it->second;
+        }
+        if (options.speed > 0) {
+            // the recorder uses the wall clock, which may step backwards, so never wait for a negative delay
+            auto offsetMicros = double(std::max<int64_t>(0, header.timestampMicros - firstTimestampMicros));
+            auto dueTime = startTime + std::chrono::microseconds(int64_t(offsetMicros / options.speed));
+            std::this_thread::sleep_until(dueTime);
+        }
+        auto dispatchStart = Clock::now();
+        sessionManager.dispatchResponse(response);
+        auto dispatchMicros = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - dispatchStart).count());
+        result.dispatchedCount++;
+        result.totalDispatchMicros += dispatchMicros;
+        result.maxDispatchMicros = std::max(result.maxDispatchMicros, dispatchMicros);
+    });
+    result.elapsedMicros = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - startTime).count());
+    if (result.truncated) {
+        LOGW("%s ends in a partial frame after %llu frames", path.c_str(), (unsigned long long) result.frameCount);
+    }
+    return result;
+}
+
+std::vector<int32_t> ResponseReplayer::listClientIds(const std::string &path) {
+    FileMemMap file;
+    mapCaptureFile(file, path);
+    std::vector<int32_t> clientIds;
+    std::unordered_set<int32_t> seen;
+    forEachFrame(file, path, [&](const ResponseRecorder::FrameHeader &header, const char *) {
+        if (seen.insert(header.clientId).second) {
+            clientIds.push_back(header.clientId);
+        }
+    });
+    return clientIds;
+}
+
+}
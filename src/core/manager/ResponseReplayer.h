@@ -0,0 +1,71 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_RESPONSEREPLAYER_H
+#define NEOGROUPCAPTCHABOT_RESPONSEREPLAYER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace core {
+
+class SessionManager;
+
+/**
+ * Feeds a capture file written by ResponseRecorder back through SessionManager::dispatchResponse,
+ * e.g. to benchmark the handlers against a recorded join flood without a network.
+ * <p>
+ * The responses are dispatched on the calling thread, which stands in for the dispatcher threads of the shards,
+ * so the target sessions should not receive live traffic at the same time.
+ */
+class ResponseReplayer {
+public:
+    struct Options {
+        // 1 replays at the recorded pace, 2 twice as fast and so on, 0 replays as fast as possible
+        double speed = 0;
+        // responses to requests carry the request ids of the recording process, so they are skipped by default
+        bool includeRequestResponses = false;
+        // recorded client id -> client id of a session in this process, ids which are not mapped are kept
+        std::unordered_map<int32_t, int32_t> clientIdMap;
+    };
+
+    struct Result {
+        uint64_t frameCount = 0;
+        uint64_t dispatchedCount = 0;
+        uint64_t skippedCount = 0;
+        // frames whose object could not be decoded
+        uint64_t malformedCount = 0;
+        // the file ends in a partial frame, e.g. the recorder was killed
+        bool truncated = false;
+        uint64_t elapsedMicros = 0;
+        // time spent in dispatchResponse, excluding decoding and pacing
+        uint64_t totalDispatchMicros = 0;
+        uint64_t maxDispatchMicros = 0;
+    };
+
+    ResponseReplayer() = delete;
+
+    /**
+     * Replay a capture file, blocks until the whole file is dispatched.
+     * Throws std::runtime_error if the file can't be read or is not a capture file.
+     * @param sessionManager the session manager to dispatch to
+     * @param path the capture file
+     * @param options replay options
+     */
+    static Result replay(SessionManager &sessionManager, const std::string &path, const Options &options);
+
+    /**
+     * Get the client ids which appear in a capture file, e.g. to create a session for each of them.
+     * Throws std::runtime_error if the file can't be read or is not a capture file.
+     * @param path the capture file
+     * @return the client ids in the order of their first frame
+     */
+    static std::vector<int32_t> listClientIds(const std::string &path);
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_RESPONSEREPLAYER_H
@@ -2,8 +2,19 @@
 // Created by kinit on 2022-02-18.
 //
 
+#include <mutex>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <stdexcept>
+#include <unistd.h>
+
 #include "ClientSession.h"
 #include "utils/log/Log.h"
+#include "utils/log/LogSampler.h"
+#include "utils/SyncUtils.h"
 
 #include "SessionManager.h"
 
@@ -13,17 +24,292 @@ static constexpr const char *LOG_TAG = "SessionManager";
 
 namespace core {
 
+// a closed session can leave a stream of late responses and updates behind, log only a sample of them
+static utils::LogSampler sNoCallbackLog(LOG_TAG, "response without callback");
+static utils::LogSampler sNoSessionLog(LOG_TAG, "update without session");
+
+/**
+ * All responses for one client are dispatched on the dispatcher thread of its shard,
+ * and so are its request deadlines, so a group is only ever touched by that thread, except for its send state.
+ * While the sender is still sending the members, completions are held back, so that a send which throws
+ * halfway never races a callback: either the sender throws and nothing is called back, or every member went out
+ * and the held back completions run on the dispatcher thread.
+ */
+class SessionManager::RequestGroup {
+public:
+    RequestGroup(std::vector<int32_t> functionIds, uint64_t sendTimeMicros, RequestGroupCallback callback,
+                 std::function<void()> onSettled, bool failFast)
+            : mFunctionIds(std::move(functionIds)), mCallback(std::move(callback)), mOnSettled(std::move(onSettled)),
+              mSendTimeMicros(sendTimeMicros), mOutstanding(mFunctionIds.size()), mFailFast(failFast) {
+        mResults.resize(mFunctionIds.size());
+        mAnswered.resize(mFunctionIds.size());
+    }
+
+    [[nodiscard]] size_t size() const noexcept {
+        return mFunctionIds.size();
+    }
+
+    [[nodiscard]] bool isAnswered(uint32_t index) const {
+        return mAnswered[index];
+    }
+
+    [[nodiscard]] int32_t getFunctionId(uint32_t index) const {
+        return mFunctionIds[index];
+    }
+
+    [[nodiscard]] uint64_t getSendTimeMicros() const noexcept {
+        return mSendTimeMicros;
+    }
+
+    /**
+     * Called by the sender once every member is sent, any thread.
+     * @return false if a completion was held back while sending, runDeferred must then be called on the dispatcher thread
+     */
+    bool markSent() noexcept {
+        int expected = kSending;
+        return mSendState.compare_exchange_strong(expected, kSent, std::memory_order_acq_rel);
+    }
+
+    /**
+     * Never call back, because sending the group failed and the sender got an exception instead, any thread.
+     */
+    void abort() noexcept {
+        mSendState.store(kAborted, std::memory_order_release);
+    }
+
+    /**
+     * Run the completions held back while the members were being sent, on the dispatcher thread.
+     */
+    void runDeferred() {
+        mSendState.store(kSent, std::memory_order_release);
+        if (mCompletionDeferred) {
+            mCompletionDeferred = false;
+            invokeCallback();
+        }
+        if (mSettledDeferred) {
+            mSettledDeferred = false;
+            invokeSettled();
+        }
+    }
+
+    /**
+     * Record the result of one member which has not been answered yet.
+     * @return true once every member has been accounted for
+     */
+    bool onResult(uint32_t index, td_api::object_ptr<td_api::Object> result) {
+        mAnswered[index] = true;
+        if (!mCompleted) {
+            bool isError = result != nullptr && result->get_id() == td_api::error::ID;
+            mResults[index] = std::move(result);
+            if (isError && mFailFast) {
+                complete();
+            }
+        }
+        if (--mOutstanding == 0) {
+            if (!mCompleted) {
+                complete();
+            }
+            if (canRunNow(mSettledDeferred)) {
+                invokeSettled();
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    enum SendState : int {
+        kSending,
+        // a completion arrived while sending
+        kDeferred,
+        kSent,
+        kAborted
+    };
+
+    /**
+     * Whether a completion can run right away, otherwise it is dropped or held back with the given flag.
+     */
+    bool canRunNow(bool &deferred) {
+        int state = mSendState.load(std::memory_order_acquire);
+        if (state == kSent) {
+            return true;
+        }
+        if (state == kAborted) {
+            return false;
+        }
+        deferred = true;
+        if (state == kSending && !mSendState.compare_exchange_strong(state, kDeferred, std::memory_order_acq_rel)
+            && state == kSent) {
+            // every member went out in the meantime, the sender won't ask for runDeferred
+            deferred = false;
+            return true;
+        }
+        return false;
+    }
+
+    void complete() {
+        mCompleted = true;
+        if (canRunNow(mCompletionDeferred)) {
+            invokeCallback();
+        }
+    }
+
+    void invokeCallback() {
+        if (mCallback) {
+            auto callback = std::move(mCallback);
+            callback(std::move(mResults));
+        }
+    }
+
+    void invokeSettled() {
+        if (mOnSettled) {
+            auto onSettled = std::move(mOnSettled);
+            onSettled();
+        }
+    }
+
+    std::vector<int32_t> mFunctionIds;
+    std::vector<td_api::object_ptr<td_api::Object>> mResults;
+    std::vector<bool> mAnswered;
+    RequestGroupCallback mCallback;
+    std::function<void()> mOnSettled;
+    uint64_t mSendTimeMicros;
+    size_t mOutstanding;
+    bool mFailFast;
+    bool mCompleted = false;
+    bool mCompletionDeferred = false;
+    bool mSettledDeferred = false;
+    std::atomic_int mSendState = kSending;
+};
+
+SessionManager::SessionManager() {
+    utils::metrics::MetricsRegistry::getInstance().addCollector([this](utils::metrics::MetricsWriter &writer) {
+        collectMetrics(writer);
+    });
+}
+
 SessionManager &SessionManager::getInstance() {
     static SessionManager instance;
     return instance;
 }
 
-td::ClientManager *SessionManager::getClientManager() {
+void SessionManager::setShardCount(int shardCount) {
+    if (shardCount < 1) {
+        throw std::invalid_argument("shard count must be at least 1, got " + std::to_string(shardCount));
+    }
+    std::scoped_lock lock(mMutex);
+    if (!mShards.empty()) {
+        throw std::logic_error("setShardCount must be called before the first session is created");
+    }
+    mShardCount = shardCount;
+}
+
+int SessionManager::getShardCount() const {
+    std::scoped_lock lock(mMutex);
+    return mShardCount;
+}
+
+void SessionManager::setMaxReceiveBatchSize(int maxBatchSize) {
+    if (maxBatchSize < 1) {
+        throw std::invalid_argument("receive batch size must be at least 1, got " + std::to_string(maxBatchSize));
+    }
+    std::scoped_lock lock(mMutex);
+    if (!mShards.empty()) {
+        throw std::logic_error("setMaxReceiveBatchSize must be called before the first session is created");
+    }
+    mMaxReceiveBatchSize = maxBatchSize;
+}
+
+void SessionManager::configureUpdateRouter(std::function<void(UpdateRouter::Builder &)> configurator) {
+    if (!configurator) {
+        throw std::invalid_argument("configurator must not be null");
+    }
+    std::scoped_lock lock(mMutex);
+    if (!mShards.empty()) {
+        throw std::logic_error("configureUpdateRouter must be called before the first session is created");
+    }
+    mUpdateRouterConfigurators.emplace_back(std::move(configurator));
+}
+
+const UpdateRouter &SessionManager::getUpdateRouter() const noexcept {
+    return mUpdateRouter;
+}
+
+void SessionManager::initUpdateRouterLocked() {
+    // no shard has been started yet, so no dispatcher thread reads the router while it is being built
+    if (!mShards.empty()) {
+        return;
+    }
+    UpdateRouter::Builder builder;
+    ClientSession::registerUpdateSubscribers(builder);
+    for (auto &configurator: mUpdateRouterConfigurators) {
+        configurator(builder);
+    }
+    mUpdateRouterConfigurators.clear();
+    mUpdateRouter = builder.build();
+}
+
+void SessionManager::addUpdateInterceptor(std::shared_ptr<UpdateInterceptor> interceptor) {
+    if (interceptor == nullptr) {
+        throw std::invalid_argument("interceptor must not be null");
+    }
+    std::scoped_lock lock(mMutex);
+    if (!mShards.empty()) {
+        throw std::logic_error("addUpdateInterceptor must be called before the first session is created");
+    }
+    if (mPendingInterceptors.size() >= UpdateInterceptorChain::kMaxInterceptors) {
+        throw std::logic_error("too many update interceptors");
+    }
+    mPendingInterceptors.emplace_back(std::move(interceptor));
+}
+
+void SessionManager::setResponseRecorder(std::shared_ptr<ResponseRecorder> recorder) {
+    if (recorder == nullptr) {
+        throw std::invalid_argument("recorder must not be null");
+    }
     std::scoped_lock lock(mMutex);
-    if (mClientManager == nullptr) {
-        mClientManager = std::make_unique<td::ClientManager>();
+    if (!mShards.empty()) {
+        throw std::logic_error("setResponseRecorder must be called before the first session is created");
+    }
+    mResponseRecorder = std::move(recorder);
+}
+
+void SessionManager::setTransportFactory(TdTransportFactory factory) {
+    if (!factory) {
+        throw std::invalid_argument("transport factory must not be null");
+    }
+    std::scoped_lock lock(mMutex);
+    if (!mShards.empty()) {
+        throw std::logic_error("setTransportFactory must be called before the first session is created");
+    }
+    mTransportFactory = std::move(factory);
+}
+
+void SessionManager::initUpdateInterceptorsLocked() {
+    if (!mShards.empty()) {
+        return;
+    }
+    mInterceptorChain = UpdateInterceptorChain(std::move(mPendingInterceptors));
+    mPendingInterceptors.clear();
+}
+
+void SessionManager::initShardsLocked() {
+    if (!mShards.empty()) {
+        return;
+    }
+    for (int i = 0; i < mShardCount; ++i) {
+        std::unique_ptr<TdTransport> transport = mTransportFactory ? mTransportFactory(i)
+                                                                   : std::make_unique<ClientManagerTransport>();
+        mShards.emplace_back(std::make_unique<ClientManagerShard>(this, i, mMaxReceiveBatchSize, std::move(transport)));
+    }
+}
+
+ClientManagerShard *SessionManager::getShardForClient(int32_t clientId) const {
+    auto client = mClients.find(clientId);
+    if (!client.has_value()) {
+        return nullptr;
     }
-    return mClientManager.get();
+    return client->shard;
 }
 
 uint64_t SessionManager::nextQueryId() noexcept {
@@ -31,55 +317,348 @@ uint64_t SessionManager::nextQueryId() noexcept {
 }
 
 uint64_t SessionManager::sendRequestWithClientId(int32_t clientId, td_api::object_ptr<td::td_api::Function> request,
-                                                 std::function<void(td_api::object_ptr<td::td_api::Object>)> callback) {
+                                                 std::function<void(td_api::object_ptr<td::td_api::Object>)> callback,
+                                                 int timeoutMillis) {
+    auto *shard = getShardForClient(clientId);
+    if (shard == nullptr) {
+        throw std::invalid_argument("no session for client id " + std::to_string(clientId));
+    }
     auto requestId = nextQueryId();
-    if (callback) {
-        mQueryCallbacks.put(requestId, std::move(callback));
+    PendingQuery query;
+    query.callback = std::move(callback);
+    query.functionId = request->get_id();
+    query.sendTimeMicros = RequestLatencyStats::nowMicros();
+    bool hasCallback = bool(query.callback);
+    mQueryCallbacks.put(requestId, std::move(query));
+    if (timeoutMillis > 0) {
+        shard->scheduleDeadline(requestId, timeoutMillis);
+    } else if (!hasCallback) {
+        // nobody waits for the response, don't let the entry outlive a response that never comes
+        shard->scheduleDeadline(requestId, kUntrackedRequestTimeoutMillis);
     }
-    mLooperCondition.notify_all();
-    getClientManager()->send(clientId, requestId, std::move(request));
+    sendOrForget(shard, clientId, requestId, std::move(request));
     return requestId;
 }
 
+void SessionManager::sendOrForget(ClientManagerShard *shard, int32_t clientId, uint64_t requestId,
+                                  td_api::object_ptr<td_api::Function> request) {
+    try {
+        shard->getTransport()->send(clientId, requestId, std::move(request));
+    } catch (...) {
+        // no response will come, drop the callback without calling it, the caller gets the exception
+        PendingQuery query;
+        mQueryCallbacks.remove(requestId, query);
+        throw;
+    }
+}
+
 uint64_t SessionManager::sendRequestWithClientId(int32_t clientId,
                                                  td_api::object_ptr<td::td_api::Function> request, nullptr_t) {
+    auto *shard = getShardForClient(clientId);
+    if (shard == nullptr) {
+        throw std::invalid_argument("no session for client id " + std::to_string(clientId));
+    }
     auto requestId = nextQueryId();
-    mLooperCondition.notify_all();
-    getClientManager()->send(clientId, requestId, std::move(request));
+    // no callback, but the response still arrives, so the latency is tracked all the same
+    PendingQuery query;
+    query.functionId = request->get_id();
+    query.sendTimeMicros = RequestLatencyStats::nowMicros();
+    mQueryCallbacks.put(requestId, std::move(query));
+    shard->scheduleDeadline(requestId, kUntrackedRequestTimeoutMillis);
+    sendOrForget(shard, clientId, requestId, std::move(request));
     return requestId;
 }
 
-std::shared_ptr<ClientSession> SessionManager::createSession(const ClientSession::TdLibParameters &parameters) {
-    int32_t id = getClientManager()->create_client_id();
-    auto sp = std::make_shared<ClientSession>(this, id, parameters);
-    mClientSessions.put(id, sp);
-    if (mWorkerThread == 0) {
-        mLooperRunning = true;
-        int rc = pthread_create(&mWorkerThread, nullptr,
-                                reinterpret_cast<void *(*)(void *)>(&SessionManager::runLooper), this);
-        if (rc != 0) {
-            throw std::runtime_error("Failed to create worker thread: error code " + std::to_string(rc));
+void SessionManager::sendRequestGroup(int32_t clientId, std::vector<td_api::object_ptr<td_api::Function>> requests,
+                                      RequestGroupCallback callback, bool failFast, int timeoutMillis,
+                                      std::function<void()> onSettled) {
+    auto *shard = getShardForClient(clientId);
+    if (shard == nullptr) {
+        throw std::invalid_argument("no session for client id " + std::to_string(clientId));
+    }
+    if (requests.empty()) {
+        if (callback) {
+            callback({});
+        }
+        if (onSettled) {
+            onSettled();
+        }
+        return;
+    }
+    if (requests.size() > kMaxRequestGroupSize) {
+        throw std::invalid_argument("a request group can have at most " + std::to_string(kMaxRequestGroupSize)
+                                    + " requests, got " + std::to_string(requests.size()));
+    }
+    auto count = uint32_t(requests.size());
+    // the member index is part of the request id, so a response finds its group without an entry of its own
+    uint64_t groupId = kRequestGroupIdBit | (mRequestGroupSequence.fetch_add(1) << kRequestGroupIndexBits);
+    std::vector<int32_t> functionIds(count);
+    for (uint32_t i = 0; i < count; i++) {
+        functionIds[i] = requests[i] != nullptr ? requests[i]->get_id() : 0;
+    }
+    auto group = std::make_shared<RequestGroup>(std::move(functionIds), RequestLatencyStats::nowMicros(),
+                                                std::move(callback), std::move(onSettled), failFast);
+    mRequestGroups.put(groupId, group);
+    mPendingGroupRequestCount.fetch_add(count, std::memory_order_relaxed);
+    if (timeoutMillis > 0) {
+        shard->scheduleDeadline(groupId, timeoutMillis);
+    }
+    auto *transport = shard->getTransport();
+    try {
+        for (uint32_t i = 0; i < count; i++) {
+            transport->send(clientId, groupId + i, std::move(requests[i]));
+        }
+    } catch (...) {
+        // the caller gets the exception instead of the callback, the members already sent may be answered
+        // in the meantime, so the group is dropped on the dispatcher thread
+        group->abort();
+        shard->scheduleTask(0, [this, groupId]() {
+            std::shared_ptr<RequestGroup> group;
+            if (mRequestGroups.remove(groupId, group)) {
+                for (uint32_t i = 0; i < group->size(); i++) {
+                    if (!group->isAnswered(i)) {
+                        mPendingGroupRequestCount.fetch_sub(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+        });
+        throw;
+    }
+    if (!group->markSent()) {
+        shard->scheduleTask(0, [group]() {
+            group->runDeferred();
+        });
+    }
+}
+
+void SessionManager::postDelayed(int32_t clientId, int delayMillis, std::function<void()> task) {
+    auto *shard = getShardForClient(clientId);
+    if (shard == nullptr) {
+        throw std::invalid_argument("no session for client id " + std::to_string(clientId));
+    }
+    shard->scheduleTask(delayMillis, std::move(task));
+}
+
+std::shared_ptr<ClientSession> SessionManager::createSession(const ClientSession::TdLibParameters &parameters,
+                                                             std::optional<CatchUpBuffer::Policy> catchUpPolicy) {
+    ClientManagerShard *shard = nullptr;
+    int32_t id;
+    {
+        std::scoped_lock lock(mMutex);
+        initUpdateRouterLocked();
+        initUpdateInterceptorsLocked();
+        initShardsLocked();
+        // place the new session on the least loaded shard
+        for (const auto &candidate: mShards) {
+            if (shard == nullptr || candidate->getSessionCount() < shard->getSessionCount()) {
+                shard = candidate.get();
+            }
         }
+        id = shard->createClientId();
     }
+    auto sp = std::make_shared<ClientSession>(this, id, parameters, catchUpPolicy);
+    mClients.put(id, ClientEntry{sp, shard});
+    shard->start();
+    LOGD("created session %d on shard %d", id, shard->getIndex());
     return sp;
 }
 
+std::vector<std::shared_ptr<ClientSession>> SessionManager::startSessions(
+        const SessionManifest &manifest, const ClientSession::TdLibParameters &baseParameters, int loginTimeoutSeconds,
+        const std::function<void(const std::shared_ptr<ClientSession> &, const SessionManifest::Entry &)> &onSessionCreated,
+        const std::function<std::optional<CatchUpBuffer::Policy>(const SessionManifest::Entry &)> &getCatchUpPolicy) {
+    struct PendingLogin {
+        size_t index;
+        uint64_t deadline;
+    };
+    // the sessions report their login result from the dispatcher threads, possibly after we have given up on them
+    struct SettledQueue {
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::vector<std::pair<size_t, ClientSession::AuthorizationState>> results;
+    };
+    const auto &entries = manifest.sessions;
+    std::vector<std::shared_ptr<ClientSession>> sessions(entries.size());
+    std::vector<PendingLogin> pendingLogins;
+    auto settledQueue = std::make_shared<SettledQueue>();
+    std::vector<std::pair<size_t, ClientSession::AuthorizationState>> settled;
+    size_t nextIndex = 0;
+    size_t authorizedCount = 0;
+    size_t failedCount = 0;
+    uint64_t startTime = utils::getCurrentTimeMillis();
+    while (nextIndex < entries.size() || !pendingLogins.empty()) {
+        // keep at most startupConcurrency sessions logging in, TDLib opens the database and connects at this point
+        while (nextIndex < entries.size() && pendingLogins.size() < size_t(manifest.startupConcurrency)) {
+            const auto &entry = entries[nextIndex];
+            ClientSession::TdLibParameters parameters = baseParameters;
+            parameters.api_id_ = manifest.apiId;
+            parameters.api_hash_ = manifest.apiHash;
+            parameters.database_directory_ = entry.databaseDirectory;
+            parameters.use_file_database_ = entry.useFileDatabase;
+            parameters.use_chat_info_database_ = entry.useChatInfoDatabase;
+            parameters.use_message_database_ = entry.useMessageDatabase;
+            auto session = createSession(parameters, getCatchUpPolicy ? getCatchUpPolicy(entry) : std::nullopt);
+            if (onSessionCreated) {
+                onSessionCreated(session, entry);
+            }
+            session->whenAuthorizationSettled([settledQueue, index = nextIndex](ClientSession *, ClientSession::AuthorizationState state) {
+                {
+                    std::scoped_lock lock(settledQueue->mutex);
+                    settledQueue->results.emplace_back(index, state);
+                }
+                settledQueue->condition.notify_one();
+            });
+            if (entry.type == SessionManifest::SessionType::BOT) {
+                session->logInWithBotToken(entry.botToken);
+            } else {
+                session->logInWithPhoneNumber(entry.phoneNumber);
+            }
+            sessions[nextIndex] = std::move(session);
+            pendingLogins.push_back({nextIndex, utils::getCurrentTimeMillis() + uint64_t(loginTimeoutSeconds) * 1000});
+            nextIndex++;
+        }
+        // sleep until a login settles or the earliest pending login times out
+        uint64_t earliestDeadline = UINT64_MAX;
+        for (const auto &login: pendingLogins) {
+            earliestDeadline = std::min(earliestDeadline, login.deadline);
+        }
+        {
+            std::unique_lock lock(settledQueue->mutex);
+            uint64_t now = utils::getCurrentTimeMillis();
+            if (settledQueue->results.empty() && earliestDeadline > now) {
+                settledQueue->condition.wait_for(lock, std::chrono::milliseconds(earliestDeadline - now), [&settledQueue]() {
+                    return !settledQueue->results.empty();
+                });
+            }
+            settled.swap(settledQueue->results);
+        }
+        for (const auto &[index, state]: settled) {
+            auto it = std::find_if(pendingLogins.begin(), pendingLogins.end(), [index = index](const PendingLogin &login) {
+                return login.index == index;
+            });
+            if (it == pendingLogins.end()) {
+                // already timed out
+                continue;
+            }
+            if (state == ClientSession::AuthorizationState::AUTHORIZED) {
+                authorizedCount++;
+            } else {
+                LOGE("session %s failed to log in", entries[index].name.c_str());
+                failedCount++;
+            }
+            pendingLogins.erase(it);
+        }
+        settled.clear();
+        uint64_t now = utils::getCurrentTimeMillis();
+        for (auto it = pendingLogins.begin(); it != pendingLogins.end();) {
+            if (now >= it->deadline) {
+                LOGW("session %s did not log in within %d seconds", entries[it->index].name.c_str(), loginTimeoutSeconds);
+                failedCount++;
+                it = pendingLogins.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    LOGI("started %zu sessions in %llu ms, %zu authorized, %zu failed", entries.size(),
+         (unsigned long long) (utils::getCurrentTimeMillis() - startTime), authorizedCount, failedCount);
+    return sessions;
+}
+
 std::shared_ptr<ClientSession> SessionManager::getSession(int32_t tdLibId) const {
-    auto session = mClientSessions.get(tdLibId);
-    if (session == nullptr) {
+    auto client = mClients.find(tdLibId);
+    if (!client.has_value()) {
         return nullptr;
     }
-    return *session;
+    return client->session;
+}
+
+std::vector<SessionManager::LooperStatistics> SessionManager::getLooperStatistics() const {
+    std::scoped_lock lock(mMutex);
+    std::vector<LooperStatistics> result;
+    result.reserve(mShards.size());
+    for (const auto &shard: mShards) {
+        result.emplace_back(shard->getStatistics());
+    }
+    return result;
+}
+
+size_t SessionManager::getPendingRequestCount() const {
+    return mQueryCallbacks.size() + mPendingGroupRequestCount.load(std::memory_order_relaxed);
+}
+
+uint64_t SessionManager::getTimedOutRequestCount() const {
+    return mTimedOutRequestCount.load(std::memory_order_relaxed);
+}
+
+RequestLatencyStats::Snapshot SessionManager::getRequestLatencySnapshot() const {
+    return mRequestLatencyStats.getSnapshot();
+}
+
+void SessionManager::completeQuery(PendingQuery &query, td_api::object_ptr<td_api::Object> result) {
+    int32_t errorCode = 0;
+    if (result != nullptr && result->get_id() == td_api::error::ID) {
+        errorCode = static_cast<const td_api::error &>(*result).code_;
+    }
+    mRequestLatencyStats.record(query.functionId, RequestLatencyStats::nowMicros() - query.sendTimeMicros, errorCode);
+    if (query.callback) {
+        query.callback(std::move(result));
+    }
 }
 
-void SessionManager::runLooper(SessionManager *sessionManager) {
-    auto *clientManager = sessionManager->getClientManager();
-    while (sessionManager->mLooperRunning) {
-        auto resp = clientManager->receive(300);
-        if (resp.object != nullptr) {
-            sessionManager->dispatchResponse(resp);
+void SessionManager::dispatchGroupResponse(uint64_t requestId, td_api::object_ptr<td_api::Object> result) {
+    uint64_t groupId = requestId & ~kRequestGroupIndexMask;
+    auto index = uint32_t(requestId & kRequestGroupIndexMask);
+    std::shared_ptr<RequestGroup> group;
+    mRequestGroups.get(groupId, group);
+    if (group == nullptr || index >= group->size() || group->isAnswered(index)) {
+        LOG_SAMPLED(sNoCallbackLog, Log::Level::DEBUG, "No callback for request id %llu", (unsigned long long) requestId);
+        return;
+    }
+    int32_t errorCode = 0;
+    if (result != nullptr && result->get_id() == td_api::error::ID) {
+        errorCode = static_cast<const td_api::error &>(*result).code_;
+    }
+    mRequestLatencyStats.record(group->getFunctionId(index), RequestLatencyStats::nowMicros() - group->getSendTimeMicros(),
+                                errorCode);
+    mPendingGroupRequestCount.fetch_sub(1, std::memory_order_relaxed);
+    if (group->onResult(index, std::move(result))) {
+        mRequestGroups.remove(groupId);
+    }
+}
+
+void SessionManager::onRequestGroupDeadline(uint64_t groupId) {
+    std::shared_ptr<RequestGroup> group;
+    if (!mRequestGroups.remove(groupId, group)) {
+        // every response has already arrived
+        return;
+    }
+    uint64_t nowMicros = RequestLatencyStats::nowMicros();
+    for (uint32_t i = 0; i < group->size(); i++) {
+        if (group->isAnswered(i)) {
+            continue;
         }
+        mTimedOutRequestCount.fetch_add(1, std::memory_order_relaxed);
+        mPendingGroupRequestCount.fetch_sub(1, std::memory_order_relaxed);
+        mRequestLatencyStats.record(group->getFunctionId(i), nowMicros - group->getSendTimeMicros(), kRequestTimeoutErrorCode);
+        group->onResult(i, td_api::make_object<td_api::error>(kRequestTimeoutErrorCode, "Request timeout"));
+    }
+    LOGW("Request group %llu timed out", (unsigned long long) (groupId & ~kRequestGroupIdBit));
+}
+
+void SessionManager::onRequestDeadline(uint64_t requestId) {
+    if ((requestId & kRequestGroupIdBit) != 0) {
+        onRequestGroupDeadline(requestId);
+        return;
     }
+    PendingQuery query;
+    if (!mQueryCallbacks.remove(requestId, query)) {
+        // the response has already arrived
+        return;
+    }
+    mTimedOutRequestCount.fetch_add(1, std::memory_order_relaxed);
+    LOGW("Request %llu timed out", (unsigned long long) requestId);
+    completeQuery(query, td_api::make_object<td_api::error>(kRequestTimeoutErrorCode, "Request timeout"));
 }
 
 void SessionManager::dispatchResponse(td::ClientManager::Response &response) {
@@ -89,25 +668,30 @@ void SessionManager::dispatchResponse(td::ClientManager::Response &response) {
     if (object == nullptr) {
         return;
     }
+    if (mResponseRecorder != nullptr) {
+        // before anything moves the object out of the response
+        mResponseRecorder->record(response);
+    }
     uint32_t objectType = object->get_id();
-    if (requestId != 0) {
-        auto pCallback = mQueryCallbacks.get(requestId);
-        if (pCallback != nullptr) {
+    if ((requestId & kRequestGroupIdBit) != 0) {
+        dispatchGroupResponse(requestId, std::move(object));
+    } else if (requestId != 0) {
+        PendingQuery query;
+        if (mQueryCallbacks.remove(requestId, query)) {
             // LOGD("Dispatching response for request id %ld", requestId);
-            auto callback = std::move(*pCallback);
-            mQueryCallbacks.remove(requestId);
-            callback(std::move(object));
+            completeQuery(query, std::move(object));
         } else {
-            LOGD("No callback for request id %ld", requestId);
+            LOG_SAMPLED(sNoCallbackLog, Log::Level::DEBUG, "No callback for request id %ld", requestId);
         }
     } else {
         // it's an update
-        if (!onInterceptUpdate(clientId, object)) {
-            auto session = mClientSessions.get(clientId);
-            if (session != nullptr) {
-                session->get()->handleUpdate(std::move(object));
+        mUpdateCounts.increment(objectType);
+        if (!onInterceptUpdate(clientId, *object)) {
+            auto client = mClients.find(clientId);
+            if (client.has_value()) {
+                client->session->handleUpdate(std::move(object));
             } else {
-                LOGE("No session for client id %d, objectType = %d", clientId, objectType);
+                LOG_SAMPLED(sNoSessionLog, Log::Level::ERROR, "No session for client id %d, objectType = %d", clientId, objectType);
             }
         }
     }
@@ -128,6 +712,9 @@ utils::CachedThreadPool &SessionManager::getExecutors() {
 }
 
 SessionManager::~SessionManager() {
+    for (auto &shard: mShards) {
+        shard->stop();
+    }
     mThreadPool.shutdown();
     mThreadPool.awaitTermination(-1);
 }
@@ -140,8 +727,97 @@ void SessionManager::terminateSession(int32_t tdLibId) {
     // TODO: send request to terminate session
 }
 
-bool SessionManager::onInterceptUpdate(int32_t clientId, const td_api::object_ptr<td_api::Object> &object) {
-    return false;
+void SessionManager::collectMetrics(utils::metrics::MetricsWriter &writer) const {
+    using utils::metrics::Labels;
+    writer.beginFamily("ngcb_sessions", "Number of sessions", "gauge");
+    writer.writeSample("ngcb_sessions", {}, uint64_t(mClients.size()));
+
+    auto looperStatistics = getLooperStatistics();
+    writer.beginFamily("ngcb_looper_queue_depth", "Responses waiting for the dispatcher thread of a shard", "gauge");
+    for (const auto &stats: looperStatistics) {
+        writer.writeSample("ngcb_looper_queue_depth", {{"shard", std::to_string(stats.shardIndex)}}, uint64_t(stats.queueDepth));
+    }
+    writer.beginFamily("ngcb_looper_queue_depth_max", "Highest queue depth of a shard so far", "gauge");
+    for (const auto &stats: looperStatistics) {
+        writer.writeSample("ngcb_looper_queue_depth_max", {{"shard", std::to_string(stats.shardIndex)}}, uint64_t(stats.maxQueueDepth));
+    }
+    writer.beginFamily("ngcb_looper_received_total", "Responses and updates received from TDLib", "counter");
+    for (const auto &stats: looperStatistics) {
+        writer.writeSample("ngcb_looper_received_total", {{"shard", std::to_string(stats.shardIndex)}}, stats.receivedCount);
+    }
+    writer.beginFamily("ngcb_looper_receiver_stall_seconds_total",
+                       "Time the receive thread of a shard was blocked on a full queue", "counter");
+    for (const auto &stats: looperStatistics) {
+        writer.writeSample("ngcb_looper_receiver_stall_seconds_total", {{"shard", std::to_string(stats.shardIndex)}},
+                           double(stats.receiverStallTimeMicros) / 1e6);
+    }
+    writer.beginFamily("ngcb_looper_dispatch_max_seconds", "Slowest single dispatch of a shard so far", "gauge");
+    for (const auto &stats: looperStatistics) {
+        writer.writeSample("ngcb_looper_dispatch_max_seconds", {{"shard", std::to_string(stats.shardIndex)}},
+                           double(stats.maxDispatchTimeMicros) / 1e6);
+    }
+    writer.beginFamily("ngcb_looper_pending_timers", "Delayed tasks and request deadlines of a shard", "gauge");
+    for (const auto &stats: looperStatistics) {
+        writer.writeSample("ngcb_looper_pending_timers", {{"shard", std::to_string(stats.shardIndex)}}, uint64_t(stats.pendingTimerCount));
+    }
+    writer.beginFamily("ngcb_looper_receive_batch_size", "Responses taken from TDLib per receive call of a shard",
+                       "histogram");
+    for (const auto &stats: looperStatistics) {
+        // bucket i holds the sizes in [2^i, 2^(i+1)), the last one is open-ended
+        utils::metrics::Histogram::Snapshot batchSizes;
+        uint64_t cumulative = 0;
+        for (int i = 0; i < ClientManagerShard::kBatchHistogramBuckets; i++) {
+            if (i < ClientManagerShard::kBatchHistogramBuckets - 1) {
+                batchSizes.upperBounds.push_back(double((uint64_t(2) << i) - 1));
+            }
+            cumulative += stats.receiveBatchSizeHistogram[i];
+            batchSizes.cumulativeCounts.push_back(cumulative);
+        }
+        // every received response is part of exactly one batch
+        batchSizes.sum = double(stats.receivedCount);
+        batchSizes.count = stats.receiveBatchCount;
+        writer.writeHistogram("ngcb_looper_receive_batch_size", {{"shard", std::to_string(stats.shardIndex)}}, batchSizes);
+    }
+
+    writer.beginFamily("ngcb_updates_total", "Updates dispatched, by td_api constructor id", "counter");
+    for (const auto &[type, count]: mUpdateCounts.getSnapshot()) {
+        writer.writeSample("ngcb_updates_total", {{"type", std::to_string(type)}}, count);
+    }
+
+    writer.beginFamily("ngcb_pending_requests", "Requests waiting for a response", "gauge");
+    writer.writeSample("ngcb_pending_requests", {}, uint64_t(getPendingRequestCount()));
+    writer.beginFamily("ngcb_timed_out_requests_total", "Requests completed with a timeout error", "counter");
+    writer.writeSample("ngcb_timed_out_requests_total", {}, getTimedOutRequestCount());
+    auto latency = mRequestLatencyStats.getSnapshot();
+    writer.beginFamily("ngcb_request_latency_seconds", "Request round trip time, by td_api function id", "summary");
+    for (const auto &function: latency.functions) {
+        std::string functionId = std::to_string(function.functionId);
+        for (const char *quantile: {"0.5", "0.9", "0.99"}) {
+            writer.writeSample("ngcb_request_latency_seconds", {{"function", functionId}, {"quantile", quantile}},
+                               double(function.getPercentileMicros(atof(quantile))) / 1e6);
+        }
+        writer.writeSample("ngcb_request_latency_seconds_sum", {{"function", functionId}}, double(function.totalMicros) / 1e6);
+        writer.writeSample("ngcb_request_latency_seconds_count", {{"function", functionId}}, function.count);
+    }
+    writer.beginFamily("ngcb_request_errors_total", "Requests completed with an error, by function id and error code", "counter");
+    for (const auto &error: latency.errors) {
+        writer.writeSample("ngcb_request_errors_total",
+                           {{"function", std::to_string(error.functionId)}, {"code", std::to_string(error.errorCode)}}, error.count);
+    }
+
+    const auto &executors = mThreadPool;
+    writer.beginFamily("ngcb_executor_threads", "Worker threads of the shared executor", "gauge");
+    writer.writeSample("ngcb_executor_threads", {}, uint64_t(executors.getPoolSize()));
+    writer.beginFamily("ngcb_executor_active_threads", "Worker threads of the shared executor running a task", "gauge");
+    writer.writeSample("ngcb_executor_active_threads", {}, uint64_t(executors.getActiveCount()));
+    writer.beginFamily("ngcb_executor_queued_tasks", "Tasks waiting for a worker thread of the shared executor", "gauge");
+    writer.writeSample("ngcb_executor_queued_tasks", {}, uint64_t(executors.getQueueSize()));
+    writer.beginFamily("ngcb_executor_completed_tasks_total", "Tasks completed by the shared executor", "counter");
+    writer.writeSample("ngcb_executor_completed_tasks_total", {}, executors.getCompletedTaskCount());
+}
+
+bool SessionManager::onInterceptUpdate(int32_t clientId, td_api::Object &object) {
+    return mInterceptorChain.intercept(clientId, object);
 }
 
 }
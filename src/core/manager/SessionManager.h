@@ -9,24 +9,44 @@
 #include <mutex>
 #include <memory>
 #include <atomic>
+#include <vector>
 #include <cstdint>
+#include <optional>
 #include <functional>
-#include <pthread.h>
-#include <condition_variable>
 
 #include <td/telegram/Client.h>
 #include <td/telegram/td_api.h>
 
-#include "utils/ConcurrentHashMap.h"
+#include "utils/RcuHashMap.h"
 #include "utils/CachedThreadPool.h"
+#include "utils/SequenceSlotTable.h"
+#include "utils/ConcurrentHashMap.h"
+#include "utils/metrics/MetricsRegistry.h"
+#include "ClientManagerShard.h"
+#include "UpdateRouter.h"
+#include "UpdateInterceptor.h"
+#include "SessionManifest.h"
+#include "ResponseRecorder.h"
+#include "RequestLatencyStats.h"
 #include "ClientSession.h"
 
 namespace core {
 
 class SessionManager {
 
+public:
+    using LooperStatistics = ClientManagerShard::LooperStatistics;
+
+    // error code of the synthetic td_api::error for requests that timed out
+    static constexpr int32_t kRequestTimeoutErrorCode = 408;
+
+    /**
+     * Completion of a request group, the results are in the same order as the requests.
+     */
+    using RequestGroupCallback = std::function<void(std::vector<td::td_api::object_ptr<td::td_api::Object>>)>;
+
 private:
-    SessionManager() = default;
+    SessionManager();
 
 public:
     ~SessionManager();
@@ -35,16 +55,141 @@ public:
 
     SessionManager &operator=(const SessionManager &) = delete;
 
-    td::ClientManager *getClientManager();
+    /**
+     * Set the number of td::ClientManager shards, each shard has its own receive and dispatcher thread.
+     * This must be called before the first session is created.
+     * @param shardCount the number of shards, at least 1
+     */
+    void setShardCount(int shardCount);
+
+    [[nodiscard]] int getShardCount() const;
+
+    /**
+     * Set the maximum number of responses each shard drains from TDLib in one go before handing them to its dispatcher.
+     * This must be called before the first session is created.
+     * @param maxBatchSize the batch cap, at least 1
+     */
+    void setMaxReceiveBatchSize(int maxBatchSize);
+
+    /**
+     * Add subscribers to the update routing table, after the built-in subscribers of ClientSession.
+     * The table is built when the first session is created and can't be changed afterwards,
+     * so this must be called before the first session is created.
+     * @param configurator called once with the builder of the routing table
+     */
+    void configureUpdateRouter(std::function<void(UpdateRouter::Builder &)> configurator);
+
+    [[nodiscard]] const UpdateRouter &getUpdateRouter() const noexcept;
+
+    /**
+     * Add a global interceptor which sees the updates of all sessions before they are routed to the session.
+     * Interceptors are called in the order they are added, at most UpdateInterceptorChain::kMaxInterceptors are allowed.
+     * This must be called before the first session is created.
+     * @param interceptor the interceptor
+     */
+    void addUpdateInterceptor(std::shared_ptr<UpdateInterceptor> interceptor);
+
+    /**
+     * Run the shards on something other than td::ClientManager, e.g. SyntheticTransport for load tests.
+     * This must be called before the first session is created.
+     * @param factory called once per shard
+     */
+    void setTransportFactory(TdTransportFactory factory);
+
+    /**
+     * Record every response dispatched by this manager, see ResponseRecorder.
+     * This must be called before the first session is created, close the recorder to stop recording.
+     * @param recorder the recorder
+     */
+    void setResponseRecorder(std::shared_ptr<ResponseRecorder> recorder);
 
     uint64_t nextQueryId() noexcept;
 
+    /**
+     * Send a request to TDLib.
+     * @param clientId the TDLib client id of the session
+     * @param request the request
+     * @param callback the callback to be called on the dispatcher thread with the response
+     * @param timeoutMillis if positive, the callback is completed with an error of code kRequestTimeoutErrorCode
+     * if there is no response after this many milliseconds
+     * @return the request id
+     */
     uint64_t sendRequestWithClientId(int32_t clientId, td::td_api::object_ptr<td::td_api::Function> request,
-                                     std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback);
+                                     std::function<void(td::td_api::object_ptr<td::td_api::Object>)> callback,
+                                     int timeoutMillis = 0);
 
+    /**
+     * Send a request to TDLib without a callback.
+     * The request is still tracked for its latency, until the response arrives or
+     * kUntrackedRequestTimeoutMillis has passed, whichever comes first.
+     * @param clientId the TDLib client id of the session
+     * @param request the request
+     * @return the request id
+     */
     uint64_t sendRequestWithClientId(int32_t clientId, td::td_api::object_ptr<td::td_api::Function> request, nullptr_t);
 
-    [[nodiscard]] std::shared_ptr<ClientSession> createSession(const ClientSession::TdLibParameters &parameters);
+    // how long a request is tracked if nobody waits for its response and no timeout was asked for
+    static constexpr int kUntrackedRequestTimeoutMillis = 10 * 60 * 1000;
+
+    /**
+     * Send several independent requests back to back and get a single completion when all of them are done.
+     * The whole group is tracked by one entry and one deadline, no matter how many requests it has.
+     * The requests are sent as they are, see ClientSession::executeGroup for a group subject to admission control.
+     * Throws std::invalid_argument if there are more than kMaxRequestGroupSize requests.
+     * @param clientId the TDLib client id of the session
+     * @param requests the requests
+     * @param callback called once on the dispatcher thread with one result per request, either the response or an error
+     * @param failFast if true, the callback is called as soon as the first error arrives, results which are not
+     * available yet are nullptr and responses arriving later are discarded
+     * @param timeoutMillis if positive, requests without a response after this many milliseconds
+     * complete with a timeout error
+     * @param onSettled called once on the dispatcher thread when every request has a response or timed out,
+     * which is later than the callback with failFast, may be null
+     * If sending throws, neither callback is called.
+     */
+    void sendRequestGroup(int32_t clientId, std::vector<td::td_api::object_ptr<td::td_api::Function>> requests,
+                          RequestGroupCallback callback, bool failFast = false, int timeoutMillis = 0,
+                          std::function<void()> onSettled = nullptr);
+
+    // the low bits of the request ids of a group hold the index of the member
+    static constexpr int kRequestGroupIndexBits = 20;
+    static constexpr size_t kMaxRequestGroupSize = size_t(1) << kRequestGroupIndexBits;
+
+    /**
+     * Run a task after a delay on the dispatcher thread of the shard that owns the session.
+     * No thread is held while waiting. The task should be short, e.g. hand work over to an executor.
+     * @param clientId the TDLib client id of the session
+     * @param delayMillis the delay in milliseconds
+     * @param task the task
+     */
+    void postDelayed(int32_t clientId, int delayMillis, std::function<void()> task);
+
+    /**
+     * Create a new session on the shard with the least sessions.
+     * @param parameters the TDLib parameters
+     * @param catchUpPolicy if set, the session buffers the startup backlog, see CatchUpBuffer
+     */
+    [[nodiscard]] std::shared_ptr<ClientSession> createSession(
+            const ClientSession::TdLibParameters &parameters,
+            std::optional<CatchUpBuffer::Policy> catchUpPolicy = std::nullopt);
+
+    /**
+     * Create the sessions of a manifest and log them in, at most manifest.startupConcurrency sessions at a time.
+     * Blocks until every session is authorized, has failed or its login has timed out.
+     * @param manifest the manifest
+     * @param baseParameters TDLib parameters shared by all sessions, e.g. the device model,
+     * the api id and hash and the database settings are taken from the manifest
+     * @param loginTimeoutSeconds how long to wait for a single session to log in
+     * @param onSessionCreated called right after each session is created and before it logs in,
+     * e.g. to set up its message handler, may be null
+     * @param getCatchUpPolicy called before each session is created, returns the catch-up policy of the session
+     * or nothing to handle its backlog as it arrives, may be null
+     * @return the sessions in manifest order, including those which failed to log in
+     */
+    std::vector<std::shared_ptr<ClientSession>> startSessions(
+            const SessionManifest &manifest, const ClientSession::TdLibParameters &baseParameters, int loginTimeoutSeconds,
+            const std::function<void(const std::shared_ptr<ClientSession> &, const SessionManifest::Entry &)> &onSessionCreated,
+            const std::function<std::optional<CatchUpBuffer::Policy>(const SessionManifest::Entry &)> &getCatchUpPolicy = nullptr);
 
     [[nodiscard]] std::shared_ptr<ClientSession> getSession(int32_t tdLibId) const;
 
@@ -54,25 +199,109 @@ public:
 
     static SessionManager &getInstance();
 
-    static void runLooper(SessionManager *sessionManager);
-
     void dispatchResponse(td::ClientManager::Response &response);
 
     static void logIfResponseError(const td::td_api::object_ptr<td::td_api::Object> &object);
 
+    /**
+     * Get the looper statistics of every shard that has been created.
+     */
+    [[nodiscard]] std::vector<LooperStatistics> getLooperStatistics() const;
+
+    /**
+     * Get the number of requests which are still waiting for a response callback.
+     */
+    [[nodiscard]] size_t getPendingRequestCount() const;
+
+    /**
+     * Get the number of requests which have been completed with a timeout error so far.
+     */
+    [[nodiscard]] uint64_t getTimedOutRequestCount() const;
+
+    /**
+     * Get the round trip latency histograms and error counts of all requests so far, per function.
+     * Timed out requests are counted with kRequestTimeoutErrorCode.
+     */
+    [[nodiscard]] RequestLatencyStats::Snapshot getRequestLatencySnapshot() const;
+
 private:
-    bool onInterceptUpdate(int32_t clientId, const td::td_api::object_ptr<td::td_api::Object> &object);
+    using QueryCallback = std::function<void(td::td_api::object_ptr<td::td_api::Object>)>;
+
+    class RequestGroup;
+
+    // what is waiting for a response: either a callback, or nothing for requests without a callback,
+    // which are only tracked for their latency
+    struct PendingQuery {
+        QueryCallback callback;
+        int32_t functionId = 0;
+        uint64_t sendTimeMicros = 0;
+    };
+
+    // request ids of group members have this bit set, they never collide with mQuerySequence
+    static constexpr uint64_t kRequestGroupIdBit = uint64_t(1) << 63;
+    static constexpr uint64_t kRequestGroupIndexMask = kMaxRequestGroupSize - 1;
+
+    void completeQuery(PendingQuery &query, td::td_api::object_ptr<td::td_api::Object> result);
+
+    // send a request whose PendingQuery is already stored, removes it again if the transport throws
+    void sendOrForget(ClientManagerShard *shard, int32_t clientId, uint64_t requestId,
+                      td::td_api::object_ptr<td::td_api::Function> request);
+
+    void dispatchGroupResponse(uint64_t requestId, td::td_api::object_ptr<td::td_api::Object> result);
+
+    void onRequestGroupDeadline(uint64_t groupId);
+
+    static constexpr size_t kQueryCallbackSlots = 16384;
+
+    bool onInterceptUpdate(int32_t clientId, td::td_api::Object &object);
+
+    void collectMetrics(utils::metrics::MetricsWriter &writer) const;
+
+    void initShardsLocked();
+
+    void initUpdateRouterLocked();
+
+    void initUpdateInterceptorsLocked();
+
+    [[nodiscard]] ClientManagerShard *getShardForClient(int32_t clientId) const;
+
+    void onRequestDeadline(uint64_t requestId);
+
+    friend class ClientManagerShard;
 
 private:
-    std::mutex mMutex;
-    std::unique_ptr<td::ClientManager> mClientManager;
+    struct ClientEntry {
+        std::shared_ptr<ClientSession> session;
+        ClientManagerShard *shard = nullptr;
+    };
+
+    mutable std::mutex mMutex;
+    int mShardCount = 1;
+    int mMaxReceiveBatchSize = 256;
+    std::vector<std::unique_ptr<ClientManagerShard>> mShards;
+    // null for td::ClientManager
+    TdTransportFactory mTransportFactory;
+    std::vector<std::function<void(UpdateRouter::Builder &)>> mUpdateRouterConfigurators;
+    // immutable once the first session is created
+    UpdateRouter mUpdateRouter;
+    std::vector<std::shared_ptr<UpdateInterceptor>> mPendingInterceptors;
+    // immutable once the first session is created
+    UpdateInterceptorChain mInterceptorChain;
+    // immutable once the first session is created
+    std::shared_ptr<ResponseRecorder> mResponseRecorder;
     std::atomic_uint64_t mQuerySequence = 1;
-    ConcurrentHashMap<uint64_t, std::function<void(td::td_api::object_ptr<td::td_api::Object>)>> mQueryCallbacks;
-    ConcurrentHashMap<int32_t, std::shared_ptr<ClientSession>> mClientSessions;
-    pthread_t mWorkerThread = 0;
-    std::mutex mLooperMutex;
-    std::condition_variable mLooperCondition;
-    std::atomic_bool mLooperRunning = false;
+    std::atomic_uint64_t mRequestGroupSequence = 1;
+    // requests of the groups in mRequestGroups which are still waiting for a response
+    std::atomic_size_t mPendingGroupRequestCount = 0;
+    std::atomic_uint64_t mTimedOutRequestCount = 0;
+    RequestLatencyStats mRequestLatencyStats;
+    // dispatched updates by td_api constructor id
+    utils::metrics::KeyedCounter mUpdateCounts = utils::metrics::KeyedCounter(512);
+    utils::SequenceSlotTable<PendingQuery> mQueryCallbacks = utils::SequenceSlotTable<PendingQuery>(kQueryCallbackSlots);
+    // group id, the request id of the first member -> the group, one entry per group
+    ConcurrentHashMap<uint64_t, std::shared_ptr<RequestGroup>> mRequestGroups;
+    // read for every update, written only when a session is created
+    utils::RcuHashMap<int32_t, ClientEntry> mClients;
     utils::CachedThreadPool mThreadPool = utils::CachedThreadPool(4, 16);
 };
 
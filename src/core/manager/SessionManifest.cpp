@@ -0,0 +1,131 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+
+#include <rapidjson/document.h>
+#include <rapidjson/error/en.h>
+
+#include "utils/file_utils.h"
+
+#include "SessionManifest.h"
+
+namespace core {
+
+static std::string getString(const rapidjson::Value &object, const char *key, const std::string &defaultValue) {
+    auto it = object.FindMember(key);
+    if (it == object.MemberEnd()) {
+        return defaultValue;
+    }
+    if (!it->value.IsString()) {
+        throw std::runtime_error(std::string("manifest: '") + key + "' must be a string");
+    }
+    return {it->value.GetString(), it->value.GetStringLength()};
+}
+
+static int getInt(const rapidjson::Value &object, const char *key, int defaultValue) {
+    auto it = object.FindMember(key);
+    if (it == object.MemberEnd()) {
+        return defaultValue;
+    }
+    if (!it->value.IsInt()) {
+        throw std::runtime_error(std::string("manifest: '") + key + "' must be an integer");
+    }
+    return it->value.GetInt();
+}
+
+static bool getBool(const rapidjson::Value &object, const char *key, bool defaultValue) {
+    auto it = object.FindMember(key);
+    if (it == object.MemberEnd()) {
+        return defaultValue;
+    }
+    if (!it->value.IsBool()) {
+        throw std::runtime_error(std::string("manifest: '") + key + "' must be a boolean");
+    }
+    return it->value.GetBool();
+}
+
+SessionManifest SessionManifest::parse(const std::string &json) {
+    rapidjson::Document document;
+    document.Parse(json.c_str(), json.size());
+    if (document.HasParseError()) {
+        throw std::runtime_error(std::string("manifest: ") + rapidjson::GetParseError_En(document.GetParseError())
+                                 + " at offset " + std::to_string(document.GetErrorOffset()));
+    }
+    if (!document.IsObject()) {
+        throw std::runtime_error("manifest: the root must be an object");
+    }
+    SessionManifest manifest;
+    manifest.apiId = getInt(document, "api_id", 0);
+    manifest.apiHash = getString(document, "api_hash", "");
+    manifest.shardCount = getInt(document, "shards", 0);
+    manifest.startupConcurrency = getInt(document, "startup_concurrency", manifest.startupConcurrency);
+    manifest.databaseRoot = getString(document, "database_root", manifest.databaseRoot);
+    if (manifest.shardCount < 0) {
+        throw std::runtime_error("manifest: 'shards' must not be negative");
+    }
+    if (manifest.startupConcurrency < 1) {
+        throw std::runtime_error("manifest: 'startup_concurrency' must be at least 1");
+    }
+    Entry defaults;
+    defaults.useFileDatabase = getBool(document, "use_file_database", defaults.useFileDatabase);
+    defaults.useChatInfoDatabase = getBool(document, "use_chat_info_database", defaults.useChatInfoDatabase);
+    defaults.useMessageDatabase = getBool(document, "use_message_database", defaults.useMessageDatabase);
+    auto sessions = document.FindMember("sessions");
+    if (sessions == document.MemberEnd() || !sessions->value.IsArray()) {
+        throw std::runtime_error("manifest: 'sessions' must be an array");
+    }
+    std::unordered_set<std::string> names;
+    for (const auto &item: sessions->value.GetArray()) {
+        if (!item.IsObject()) {
+            throw std::runtime_error("manifest: every session must be an object");
+        }
+        Entry entry = defaults;
+        entry.name = getString(item, "name", "");
+        if (entry.name.empty()) {
+            throw std::runtime_error("manifest: session without a name");
+        }
+        if (!names.insert(entry.name).second) {
+            throw std::runtime_error("manifest: duplicate session name '" + entry.name + "'");
+        }
+        std::string type = getString(item, "type", "bot");
+        if (type == "bot") {
+            entry.type = SessionType::BOT;
+            entry.botToken = getString(item, "token", "");
+            if (entry.botToken.empty()) {
+                throw std::runtime_error("manifest: bot session '" + entry.name + "' has no token");
+            }
+        } else if (type == "user") {
+            entry.type = SessionType::USER;
+            entry.phoneNumber = getString(item, "phone", "");
+            if (entry.phoneNumber.empty()) {
+                throw std::runtime_error("manifest: user session '" + entry.name + "' has no phone");
+            }
+        } else {
+            throw std::runtime_error("manifest: session '" + entry.name + "' has unknown type '" + type + "'");
+        }
+        entry.databaseDirectory = getString(item, "database_directory",
+                                            manifest.databaseRoot + utils::kPathSeparator + entry.name);
+        entry.useFileDatabase = getBool(item, "use_file_database", entry.useFileDatabase);
+        entry.useChatInfoDatabase = getBool(item, "use_chat_info_database", entry.useChatInfoDatabase);
+        entry.useMessageDatabase = getBool(item, "use_message_database", entry.useMessageDatabase);
+        manifest.sessions.emplace_back(std::move(entry));
+    }
+    return manifest;
+}
+
+SessionManifest SessionManifest::loadFromFile(const std::string &path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("unable to open manifest " + path);
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return parse(buffer.str());
+}
+
+}
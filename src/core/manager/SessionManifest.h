@@ -0,0 +1,75 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_SESSIONMANIFEST_H
+#define NEOGROUPCAPTCHABOT_SESSIONMANIFEST_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace core {
+
+/**
+ * The list of sessions hosted by the process, loaded from a JSON file, e.g.
+ * <pre>
+ * {
+ *   "api_id": 12345,
+ *   "api_hash": "0123456789abcdef",
+ *   "shards": 4,
+ *   "startup_concurrency": 8,
+ *   "database_root": "database",
+ *   "sessions": [
+ *     {"name": "bot_1", "type": "bot", "token": "123:abc"},
+ *     {"name": "user_1", "type": "user", "phone": "+1 555 0100", "database_directory": "/data/user_1"}
+ *   ]
+ * }
+ * </pre>
+ * The database directory of a session defaults to database_root/name, relative paths are relative to the
+ * working directory. use_file_database, use_chat_info_database and use_message_database can be set
+ * at the top level and overridden per session.
+ */
+struct SessionManifest {
+    enum class SessionType {
+        BOT,
+        USER
+    };
+
+    struct Entry {
+        // unique within the manifest, used for the default database directory and in logs
+        std::string name;
+        SessionType type = SessionType::BOT;
+        std::string botToken;
+        std::string phoneNumber;
+        std::string databaseDirectory;
+        bool useFileDatabase = false;
+        bool useChatInfoDatabase = true;
+        bool useMessageDatabase = false;
+    };
+
+    int32_t apiId = 0;
+    std::string apiHash;
+    // 0 to keep the current shard count of the SessionManager
+    int shardCount = 0;
+    // the maximum number of sessions logging in at the same time
+    int startupConcurrency = 4;
+    std::string databaseRoot = "database";
+    std::vector<Entry> sessions;
+
+    /**
+     * Parse a manifest, throws std::runtime_error if it is malformed.
+     * @param json the JSON text
+     */
+    static SessionManifest parse(const std::string &json);
+
+    /**
+     * Load a manifest from a file, throws std::runtime_error if it can't be read or is malformed.
+     * @param path the path to the JSON file
+     */
+    static SessionManifest loadFromFile(const std::string &path);
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_SESSIONMANIFEST_H
@@ -0,0 +1,301 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+#include "utils/log/Log.h"
+
+#include "SyntheticTransport.h"
+
+namespace td_api = td::td_api;
+
+static constexpr const char *LOG_TAG = "SyntheticTransport";
+
+namespace core {
+
+// client ids are unique in the process, just like those of td::ClientManager
+static std::atomic_int32_t sNextClientId = 1;
+
+// supergroup chat ids are -100xxxxxxxxxx
+static constexpr int64_t kChatIdBase = -1000000000000LL;
+static constexpr int64_t kUserIdBase = 1000000000LL;
+// TDLib message ids are server message ids shifted by 20 bits
+static constexpr int kMessageIdShift = 20;
+
+SyntheticTransport::SyntheticTransport(const Config &config)
+        : mConfig(config), mRandomState((0x9E3779B97F4A7C15uLL ^ uint64_t(Clock::now().time_since_epoch().count())) | 1u) {
+    if (config.chatCount <= 0 || config.userCount <= 0 || config.membersPerJoin <= 0) {
+        throw std::invalid_argument("chat count, user count and members per join must be positive");
+    }
+    if (config.responseLatencyMicros < 0 || config.responseLatencyJitterMicros < 0) {
+        throw std::invalid_argument("response latency must not be negative");
+    }
+    if (config.updatesPerSecond > 0
+        && config.textMessageWeight + config.joinWeight + config.callbackQueryWeight == 0) {
+        throw std::invalid_argument("at least one update kind must have a weight");
+    }
+}
+
+SyntheticTransport::~SyntheticTransport() = default;
+
+void SyntheticTransport::setResponder(int32_t functionId, Responder responder) {
+    if (!responder) {
+        throw std::invalid_argument("responder must not be null");
+    }
+    std::scoped_lock lock(mMutex);
+    mResponders[functionId] = std::move(responder);
+}
+
+int32_t SyntheticTransport::createClientId() {
+    return sNextClientId.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SyntheticTransport::send(int32_t clientId, uint64_t requestId, td_api::object_ptr<td_api::Function> request) {
+    if (request == nullptr) {
+        return;
+    }
+    std::unique_lock lock(mMutex);
+    if (mStartedClients.insert(clientId).second) {
+        // TDLib asks for the parameters once the first request has created the instance
+        enqueueAuthorizationStateLocked(Clock::now(), clientId, td_api::make_object<td_api::authorizationStateWaitTdlibParameters>());
+    }
+    auto dueTime = Clock::now() + nextResponseLatency();
+    td_api::object_ptr<td_api::Object> response;
+    if (auto it = mResponders.find(request->get_id()); it != mResponders.end()) {
+        Responder responder = it->second;
+        lock.unlock();
+        response = responder(clientId, *request);
+        lock.lock();
+    } else {
+        response = createCannedResponseLocked(clientId, *request, dueTime);
+    }
+    if (response == nullptr) {
+        mStatistics.unsupportedRequestCount++;
+        response = td_api::make_object<td_api::error>(kUnsupportedErrorCode, "Not supported by SyntheticTransport");
+    }
+    mStatistics.answeredRequestCount++;
+    enqueueLocked(dueTime, clientId, requestId, std::move(response));
+    mCondition.notify_one();
+}
+
+td_api::object_ptr<td_api::Object> SyntheticTransport::createCannedResponseLocked(
+        int32_t clientId, const td_api::Function &request, Clock::time_point dueTime) {
+    // state updates are stamped one tick after the response, so that they are delivered after it
+    auto updateTime = dueTime + Clock::duration(1);
+    switch (request.get_id()) {
+        case td_api::setTdlibParameters::ID: {
+            enqueueAuthorizationStateLocked(updateTime, clientId, td_api::make_object<td_api::authorizationStateWaitEncryptionKey>());
+            return td_api::make_object<td_api::ok>();
+        }
+        case td_api::checkDatabaseEncryptionKey::ID: {
+            enqueueAuthorizationStateLocked(updateTime, clientId, td_api::make_object<td_api::authorizationStateWaitPhoneNumber>());
+            return td_api::make_object<td_api::ok>();
+        }
+        case td_api::checkAuthenticationBotToken::ID:
+        case td_api::setAuthenticationPhoneNumber::ID: {
+            enqueueAuthorizationStateLocked(updateTime, clientId, td_api::make_object<td_api::authorizationStateReady>());
+            auto connectionState = td_api::make_object<td_api::updateConnectionState>();
+            connectionState->state_ = td_api::make_object<td_api::connectionStateReady>();
+            enqueueLocked(updateTime, clientId, 0, std::move(connectionState));
+            return td_api::make_object<td_api::ok>();
+        }
+        case td_api::close::ID: {
+            enqueueAuthorizationStateLocked(updateTime, clientId, td_api::make_object<td_api::authorizationStateClosed>());
+            return td_api::make_object<td_api::ok>();
+        }
+        case td_api::getOption::ID: {
+            const auto &getOption = static_cast<const td_api::getOption &>(request);
+            if (getOption.name_ == "version") {
+                return td_api::make_object<td_api::optionValueString>("synthetic");
+            }
+            return td_api::make_object<td_api::optionValueEmpty>();
+        }
+        case td_api::sendMessage::ID: {
+            const auto &sendMessage = static_cast<const td_api::sendMessage &>(request);
+            auto message = td_api::make_object<td_api::message>();
+            message->id_ = mNextMessageId++ << kMessageIdShift;
+            message->chat_id_ = sendMessage.chat_id_;
+            message->is_outgoing_ = true;
+            message->date_ = int32_t(std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count());
+            auto content = td_api::make_object<td_api::messageText>();
+            content->text_ = td_api::make_object<td_api::formattedText>();
+            message->content_ = std::move(content);
+            return message;
+        }
+        case td_api::setOption::ID:
+        case td_api::setLogVerbosityLevel::ID:
+        case td_api::deleteMessages::ID:
+        case td_api::setChatMemberStatus::ID: {
+            return td_api::make_object<td_api::ok>();
+        }
+        default: {
+            return nullptr;
+        }
+    }
+}
+
+bool SyntheticTransport::isDueLater(const PendingResponse &lhs, const PendingResponse &rhs) noexcept {
+    return lhs.dueTime != rhs.dueTime ? lhs.dueTime > rhs.dueTime : lhs.sequence > rhs.sequence;
+}
+
+void SyntheticTransport::enqueueLocked(Clock::time_point dueTime, int32_t clientId, uint64_t requestId,
+                                       td_api::object_ptr<td_api::Object> object) {
+    PendingResponse pending = {dueTime, mSequence++, Response()};
+    pending.response.client_id = clientId;
+    pending.response.request_id = requestId;
+    pending.response.object = std::move(object);
+    mPendingResponses.push_back(std::move(pending));
+    std::push_heap(mPendingResponses.begin(), mPendingResponses.end(), isDueLater);
+}
+
+void SyntheticTransport::enqueueAuthorizationStateLocked(Clock::time_point dueTime, int32_t clientId,
+                                                         td_api::object_ptr<td_api::AuthorizationState> state) {
+    auto update = td_api::make_object<td_api::updateAuthorizationState>();
+    update->authorization_state_ = std::move(state);
+    enqueueLocked(dueTime, clientId, 0, std::move(update));
+}
+
+TdTransport::Response SyntheticTransport::receive(double timeoutSeconds) {
+    auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(std::max(0.0, timeoutSeconds)));
+    std::unique_lock lock(mMutex);
+    while (true) {
+        auto now = Clock::now();
+        if (!mPendingResponses.empty() && mPendingResponses.front().dueTime <= now) {
+            std::pop_heap(mPendingResponses.begin(), mPendingResponses.end(), isDueLater);
+            Response response = std::move(mPendingResponses.back().response);
+            mPendingResponses.pop_back();
+            onDeliveredLocked(response);
+            return response;
+        }
+        auto wakeTime = deadline;
+        if (!mPendingResponses.empty()) {
+            wakeTime = std::min(wakeTime, mPendingResponses.front().dueTime);
+        }
+        if (mConfig.updatesPerSecond > 0 && !mAuthorizedClients.empty()) {
+            double elapsedSeconds = std::chrono::duration<double>(now - mFirehoseStartTime).count();
+            auto dueCount = uint64_t(elapsedSeconds * mConfig.updatesPerSecond);
+            auto maxBacklog = uint64_t(kMaxBacklogSeconds * mConfig.updatesPerSecond) + 1;
+            if (dueCount > mFirehoseEmittedCount + maxBacklog) {
+                // the consumer can't keep up, drop the backlog instead of bursting it out later
+                mStatistics.skippedUpdateCount += dueCount - mFirehoseEmittedCount - maxBacklog;
+                mFirehoseEmittedCount = dueCount - maxBacklog;
+            }
+            if (mFirehoseEmittedCount < dueCount) {
+                mFirehoseEmittedCount++;
+                int32_t clientId = mAuthorizedClients[mNextFirehoseClient++ % mAuthorizedClients.size()];
+                return generateUpdateLocked(clientId);
+            }
+            auto nextUpdateTime = mFirehoseStartTime + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(double(mFirehoseEmittedCount + 1) / mConfig.updatesPerSecond));
+            wakeTime = std::min(wakeTime, nextUpdateTime);
+        }
+        if (now >= deadline || mInterrupted) {
+            mInterrupted = false;
+            return {};
+        }
+        mCondition.wait_until(lock, wakeTime);
+    }
+}
+
+void SyntheticTransport::onDeliveredLocked(const Response &response) {
+    if (response.request_id != 0 || response.object->get_id() != td_api::updateAuthorizationState::ID) {
+        return;
+    }
+    // the firehose of a client starts once the client has seen that it is authorized, and stops when it is closed
+    const auto *state = static_cast<const td_api::updateAuthorizationState &>(*response.object).authorization_state_.get();
+    int32_t clientId = response.client_id;
+    auto it = std::find(mAuthorizedClients.begin(), mAuthorizedClients.end(), clientId);
+    if (state->get_id() == td_api::authorizationStateReady::ID && it == mAuthorizedClients.end()) {
+        if (mAuthorizedClients.empty()) {
+            mFirehoseStartTime = Clock::now();
+            mFirehoseEmittedCount = 0;
+        }
+        mAuthorizedClients.push_back(clientId);
+    } else if (state->get_id() == td_api::authorizationStateClosed::ID && it != mAuthorizedClients.end()) {
+        mAuthorizedClients.erase(it);
+    }
+    mStatistics.authorizedClientCount = mAuthorizedClients.size();
+}
+
+void SyntheticTransport::interruptReceive() {
+    std::scoped_lock lock(mMutex);
+    mInterrupted = true;
+    mCondition.notify_all();
+}
+
+TdTransport::Response SyntheticTransport::generateUpdateLocked(int32_t clientId) {
+    mStatistics.generatedUpdateCount++;
+    uint64_t random = nextRandom();
+    int64_t chatId = kChatIdBase - int64_t(random % uint64_t(mConfig.chatCount));
+    int64_t userId = kUserIdBase + int64_t((random >> 24) % uint64_t(mConfig.userCount));
+    int32_t now = int32_t(std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    uint64_t kind = (random >> 48) % (mConfig.textMessageWeight + mConfig.joinWeight + mConfig.callbackQueryWeight);
+    Response response = {};
+    response.client_id = clientId;
+    response.request_id = 0;
+    if (kind >= uint64_t(mConfig.textMessageWeight) + mConfig.joinWeight) {
+        auto update = td_api::make_object<td_api::updateNewCallbackQuery>();
+        update->id_ = int64_t(random >> 1);
+        update->sender_user_id_ = userId;
+        update->chat_id_ = chatId;
+        update->message_id_ = int64_t(1 + random % 1000) << kMessageIdShift;
+        update->chat_instance_ = chatId;
+        auto payload = td_api::make_object<td_api::callbackQueryPayloadData>();
+        payload->data_ = "synthetic";
+        update->payload_ = std::move(payload);
+        response.object = std::move(update);
+        return response;
+    }
+    auto message = td_api::make_object<td_api::message>();
+    message->id_ = mNextMessageId++ << kMessageIdShift;
+    message->chat_id_ = chatId;
+    message->date_ = now;
+    message->sender_id_ = td_api::make_object<td_api::messageSenderUser>(userId);
+    if (kind >= mConfig.textMessageWeight) {
+        // a join flood: one service message adding several fresh users
+        std::vector<int64_t> members;
+        members.reserve(mConfig.membersPerJoin);
+        for (int i = 0; i < mConfig.membersPerJoin; i++) {
+            members.push_back(kUserIdBase + int64_t(nextRandom() % uint64_t(mConfig.userCount)));
+        }
+        message->content_ = td_api::make_object<td_api::messageChatAddMembers>(std::move(members));
+    } else {
+        auto content = td_api::make_object<td_api::messageText>();
+        content->text_ = td_api::make_object<td_api::formattedText>();
+        content->text_->text_ = "synthetic message " + std::to_string(message->id_ >> kMessageIdShift);
+        message->content_ = std::move(content);
+    }
+    response.object = td_api::make_object<td_api::updateNewMessage>(std::move(message));
+    return response;
+}
+
+SyntheticTransport::Clock::duration SyntheticTransport::nextResponseLatency() {
+    int64_t micros = mConfig.responseLatencyMicros;
+    if (mConfig.responseLatencyJitterMicros > 0) {
+        micros += int64_t(nextRandom() % (uint64_t(mConfig.responseLatencyJitterMicros) + 1));
+    }
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::microseconds(micros));
+}
+
+uint64_t SyntheticTransport::nextRandom() noexcept {
+    // xorshift64*, the quality is plenty for picking chats and users
+    uint64_t x = mRandomState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    mRandomState = x;
+    return x * 0x2545F4914F6CDD1DuLL;
+}
+
+SyntheticTransport::Statistics SyntheticTransport::getStatistics() const {
+    std::scoped_lock lock(mMutex);
+    return mStatistics;
+}
+
+}
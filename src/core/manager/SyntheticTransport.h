@@ -0,0 +1,143 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_SYNTHETICTRANSPORT_H
+#define NEOGROUPCAPTCHABOT_SYNTHETICTRANSPORT_H
+
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+
+#include "TdTransport.h"
+
+namespace core {
+
+/**
+ * A fake TDLib for load tests, no network and no database.
+ * <p>
+ * Every client goes through the usual authorization states and accepts any bot token or phone number.
+ * Once a client is authorized, it receives a firehose of synthetic updates: new text messages,
+ * messageChatAddMembers join floods and callback queries, spread round-robin over the authorized clients.
+ * Requests are answered with canned responses after an optional injected latency,
+ * functions without a canned response fail with kUnsupportedErrorCode unless a responder is registered.
+ * <p>
+ * The updates are generated lazily by receive, so the firehose costs nothing but the update objects themselves.
+ */
+class SyntheticTransport final : public TdTransport {
+public:
+    static constexpr int32_t kUnsupportedErrorCode = 501;
+
+    struct Config {
+        // updates per second over all authorized clients of this transport, 0 disables the firehose
+        double updatesPerSecond = 0;
+        // relative weights of the update kinds in the firehose
+        uint32_t textMessageWeight = 8;
+        uint32_t joinWeight = 1;
+        uint32_t callbackQueryWeight = 1;
+        // users added by one messageChatAddMembers
+        int membersPerJoin = 5;
+        int chatCount = 100;
+        int userCount = 100000;
+        // delay before a request is answered, uniformly distributed in [latency, latency + jitter]
+        int responseLatencyMicros = 0;
+        int responseLatencyJitterMicros = 0;
+    };
+
+    struct Statistics {
+        uint64_t generatedUpdateCount = 0;
+        // updates not generated because the consumer fell behind by more than kMaxBacklogSeconds
+        uint64_t skippedUpdateCount = 0;
+        uint64_t answeredRequestCount = 0;
+        uint64_t unsupportedRequestCount = 0;
+        size_t authorizedClientCount = 0;
+    };
+
+    /**
+     * Produces the response to a request, called on the thread which sends the request.
+     */
+    using Responder = std::function<td::td_api::object_ptr<td::td_api::Object>(
+            int32_t clientId, const td::td_api::Function &request)>;
+
+    explicit SyntheticTransport(const Config &config);
+
+    ~SyntheticTransport() override;
+
+    /**
+     * Answer a function with a custom responder instead of the canned response.
+     * This should be called before the transport is used.
+     * @param functionId the td_api constructor id of the function
+     * @param responder the responder
+     */
+    void setResponder(int32_t functionId, Responder responder);
+
+    int32_t createClientId() override;
+
+    void send(int32_t clientId, uint64_t requestId, td::td_api::object_ptr<td::td_api::Function> request) override;
+
+    Response receive(double timeoutSeconds) override;
+
+    void interruptReceive() override;
+
+    [[nodiscard]] Statistics getStatistics() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // the firehose does not try to catch up more than this
+    static constexpr double kMaxBacklogSeconds = 1.0;
+
+    struct PendingResponse {
+        Clock::time_point dueTime;
+        uint64_t sequence;
+        Response response;
+    };
+
+    // heap order of mPendingResponses
+    static bool isDueLater(const PendingResponse &lhs, const PendingResponse &rhs) noexcept;
+
+    void enqueueLocked(Clock::time_point dueTime, int32_t clientId, uint64_t requestId,
+                       td::td_api::object_ptr<td::td_api::Object> object);
+
+    void enqueueAuthorizationStateLocked(Clock::time_point dueTime, int32_t clientId,
+                                         td::td_api::object_ptr<td::td_api::AuthorizationState> state);
+
+    td::td_api::object_ptr<td::td_api::Object> createCannedResponseLocked(
+            int32_t clientId, const td::td_api::Function &request, Clock::time_point dueTime);
+
+    void onDeliveredLocked(const Response &response);
+
+    Response generateUpdateLocked(int32_t clientId);
+
+    Clock::duration nextResponseLatency();
+
+    uint64_t nextRandom() noexcept;
+
+    const Config mConfig;
+    std::unordered_map<int32_t, Responder> mResponders;
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    // min-heap by due time, then by sequence so that responses with the same due time keep their order
+    std::vector<PendingResponse> mPendingResponses;
+    uint64_t mSequence = 0;
+    // clients which have sent a request, like TDLib a client only starts then
+    std::unordered_set<int32_t> mStartedClients;
+    std::vector<int32_t> mAuthorizedClients;
+    size_t mNextFirehoseClient = 0;
+    Clock::time_point mFirehoseStartTime;
+    uint64_t mFirehoseEmittedCount = 0;
+    bool mInterrupted = false;
+    uint64_t mRandomState;
+    int64_t mNextMessageId = 1;
+    Statistics mStatistics;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_SYNTHETICTRANSPORT_H
@@ -0,0 +1,36 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <td/telegram/td_api_json.h>
+#include <td/utils/JsonBuilder.h>
+
+#include "TdObjectJson.h"
+
+namespace td_api = td::td_api;
+
+namespace core::json {
+
+std::string serializeObject(const td_api::Object &object) {
+    return td::json_encode<std::string>(td::ToJson(object));
+}
+
+td_api::object_ptr<td_api::Object> deserializeObject(std::string &json) {
+    // json_decode works in place
+    auto value = td::json_decode(td::MutableSlice(json));
+    if (value.is_error()) {
+        return nullptr;
+    }
+    td_api::object_ptr<td_api::Object> object;
+    if (td_api::from_json(object, value.move_as_ok()).is_error()) {
+        return nullptr;
+    }
+    return object;
+}
+
+td_api::object_ptr<td_api::Object> copyObject(const std::string &json) {
+    std::string buffer = json;
+    return deserializeObject(buffer);
+}
+
+}
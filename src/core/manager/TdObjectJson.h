@@ -0,0 +1,34 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_TDOBJECTJSON_H
+#define NEOGROUPCAPTCHABOT_TDOBJECTJSON_H
+
+#include <string>
+
+#include <td/telegram/td_api.h>
+
+namespace core::json {
+
+/**
+ * Encode an object in the TDLib JSON encoding.
+ */
+[[nodiscard]] std::string serializeObject(const td::td_api::Object &object);
+
+/**
+ * Decode an object from the TDLib JSON encoding, the buffer is used as scratch space.
+ * @return the object, or nullptr if the JSON is malformed
+ */
+[[nodiscard]] td::td_api::object_ptr<td::td_api::Object> deserializeObject(std::string &json);
+
+/**
+ * Deep copy an object through its JSON encoding, td_api objects can't be copied otherwise.
+ * @param json the JSON encoding of the object, see serializeObject
+ * @return the copy, or nullptr if the JSON is malformed
+ */
+[[nodiscard]] td::td_api::object_ptr<td::td_api::Object> copyObject(const std::string &json);
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_TDOBJECTJSON_H
@@ -0,0 +1,152 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_TDRESULT_H
+#define NEOGROUPCAPTCHABOT_TDRESULT_H
+
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+#include <td/telegram/td_api.h>
+
+namespace core {
+
+namespace detail {
+
+template<typename P>
+struct ObjectPtrElement;
+
+template<typename T>
+struct ObjectPtrElement<td::td_api::object_ptr<T>> {
+    using type = T;
+};
+
+}
+
+/**
+ * A td_api function, i.e. something with a ReturnType.
+ */
+template<typename F>
+concept TdFunction = std::is_base_of_v<td::td_api::Function, F> && requires {
+    typename detail::ObjectPtrElement<typename F::ReturnType>::type;
+};
+
+/**
+ * The object type TDLib returns for the function F, e.g. td_api::message for td_api::sendMessage.
+ */
+template<TdFunction F>
+using TdReturnType = typename detail::ObjectPtrElement<typename F::ReturnType>::type;
+
+/**
+ * The response to a td_api function: either an object of the return type of the function or a td_api::error.
+ * The type is known at compile time, so there is no need to check object ids or cast by hand.
+ * @tparam T the return type of the function, see TdReturnType
+ */
+template<typename T>
+class TdResult {
+public:
+    // error code used if TDLib returned no object at all
+    static constexpr int32_t kEmptyResponseErrorCode = 500;
+
+    /**
+     * Wrap a raw response, which is either a td_api::error or an object of type T as promised by the function.
+     */
+    explicit TdResult(td::td_api::object_ptr<td::td_api::Object> object) {
+        if (object == nullptr) {
+            mError = td::td_api::make_object<td::td_api::error>(kEmptyResponseErrorCode, "Empty response");
+        } else if (object->get_id() == td::td_api::error::ID) {
+            mError = td::td_api::move_object_as<td::td_api::error>(object);
+        } else {
+            mValue = td::td_api::move_object_as<T>(object);
+        }
+    }
+
+    explicit TdResult(td::td_api::object_ptr<td::td_api::error> error) : mError(std::move(error)) {}
+
+    TdResult(TdResult &&) noexcept = default;
+
+    TdResult &operator=(TdResult &&) noexcept = default;
+
+    TdResult(const TdResult &) = delete;
+
+    TdResult &operator=(const TdResult &) = delete;
+
+    [[nodiscard]] bool isOk() const noexcept {
+        return mError == nullptr;
+    }
+
+    [[nodiscard]] bool isError() const noexcept {
+        return mError != nullptr;
+    }
+
+    explicit operator bool() const noexcept {
+        return isOk();
+    }
+
+    /**
+     * Get the result object, throws std::logic_error if this is an error.
+     */
+    [[nodiscard]] T &getValue() const {
+        if (mValue == nullptr) {
+            throw std::logic_error("TdResult is an error: " + getErrorMessage());
+        }
+        return *mValue;
+    }
+
+    T *operator->() const {
+        return &getValue();
+    }
+
+    /**
+     * Move the result object out, throws std::logic_error if this is an error.
+     */
+    [[nodiscard]] td::td_api::object_ptr<T> takeValue() {
+        if (mValue == nullptr) {
+            throw std::logic_error("TdResult is an error: " + getErrorMessage());
+        }
+        return std::move(mValue);
+    }
+
+    /**
+     * Get the error, throws std::logic_error if this is not an error.
+     */
+    [[nodiscard]] const td::td_api::error &getError() const {
+        if (mError == nullptr) {
+            throw std::logic_error("TdResult is not an error");
+        }
+        return *mError;
+    }
+
+    [[nodiscard]] td::td_api::object_ptr<td::td_api::error> takeError() {
+        if (mError == nullptr) {
+            throw std::logic_error("TdResult is not an error");
+        }
+        return std::move(mError);
+    }
+
+    /**
+     * Get the error code, or 0 if this is not an error.
+     */
+    [[nodiscard]] int32_t getErrorCode() const noexcept {
+        return mError != nullptr ? mError->code_ : 0;
+    }
+
+    /**
+     * Get the error message, or an empty string if this is not an error.
+     */
+    [[nodiscard]] std::string getErrorMessage() const {
+        return mError != nullptr ? mError->message_ : std::string();
+    }
+
+private:
+    td::td_api::object_ptr<T> mValue;
+    td::td_api::object_ptr<td::td_api::error> mError;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_TDRESULT_H
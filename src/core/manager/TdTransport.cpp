@@ -0,0 +1,26 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include "TdTransport.h"
+
+namespace core {
+
+ClientManagerTransport::ClientManagerTransport() : mClientManager(std::make_unique<td::ClientManager>()) {}
+
+ClientManagerTransport::~ClientManagerTransport() = default;
+
+int32_t ClientManagerTransport::createClientId() {
+    return mClientManager->create_client_id();
+}
+
+void ClientManagerTransport::send(int32_t clientId, uint64_t requestId,
+                                  td::td_api::object_ptr<td::td_api::Function> request) {
+    mClientManager->send(clientId, requestId, std::move(request));
+}
+
+TdTransport::Response ClientManagerTransport::receive(double timeoutSeconds) {
+    return mClientManager->receive(timeoutSeconds);
+}
+
+}
@@ -0,0 +1,82 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_TDTRANSPORT_H
+#define NEOGROUPCAPTCHABOT_TDTRANSPORT_H
+
+#include <memory>
+#include <cstdint>
+#include <functional>
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+namespace core {
+
+/**
+ * The part of td::ClientManager a shard uses, so that the shards can run against something other than TDLib,
+ * e.g. SyntheticTransport for load tests.
+ * The contract is the one of td::ClientManager: send and createClientId may be called from any thread,
+ * receive is only called from the receive thread of the shard.
+ */
+class TdTransport {
+public:
+    using Response = td::ClientManager::Response;
+
+    TdTransport() = default;
+
+    virtual ~TdTransport() = default;
+
+    TdTransport(const TdTransport &) = delete;
+
+    TdTransport &operator=(const TdTransport &) = delete;
+
+    /**
+     * Create a new client id, client ids must be unique across all transports in the process.
+     */
+    virtual int32_t createClientId() = 0;
+
+    virtual void send(int32_t clientId, uint64_t requestId, td::td_api::object_ptr<td::td_api::Function> request) = 0;
+
+    /**
+     * Wait for the next response or update.
+     * @param timeoutSeconds the maximum time to wait, 0 to return immediately
+     * @return the response, its object is nullptr if nothing arrived in time
+     */
+    virtual Response receive(double timeoutSeconds) = 0;
+
+    /**
+     * Make a receive call which is waiting return early, used to stop the shard.
+     * Transports which can't be interrupted return from receive when their timeout expires.
+     */
+    virtual void interruptReceive() {}
+};
+
+/**
+ * Creates the transport of a shard.
+ */
+using TdTransportFactory = std::function<std::unique_ptr<TdTransport>(int shardIndex)>;
+
+/**
+ * The real thing: a td::ClientManager.
+ */
+class ClientManagerTransport final : public TdTransport {
+public:
+    ClientManagerTransport();
+
+    ~ClientManagerTransport() override;
+
+    int32_t createClientId() override;
+
+    void send(int32_t clientId, uint64_t requestId, td::td_api::object_ptr<td::td_api::Function> request) override;
+
+    Response receive(double timeoutSeconds) override;
+
+private:
+    std::unique_ptr<td::ClientManager> mClientManager;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_TDTRANSPORT_H
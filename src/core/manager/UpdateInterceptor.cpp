@@ -0,0 +1,64 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <bit>
+#include <string>
+#include <stdexcept>
+
+#include "UpdateInterceptor.h"
+
+namespace core {
+
+UpdateInterceptorChain::UpdateInterceptorChain(std::vector<std::shared_ptr<UpdateInterceptor>> interceptors)
+        : mInterceptors(std::move(interceptors)) {
+    if (mInterceptors.size() > kMaxInterceptors) {
+        throw std::logic_error("too many update interceptors: " + std::to_string(mInterceptors.size()));
+    }
+    std::vector<int32_t> updateIds;
+    for (size_t i = 0; i < mInterceptors.size(); i++) {
+        if (mInterceptors[i] == nullptr) {
+            throw std::invalid_argument("interceptor must not be null");
+        }
+        uint64_t bit = uint64_t(1) << i;
+        auto interested = mInterceptors[i]->getInterestedUpdateIds();
+        if (interested.empty()) {
+            mWildcardMask |= bit;
+            continue;
+        }
+        for (int32_t updateId: interested) {
+            size_t index = 0;
+            while (index < updateIds.size() && updateIds[index] != updateId) {
+                index++;
+            }
+            if (index == updateIds.size()) {
+                updateIds.push_back(updateId);
+                mMasks.push_back(0);
+            }
+            mMasks[index] |= bit;
+        }
+    }
+    mIndex = utils::PerfectHashIndex(updateIds);
+}
+
+bool UpdateInterceptorChain::intercept(int32_t clientId, td::td_api::Object &update) const {
+    uint64_t mask = mWildcardMask;
+    int32_t index = mIndex.indexOf(update.get_id());
+    if (index != utils::PerfectHashIndex::kNotFound) {
+        mask |= mMasks[index];
+    }
+    while (mask != 0) {
+        int i = std::countr_zero(mask);
+        mask &= mask - 1;
+        if (mInterceptors[i]->onUpdate(clientId, update)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool UpdateInterceptorChain::isEmpty() const noexcept {
+    return mInterceptors.empty();
+}
+
+}
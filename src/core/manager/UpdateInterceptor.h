@@ -0,0 +1,81 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_UPDATEINTERCEPTOR_H
+#define NEOGROUPCAPTCHABOT_UPDATEINTERCEPTOR_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <td/telegram/td_api.h>
+
+#include "utils/PerfectHashIndex.h"
+
+namespace core {
+
+/**
+ * Sees updates of every session before they are routed to the session, e.g. for metrics, dedup or auditing.
+ * Interceptors are called on the dispatcher threads, possibly on several threads at the same time.
+ */
+class UpdateInterceptor {
+public:
+    UpdateInterceptor() = default;
+
+    virtual ~UpdateInterceptor() = default;
+
+    UpdateInterceptor(const UpdateInterceptor &) = delete;
+
+    UpdateInterceptor &operator=(const UpdateInterceptor &) = delete;
+
+    /**
+     * Get the td_api ids of the updates this interceptor wants to see, queried once on registration.
+     * @return the update ids, or an empty vector for all updates
+     */
+    [[nodiscard]] virtual std::vector<int32_t> getInterestedUpdateIds() const = 0;
+
+    /**
+     * Called with an update of one of the interested types.
+     * @param clientId the TDLib client id of the session which received the update
+     * @param update the update
+     * @return true to consume the update, later interceptors and the session won't see it
+     */
+    virtual bool onUpdate(int32_t clientId, td::td_api::Object &update) = 0;
+};
+
+/**
+ * An immutable chain of at most kMaxInterceptors interceptors.
+ * For every update id there is a bitmask of the interceptors interested in it,
+ * so an update nobody is interested in costs a single hash table load and no virtual call.
+ */
+class UpdateInterceptorChain {
+public:
+    static constexpr size_t kMaxInterceptors = 64;
+
+    UpdateInterceptorChain() = default;
+
+    /**
+     * @param interceptors the interceptors, in the order they are called
+     */
+    explicit UpdateInterceptorChain(std::vector<std::shared_ptr<UpdateInterceptor>> interceptors);
+
+    /**
+     * Pass an update through the interested interceptors.
+     * @return true if an interceptor consumed the update
+     */
+    bool intercept(int32_t clientId, td::td_api::Object &update) const;
+
+    [[nodiscard]] bool isEmpty() const noexcept;
+
+private:
+    std::vector<std::shared_ptr<UpdateInterceptor>> mInterceptors;
+    // interceptors interested in every update
+    uint64_t mWildcardMask = 0;
+    utils::PerfectHashIndex mIndex;
+    std::vector<uint64_t> mMasks;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_UPDATEINTERCEPTOR_H
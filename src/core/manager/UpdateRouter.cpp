@@ -0,0 +1,61 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "UpdateRouter.h"
+
+namespace core {
+
+UpdateRouter::Builder &UpdateRouter::Builder::subscribe(int32_t updateId, Subscriber subscriber) {
+    if (!subscriber) {
+        throw std::invalid_argument("subscriber must not be null");
+    }
+    mSubscriptions.emplace_back(updateId, std::move(subscriber));
+    return *this;
+}
+
+UpdateRouter UpdateRouter::Builder::build() {
+    // group the subscribers by update type, keeping the subscription order within each type
+    std::stable_sort(mSubscriptions.begin(), mSubscriptions.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.first < rhs.first;
+    });
+    UpdateRouter router;
+    router.mSubscribers.reserve(mSubscriptions.size());
+    for (auto &[updateId, subscriber]: mSubscriptions) {
+        if (router.mUpdateIds.empty() || router.mUpdateIds.back() != updateId) {
+            router.mUpdateIds.push_back(updateId);
+            auto position = uint32_t(router.mSubscribers.size());
+            router.mRoutes.push_back({position, position});
+        }
+        router.mSubscribers.push_back(std::move(subscriber));
+        router.mRoutes.back().end++;
+    }
+    mSubscriptions.clear();
+    router.mIndex = utils::PerfectHashIndex(router.mUpdateIds);
+    return router;
+}
+
+bool UpdateRouter::dispatch(ClientSession *session, td::td_api::Object &update) const {
+    int32_t index = mIndex.indexOf(update.get_id());
+    if (index == utils::PerfectHashIndex::kNotFound) {
+        return false;
+    }
+    const Route &route = mRoutes[index];
+    for (uint32_t i = route.begin; i < route.end; i++) {
+        mSubscribers[i](session, update);
+    }
+    return true;
+}
+
+bool UpdateRouter::hasSubscriber(int32_t updateId) const noexcept {
+    return mIndex.indexOf(updateId) != utils::PerfectHashIndex::kNotFound;
+}
+
+std::vector<int32_t> UpdateRouter::getSubscribedUpdateIds() const {
+    return mUpdateIds;
+}
+
+}
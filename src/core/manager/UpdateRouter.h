@@ -0,0 +1,96 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_UPDATEROUTER_H
+#define NEOGROUPCAPTCHABOT_UPDATEROUTER_H
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+#include <td/telegram/td_api.h>
+
+#include "utils/PerfectHashIndex.h"
+
+namespace core {
+
+class ClientSession;
+
+/**
+ * Routes TDLib updates to the subscribers of their type.
+ * The routing table is built once and is immutable afterwards, dispatch is a single hash table load
+ * followed by the subscribers of the update type, update types nobody subscribed to cost nothing.
+ */
+class UpdateRouter {
+public:
+    using Subscriber = std::function<void(ClientSession *, td::td_api::Object &)>;
+
+    class Builder {
+    public:
+        Builder() = default;
+
+        /**
+         * Subscribe to an update type, e.g.
+         * <code>builder.subscribe&lt;td_api::updateNewMessage&gt;([](ClientSession *session, td_api::updateNewMessage &update) {...});</code>
+         * Subscribers of the same type are called in the order they are subscribed.
+         * A subscriber may move data out of the update only if no later subscriber needs it.
+         * @tparam U the update type
+         * @param subscriber called with the session and the update
+         */
+        template<typename U, typename Fn>
+        Builder &subscribe(Fn subscriber) {
+            static_assert(std::is_base_of_v<td::td_api::Update, U>, "U must be a td_api update");
+            return subscribe(U::ID, [subscriber = std::move(subscriber)](ClientSession *session, td::td_api::Object &update) {
+                subscriber(session, static_cast<U &>(update));
+            });
+        }
+
+        /**
+         * Subscribe to an update type by its constructor id.
+         * @param updateId the td_api constructor id of the update
+         * @param subscriber called with the session and the update
+         */
+        Builder &subscribe(int32_t updateId, Subscriber subscriber);
+
+        [[nodiscard]] UpdateRouter build();
+
+    private:
+        std::vector<std::pair<int32_t, Subscriber>> mSubscriptions;
+    };
+
+    UpdateRouter() = default;
+
+    /**
+     * Call the subscribers of the update type.
+     * @param session the session which received the update
+     * @param update the update
+     * @return true if there was at least one subscriber
+     */
+    bool dispatch(ClientSession *session, td::td_api::Object &update) const;
+
+    [[nodiscard]] bool hasSubscriber(int32_t updateId) const noexcept;
+
+    /**
+     * Get the update types with at least one subscriber.
+     */
+    [[nodiscard]] std::vector<int32_t> getSubscribedUpdateIds() const;
+
+private:
+    // the subscribers of one update type are mSubscribers[begin, end)
+    struct Route {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+    };
+
+    utils::PerfectHashIndex mIndex;
+    std::vector<int32_t> mUpdateIds;
+    std::vector<Route> mRoutes;
+    std::vector<Subscriber> mSubscribers;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_UPDATEROUTER_H
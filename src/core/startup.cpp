@@ -1,8 +1,16 @@
 #include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
 #include <sys/utsname.h>
 #include <iostream>
 #include <functional>
 #include <string>
+#include <climits>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
 
 #include <td/telegram/Client.h>
 #include <td/telegram/td_api.h>
@@ -12,8 +20,16 @@
 #include "utils/config/ConfigManager.h"
 #include "manager/SessionManager.h"
 #include "manager/ClientSession.h"
+#include "manager/SessionManifest.h"
+#include "manager/BotPool.h"
+#include "manager/HandlerModuleHost.h"
+#include "manager/ResponseRecorder.h"
+#include "manager/ResponseReplayer.h"
+#include "manager/SyntheticTransport.h"
 #include "utils/SyncUtils.h"
 #include "utils/log/Log.h"
+#include "utils/metrics/MetricsRegistry.h"
+#include "utils/metrics/MetricsServer.h"
 
 using namespace utils;
 using utils::config::ConfigManager;
@@ -25,6 +41,358 @@ namespace tdapi = td::td_api;
 
 static constexpr const char *LOG_TAG = "startup";
 
+// set by SIGUSR1, the report loops dump the request latency when they see it
+static volatile sig_atomic_t sLatencyDumpRequested = 0;
+
+// set by SIGHUP, the report loops reload the handler module when they see it
+static volatile sig_atomic_t sModuleReloadRequested = 0;
+
+// set by SIGINT and SIGTERM, the report loops return when they see it
+static volatile sig_atomic_t sShutdownRequested = 0;
+
+// the handlers of --module=, null without one
+static std::shared_ptr<core::HandlerModuleHost> sModuleHost;
+
+// the recorder of --record=, null without one
+static std::shared_ptr<core::ResponseRecorder> sResponseRecorder;
+
+static void installSignalHandler(int signal, void (*handler)(int)) {
+    struct sigaction action = {};
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    // no SA_RESTART, the report loops are woken up by the signal
+    action.sa_flags = 0;
+    if (sigaction(signal, &action, nullptr) != 0) {
+        LOGW("failed to install the handler of signal %d: %s", signal, strerror(errno));
+    }
+}
+
+/**
+ * Flush the buffered frames of the capture file, they are lost if the process exits without it.
+ */
+static void closeResponseRecorder() {
+    if (sResponseRecorder != nullptr) {
+        sResponseRecorder->close();
+        LOGI("closed capture file %s", sResponseRecorder->getPath().c_str());
+    }
+}
+
+static void logRequestLatencyIfRequested() {
+    if (sLatencyDumpRequested != 0) {
+        sLatencyDumpRequested = 0;
+        std::string table = SessionManager::getInstance().getRequestLatencySnapshot().format();
+        LOGI("request latency:\n%s", table.c_str());
+    }
+}
+
+static void reloadModuleIfRequested() {
+    if (sModuleReloadRequested != 0) {
+        sModuleReloadRequested = 0;
+        if (sModuleHost == nullptr) {
+            LOGW("no handler module to reload");
+            return;
+        }
+        uint64_t start = getCurrentTimeMillis();
+        try {
+            sModuleHost->reload();
+            LOGI("reloaded handler module in %llu ms", (unsigned long long) (getCurrentTimeMillis() - start));
+        } catch (const std::exception &e) {
+            LOGE("failed to reload handler module, keeping the current one: %s", e.what());
+        }
+    }
+}
+
+/**
+ * Messages sent before the startup are part of the backlog, drop them during the catch-up without handling them.
+ */
+static core::CatchUpBuffer::Policy createCatchUpPolicy(uint64_t startupTime) {
+    core::CatchUpBuffer::Policy policy;
+    policy.staleBefore = int32_t(startupTime / 1000);
+    // the newest messages of a chat are enough to catch up with a raid that started while we were down
+    policy.maxMessagesPerChat = 32;
+    return policy;
+}
+
+static ClientSession::MessageHandler createDemoMessageHandler(uint64_t startupTime, core::BotPool *botPool);
+
+/**
+ * The handler module gets the messages first if there is one, the demo handler gets what it leaves.
+ * @param botPool the pool the bot belongs to, or null if it answers on its own
+ */
+static ClientSession::MessageHandler createMessageHandler(uint64_t startupTime, core::BotPool *botPool = nullptr) {
+    if (sModuleHost != nullptr) {
+        return sModuleHost->createMessageHandler(createDemoMessageHandler(startupTime, botPool));
+    }
+    return createDemoMessageHandler(startupTime, botPool);
+}
+
+static ClientSession::MessageHandler createDemoMessageHandler(uint64_t startupTime, core::BotPool *botPool) {
+    return [startupTime, botPool](ClientSession *session, const tdapi::message *message) {
+        const auto *content = message->content_.get();
+        static int sendCount = 0;
+        if (sendCount > 10) {
+            throw std::runtime_error("send too many messages");
+        }
+        // don't handle old messages
+        uint64_t msgTime = message->date_ * 1000;
+        if (msgTime < startupTime) {
+            LOGI("ignore old message at time: %llu, startup_time: %llu", msgTime, startupTime);
+            return true;
+        }
+
+        // every bot of a pool sees the message, one of them answers
+        if (botPool != nullptr && !botPool->isResponsibleFor(session->getTdLibObjectId(), message->chat_id_)) {
+            return true;
+        }
+
+        std::cout << "message: type=" << content->get_id() << std::endl;
+        if (content->get_id() == tdapi::messageText::ID) {
+            std::string text = static_cast<const tdapi::messageText *>(content)->text_->text_;
+            std::string reply = "Hello, " + text;
+            if (botPool == nullptr) {
+                session->sendTextMessage(message->chat_id_, reply);
+            } else {
+                // the pool sends through another admin if this bot is rate limited in the chat
+                int64_t chatId = message->chat_id_;
+                botPool->execute(
+                        chatId,
+                        [chatId, reply]() -> tdapi::object_ptr<tdapi::Function> {
+                            return tdapi::make_object<tdapi::sendMessage>(
+                                    chatId, 0, 0, tdapi::make_object<tdapi::messageSendOptions>(false, false, false, nullptr),
+                                    nullptr, tdapi::make_object<tdapi::inputMessageText>(
+                                            tdapi::make_object<tdapi::formattedText>(
+                                                    reply, std::vector<tdapi::object_ptr<tdapi::textEntity>>()),
+                                            false, false));
+                        },
+                        [](ClientSession *, tdapi::object_ptr<tdapi::Object> result) {
+                            if (result != nullptr && result->get_id() == tdapi::error::ID) {
+                                const auto &error = static_cast<const tdapi::error &>(*result);
+                                LOGE("pooled sendMessage code:%d error: %s", error.code_, error.message_.c_str());
+                            }
+                        });
+            }
+            sendCount++;
+            return true;
+        }
+        return false;
+    };
+}
+
+/**
+ * Host every session of a manifest, then report memory and dispatch throughput once a minute.
+ */
+static int runManifest(const std::string &manifestPath, int32_t apiId, const std::string &apiHash,
+                       const ClientSession::TdLibParameters &baseParameters) {
+    core::SessionManifest manifest;
+    try {
+        manifest = core::SessionManifest::loadFromFile(manifestPath);
+    } catch (const std::exception &e) {
+        LOGE("failed to load manifest: %s", e.what());
+        return 1;
+    }
+    if (manifest.apiId <= 0) {
+        manifest.apiId = apiId;
+    }
+    if (manifest.apiHash.empty()) {
+        manifest.apiHash = apiHash;
+    }
+    if (manifest.apiId <= 0 || manifest.apiHash.empty()) {
+        LOGE("api id and api hash must be set in the manifest, the cmd line or the env vars");
+        return 1;
+    }
+    auto &sessionManager = SessionManager::getInstance();
+    if (manifest.shardCount > 0) {
+        sessionManager.setShardCount(manifest.shardCount);
+    }
+    // the bots of the manifest share the moderation load of the chats they are admins of
+    auto botPool = std::make_shared<core::BotPool>();
+    sessionManager.addUpdateInterceptor(botPool);
+    uint64_t startupTime = getCurrentTimeMillis();
+    uint64_t rssBefore = getCurrentResidentSetSize();
+    auto sessions = sessionManager.startSessions(
+            manifest, baseParameters, 120,
+            [startupTime, &botPool](const std::shared_ptr<ClientSession> &session, const core::SessionManifest::Entry &entry) {
+                if (entry.type == core::SessionManifest::SessionType::BOT) {
+                    session->setMessageHandler(createMessageHandler(startupTime, botPool.get()));
+                    botPool->addBot(session);
+                }
+            },
+            [startupTime](const core::SessionManifest::Entry &entry) -> std::optional<core::CatchUpBuffer::Policy> {
+                if (entry.type == core::SessionManifest::SessionType::BOT) {
+                    return createCatchUpPolicy(startupTime);
+                }
+                return std::nullopt;
+            });
+    uint64_t lastReceivedCount = 0;
+    uint64_t lastReportTime = getCurrentTimeMillis();
+    while (sShutdownRequested == 0) {
+        // returns early on signals
+        sleep(60);
+        logRequestLatencyIfRequested();
+        reloadModuleIfRequested();
+        uint64_t now = getCurrentTimeMillis();
+        if (now - lastReportTime < 60 * 1000) {
+            continue;
+        }
+        uint64_t receivedCount = 0;
+        for (const auto &stats: sessionManager.getLooperStatistics()) {
+            receivedCount += stats.receivedCount;
+        }
+        uint64_t rss = getCurrentResidentSetSize();
+        uint64_t perSession = sessions.empty() || rss < rssBefore ? 0 : (rss - rssBefore) / sessions.size();
+        double throughput = double(receivedCount - lastReceivedCount) * 1000.0 / double(std::max<uint64_t>(1, now - lastReportTime));
+        auto poolStats = botPool->getStatistics();
+        LOGI("sessions = %zu, rss = %llu KiB, per session = %llu KiB, dispatched = %.1f/s, pending requests = %zu, "
+             "pool routed = %llu, failovers = %llu, unavailable = %llu",
+             sessions.size(), (unsigned long long) (rss / 1024), (unsigned long long) (perSession / 1024),
+             throughput, sessionManager.getPendingRequestCount(), (unsigned long long) poolStats.routedCount,
+             (unsigned long long) poolStats.failoverCount, (unsigned long long) poolStats.unavailableCount);
+        lastReceivedCount = receivedCount;
+        lastReportTime = now;
+    }
+    return 0;
+}
+
+/**
+ * Run sessions against SyntheticTransport instead of TDLib and report the throughput every 10 seconds.
+ * Every join is answered with a message, so that the outbound path is exercised as well.
+ */
+static int runSyntheticLoad(double updatesPerSecond, int sessionCount, int latencyMicros, int durationSeconds,
+                            const ClientSession::TdLibParameters &baseParameters) {
+    auto &sessionManager = SessionManager::getInstance();
+    int shardCount = sessionManager.getShardCount();
+    core::SyntheticTransport::Config config;
+    config.updatesPerSecond = updatesPerSecond / shardCount;
+    config.responseLatencyMicros = latencyMicros;
+    config.responseLatencyJitterMicros = latencyMicros / 2;
+    // owned by the shards, which live as long as the process
+    static std::vector<core::SyntheticTransport *> transports;
+    static std::mutex transportsMutex;
+    sessionManager.setTransportFactory([config](int) {
+        auto transport = std::make_unique<core::SyntheticTransport>(config);
+        std::scoped_lock lock(transportsMutex);
+        transports.push_back(transport.get());
+        return transport;
+    });
+    static std::atomic_uint64_t handledCount = 0;
+    std::vector<std::shared_ptr<ClientSession>> sessions;
+    for (int i = 0; i < sessionCount; i++) {
+        ClientSession::TdLibParameters parameters = baseParameters;
+        parameters.database_directory_ = "synthetic_" + std::to_string(i);
+        auto session = sessionManager.createSession(parameters);
+        session->setMessageHandler([](ClientSession *session, const tdapi::message *message) {
+            handledCount.fetch_add(1, std::memory_order_relaxed);
+            if (message->content_ != nullptr && message->content_->get_id() == tdapi::messageChatAddMembers::ID) {
+                session->sendTextMessage(message->chat_id_, "Welcome");
+            }
+            return true;
+        });
+        session->logInWithBotToken("0:synthetic");
+        sessions.push_back(std::move(session));
+    }
+    uint64_t startTime = getCurrentTimeMillis();
+    uint64_t lastReceivedCount = 0;
+    uint64_t lastHandledCount = 0;
+    uint64_t lastReportTime = startTime;
+    while (sShutdownRequested == 0
+           && (durationSeconds <= 0 || getCurrentTimeMillis() - startTime < uint64_t(durationSeconds) * 1000)) {
+        // returns early on SIGUSR1
+        sleep(10);
+        logRequestLatencyIfRequested();
+        if (getCurrentTimeMillis() - lastReportTime < 10 * 1000) {
+            continue;
+        }
+        uint64_t receivedCount = 0;
+        for (const auto &stats: sessionManager.getLooperStatistics()) {
+            receivedCount += stats.receivedCount;
+        }
+        uint64_t generatedCount = 0;
+        uint64_t skippedCount = 0;
+        {
+            std::scoped_lock lock(transportsMutex);
+            for (auto *transport: transports) {
+                auto stats = transport->getStatistics();
+                generatedCount += stats.generatedUpdateCount;
+                skippedCount += stats.skippedUpdateCount;
+            }
+        }
+        uint64_t handled = handledCount.load(std::memory_order_relaxed);
+        uint64_t now = getCurrentTimeMillis();
+        double seconds = double(std::max<uint64_t>(1, now - lastReportTime)) / 1000.0;
+        LOGI("dispatched = %.1f/s, handled = %.1f/s, generated = %llu, skipped = %llu, pending requests = %zu, rss = %llu KiB",
+             double(receivedCount - lastReceivedCount) / seconds, double(handled - lastHandledCount) / seconds,
+             (unsigned long long) generatedCount, (unsigned long long) skippedCount,
+             sessionManager.getPendingRequestCount(), (unsigned long long) (getCurrentResidentSetSize() / 1024));
+        lastReceivedCount = receivedCount;
+        lastHandledCount = handled;
+        lastReportTime = now;
+    }
+    sLatencyDumpRequested = 1;
+    logRequestLatencyIfRequested();
+    return 0;
+}
+
+/**
+ * Replay a capture file of --record= into one session per recorded client and report the dispatch cost.
+ * The sessions run on SyntheticTransport without the firehose, so the replayed responses are all they get,
+ * and their messages go to the handler module if there is one.
+ */
+static int runReplay(const std::string &replayPath, double speed, const ClientSession::TdLibParameters &baseParameters) {
+    auto &sessionManager = SessionManager::getInstance();
+    std::vector<int32_t> recordedClientIds;
+    try {
+        recordedClientIds = core::ResponseReplayer::listClientIds(replayPath);
+    } catch (const std::exception &e) {
+        LOGE("failed to read capture file: %s", e.what());
+        return 1;
+    }
+    // updatesPerSecond = 0, the sessions only get authorized and answered
+    core::SyntheticTransport::Config config;
+    sessionManager.setTransportFactory([config](int) {
+        return std::make_unique<core::SyntheticTransport>(config);
+    });
+    static std::atomic_uint64_t handledCount = 0;
+    ClientSession::MessageHandler countingHandler = [](ClientSession *, const tdapi::message *) {
+        handledCount.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    };
+    core::ResponseReplayer::Options options;
+    options.speed = speed;
+    std::vector<std::shared_ptr<ClientSession>> sessions;
+    for (int32_t recordedClientId: recordedClientIds) {
+        ClientSession::TdLibParameters parameters = baseParameters;
+        parameters.database_directory_ = "replay_" + std::to_string(recordedClientId);
+        auto session = sessionManager.createSession(parameters);
+        session->setMessageHandler(sModuleHost != nullptr ? sModuleHost->createMessageHandler(countingHandler)
+                                                          : countingHandler);
+        auto login = session->getAuthorizationFuture();
+        session->logInWithBotToken("0:replay");
+        if (login.wait_for(std::chrono::seconds(10)) != std::future_status::ready
+            || login.get() != ClientSession::AuthorizationState::AUTHORIZED) {
+            LOGE("replay session for client %d failed to log in", recordedClientId);
+            return 1;
+        }
+        options.clientIdMap[recordedClientId] = session->getTdLibObjectId();
+        sessions.push_back(std::move(session));
+    }
+    LOGI("replaying %s into %zu sessions at speed %.1f", replayPath.c_str(), sessions.size(), speed);
+    core::ResponseReplayer::Result result;
+    try {
+        result = core::ResponseReplayer::replay(sessionManager, replayPath, options);
+    } catch (const std::exception &e) {
+        LOGE("failed to replay capture file: %s", e.what());
+        return 1;
+    }
+    LOGI("replayed %llu frames in %llu ms: dispatched = %llu, skipped = %llu, malformed = %llu, handled messages = %llu, "
+         "dispatch avg = %.1f us, max = %llu us%s",
+         (unsigned long long) result.frameCount, (unsigned long long) (result.elapsedMicros / 1000),
+         (unsigned long long) result.dispatchedCount, (unsigned long long) result.skippedCount,
+         (unsigned long long) result.malformedCount, (unsigned long long) handledCount.load(),
+         result.dispatchedCount == 0 ? 0.0 : double(result.totalDispatchMicros) / double(result.dispatchedCount),
+         (unsigned long long) result.maxDispatchMicros, result.truncated ? ", truncated" : "");
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     Log::setLogHandler([](Log::Level level, const char *tag, const char *msg) {
         uint64_t timestamp = utils::getCurrentTimeMillis();
@@ -50,10 +418,36 @@ int main(int argc, char *argv[]) {
         std::cout << str.c_str() << std::endl;
     });
 
+    // kill -USR1 dumps the request latency histograms
+    installSignalHandler(SIGUSR1, [](int) {
+        sLatencyDumpRequested = 1;
+    });
+    // kill -HUP reloads the handler module without restarting the sessions
+    installSignalHandler(SIGHUP, [](int) {
+        sModuleReloadRequested = 1;
+    });
+    // ctrl-c and kill stop the report loops, so that the capture file is flushed
+    for (int signal: {SIGINT, SIGTERM}) {
+        installSignalHandler(signal, [](int) {
+            sShutdownRequested = 1;
+        });
+    }
+
     int32_t tgApiId = 0;
     std::string tgApiHash;
     std::string tgBotToken;
     std::string tgUserPhone;
+    int shardCount = 1;
+    std::string manifestPath;
+    std::string recordPath;
+    std::string replayPath;
+    double replaySpeed = 0;
+    std::string metricsEndpoint;
+    std::string modulePath;
+    double syntheticUpdatesPerSecond = 0;
+    int syntheticSessionCount = 1;
+    int syntheticLatencyMicros = 0;
+    int durationSeconds = 0;
 
     // read from cmd line
     for (int i = 1; i < argc; ++i) {
@@ -65,6 +459,28 @@ int main(int argc, char *argv[]) {
             tgBotToken = argv[i] + strlen("--tg-bot-token=");
         } else if (strstr(argv[i], "--user-phone=") == argv[i]) {
             tgUserPhone = argv[i] + strlen("--user-phone=");
+        } else if (strstr(argv[i], "--shards=") == argv[i]) {
+            shardCount = atoi(argv[i] + strlen("--shards="));
+        } else if (strstr(argv[i], "--manifest=") == argv[i]) {
+            manifestPath = argv[i] + strlen("--manifest=");
+        } else if (strstr(argv[i], "--metrics=") == argv[i]) {
+            metricsEndpoint = argv[i] + strlen("--metrics=");
+        } else if (strstr(argv[i], "--module=") == argv[i]) {
+            modulePath = argv[i] + strlen("--module=");
+        } else if (strstr(argv[i], "--replay=") == argv[i]) {
+            replayPath = argv[i] + strlen("--replay=");
+        } else if (strstr(argv[i], "--replay-speed=") == argv[i]) {
+            replaySpeed = std::max(0.0, atof(argv[i] + strlen("--replay-speed=")));
+        } else if (strstr(argv[i], "--record=") == argv[i]) {
+            recordPath = argv[i] + strlen("--record=");
+        } else if (strstr(argv[i], "--synthetic=") == argv[i]) {
+            syntheticUpdatesPerSecond = atof(argv[i] + strlen("--synthetic="));
+        } else if (strstr(argv[i], "--synthetic-sessions=") == argv[i]) {
+            syntheticSessionCount = std::max(1, atoi(argv[i] + strlen("--synthetic-sessions=")));
+        } else if (strstr(argv[i], "--synthetic-latency-us=") == argv[i]) {
+            syntheticLatencyMicros = std::max(0, atoi(argv[i] + strlen("--synthetic-latency-us=")));
+        } else if (strstr(argv[i], "--duration=") == argv[i]) {
+            durationSeconds = atoi(argv[i] + strlen("--duration="));
         }
     }
 
@@ -82,13 +498,25 @@ int main(int argc, char *argv[]) {
         tgUserPhone = env;
     }
     // check if all required params are set
-    if (tgApiId <= 0 || tgApiHash.empty() || tgBotToken.empty() || tgUserPhone.empty()) {
+    if (manifestPath.empty() && syntheticUpdatesPerSecond <= 0 && replayPath.empty() && (tgApiId <= 0 || tgApiHash.empty() || tgBotToken.empty() || tgUserPhone.empty())) {
         std::cerr << "Please either set TG_API_ID, TG_API_HASH, TG_BOT_TOKEN and TG_USER_PHONE env vars" << std::endl;
         std::cerr << "or set '--api-id=xxx', '--api-hash=xxx', '--bot-token=xxx' and '--user-phone=xxx' cmd line args." << std::endl;
         std::cerr << "Note: if the --user-phone param has spaces, please use something like \"--user-phone=+1 114514\" instead." << std::endl;
+        std::cerr << "To host many sessions, list them in a JSON file and pass '--manifest=path/to/sessions.json'." << std::endl;
+        std::cerr << "To load test without a network, pass '--synthetic=<updates per second>'." << std::endl;
+        std::cerr << "To replay a capture file of '--record=', pass '--replay=<path>' and optionally '--replay-speed=<factor>'." << std::endl;
         return 1;
     }
 
+    // relative to the directory we were started in, not the executable directory we change into
+    for (std::string *path: {&manifestPath, &recordPath, &replayPath, &modulePath}) {
+        if (!path->empty() && (*path)[0] != kPathSeparator) {
+            if (char cwd[PATH_MAX]; getcwd(cwd, sizeof(cwd)) != nullptr) {
+                *path = std::string(cwd) + kPathSeparator + *path;
+            }
+        }
+    }
+
     auto exePath = getCurrentExecutablePath();
     auto exeDir = getParentDirectory(exePath);
     if (exeDir.empty()) {
@@ -104,12 +532,45 @@ int main(int argc, char *argv[]) {
 //    auto &cfg = ConfigManager::getDefaultConfig();
     td::ClientManager::execute(tdapi::make_object<tdapi::setLogVerbosityLevel>(1));
     auto &sessionManager = SessionManager::getInstance();
+    if (shardCount > 1) {
+        sessionManager.setShardCount(shardCount);
+    }
+    if (!metricsEndpoint.empty()) {
+        // scraped with e.g. curl --unix-socket /run/ngcb.sock http://localhost/metrics
+        static metrics::MetricsServer metricsServer(metrics::MetricsRegistry::getInstance());
+        try {
+            metricsServer.start(metricsEndpoint);
+        } catch (const std::exception &e) {
+            LOGE("failed to start metrics server: %s", e.what());
+            return 1;
+        }
+    }
+    if (!recordPath.empty()) {
+        try {
+            sResponseRecorder = std::make_shared<core::ResponseRecorder>(recordPath);
+            sessionManager.setResponseRecorder(sResponseRecorder);
+        } catch (const std::exception &e) {
+            LOGE("failed to start recording: %s", e.what());
+            return 1;
+        }
+    }
+
+    if (!modulePath.empty()) {
+        // sees the member updates as well, e.g. for captcha on join
+        sModuleHost = std::make_shared<core::HandlerModuleHost>(std::vector<int32_t>{tdapi::updateChatMember::ID});
+        try {
+            sModuleHost->load(modulePath);
+        } catch (const std::exception &e) {
+            LOGE("failed to load handler module: %s", e.what());
+            return 1;
+        }
+        sessionManager.addUpdateInterceptor(sModuleHost);
+    }
 
     ClientSession::TdLibParameters parameters;
     parameters.api_id_ = tgApiId;
     parameters.api_hash_ = tgApiHash;
     parameters.use_test_dc_ = false;
-    parameters.database_directory_ = exeDir + kPathSeparator + "database" + kPathSeparator + "bot_1";
 
     // update parameter system info
     if (struct utsname uts = {}; uname(&uts) == 0) {
@@ -118,60 +579,60 @@ int main(int argc, char *argv[]) {
         parameters.system_version_ = uts.release;
     }
 
-    auto botClient = sessionManager.createSession(parameters);
-    botClient->execute(tdapi::make_object<tdapi::getOption>("version"), nullptr);
-
-    botClient->logInWithBotToken(tgBotToken);
+    if (!replayPath.empty()) {
+        int result = runReplay(replayPath, replaySpeed, parameters);
+        closeResponseRecorder();
+        return result;
+    }
+    if (syntheticUpdatesPerSecond > 0) {
+        int result = runSyntheticLoad(syntheticUpdatesPerSecond, syntheticSessionCount, syntheticLatencyMicros,
+                                      durationSeconds, parameters);
+        closeResponseRecorder();
+        return result;
+    }
+    if (!manifestPath.empty()) {
+        int result = runManifest(manifestPath, tgApiId, tgApiHash, parameters);
+        closeResponseRecorder();
+        return result;
+    }
+    parameters.database_directory_ = exeDir + kPathSeparator + "database" + kPathSeparator + "bot_1";
 
-    static bool isBotLoggedIn = false;
     uint64_t startupTime = getCurrentTimeMillis();
+    // the catch-up policy is fixed on creation, updates may arrive as soon as the first request is sent
+    auto botClient = sessionManager.createSession(parameters, createCatchUpPolicy(startupTime));
+    botClient->setMessageHandler(createMessageHandler(startupTime));
+    botClient->execute(tdapi::make_object<tdapi::getOption>("version"), nullptr);
+    auto botLogin = botClient->getAuthorizationFuture();
+    botClient->logInWithBotToken(tgBotToken);
 
-    botClient->setMessageHandler([startupTime](ClientSession *session, const tdapi::message *message) {
-        const auto *content = message->content_.get();
-        static int sendCount = 0;
-        if (sendCount > 10) {
-            throw std::runtime_error("send too many messages");
-        }
-        // don't handle old messages
-        uint64_t msgTime = message->date_ * 1000;
-        if (msgTime < startupTime) {
-            LOGI("ignore old message at time: %llu, startup_time: %llu", msgTime, startupTime);
-            return true;
-        }
-
-        std::cout << "message: type=" << content->get_id() << std::endl;
-        if (content->get_id() == tdapi::messageText::ID) {
-            std::string text = static_cast<const tdapi::messageText *>(content)->text_->text_;
-            std::string reply = "Hello, " + text;
-            session->sendTextMessage(message->chat_id_, reply);
-            sendCount++;
-            return true;
+    // the user session logs in at the same time, the bot does not depend on it
+    LOGI("start login user");
+    parameters.database_directory_ = exeDir + kPathSeparator + "database" + kPathSeparator + "user_1";
+    auto userClient = sessionManager.createSession(parameters);
+    userClient->execute(tdapi::make_object<tdapi::getOption>("version"), nullptr);
+    userClient->whenAuthorizationSettled([startupTime](ClientSession *, ClientSession::AuthorizationState state) {
+        if (state == ClientSession::AuthorizationState::AUTHORIZED) {
+            LOGI("user logged in after %llu ms", (unsigned long long) (getCurrentTimeMillis() - startupTime));
+        } else {
+            LOGE("user login failed");
         }
-        return false;
     });
+    userClient->logInWithPhoneNumber(tgUserPhone);
 
     // wait 120s for login success
-    for (int i = 0; i < 120; ++i) {
-        if (botClient->isAuthorized()) {
-            isBotLoggedIn = true;
-            break;
-        }
-        sleep(1);
-    }
-
-    if (!isBotLoggedIn) {
+    if (botLogin.wait_for(std::chrono::seconds(120)) != std::future_status::ready
+        || botLogin.get() != ClientSession::AuthorizationState::AUTHORIZED) {
         LOGE("bot login failed or timeout");
         return -1;
     }
+    LOGI("bot logged in after %llu ms", (unsigned long long) (getCurrentTimeMillis() - startupTime));
 
-    // login user
-    LOGI("start login user");
-    parameters.database_directory_ = exeDir + kPathSeparator + "database" + kPathSeparator + "user_1";
-
-    auto userClient = sessionManager.createSession(parameters);
-    botClient->execute(tdapi::make_object<tdapi::getOption>("version"), nullptr);
-    userClient->logInWithPhoneNumber(tgUserPhone);
-
-    sessionManager.getExecutors().awaitTermination(-1);
+    while (sShutdownRequested == 0) {
+        // returns early on signals
+        sleep(60);
+        logRequestLatencyIfRequested();
+        reloadModuleIfRequested();
+    }
+    closeResponseRecorder();
     return 0;
 }
@@ -0,0 +1,34 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <string>
+
+#include <td/telegram/td_api.h>
+
+#include "core/manager/HandlerModule.h"
+#include "core/manager/ClientSession.h"
+
+namespace td_api = td::td_api;
+
+/**
+ * An example handler module, answers /ping. Build it, start the bot with --module=path/to/libngcb_echo_module.so,
+ * change it, build it again and kill -HUP the bot to swap it in.
+ */
+class EchoModule : public core::HandlerModule {
+public:
+    bool onMessage(core::ClientSession *session, const td_api::message *message) override {
+        const auto *content = message->content_.get();
+        if (content == nullptr || content->get_id() != td_api::messageText::ID) {
+            return false;
+        }
+        const auto &text = static_cast<const td_api::messageText *>(content)->text_->text_;
+        if (text != "/ping") {
+            return false;
+        }
+        session->sendTextMessage(message->chat_id_, "pong");
+        return true;
+    }
+};
+
+NGCB_HANDLER_MODULE("echo", EchoModule)
@@ -33,6 +33,14 @@ public:
 
     [[nodiscard]] size_t currentWorkerCount() const;
 
+    [[nodiscard]] size_t getPoolSize() const;
+
+    [[nodiscard]] int getActiveCount() const;
+
+    [[nodiscard]] size_t getQueueSize() const;
+
+    [[nodiscard]] uint64_t getCompletedTaskCount() const;
+
     [[nodiscard]] bool isShutdown() const;
 
     [[nodiscard]] bool isTerminated() const;
@@ -50,8 +58,10 @@ private:
     int mMaxQueueSize;
     std::atomic_bool mIsShutdown = false;
     std::atomic_bool mIsTerminated = false;
-    std::mutex mWorkerLock;
-    std::mutex mQueueLock;
+    std::atomic_int mActiveCount = 0;
+    std::atomic_uint64_t mCompletedTaskCount = 0;
+    mutable std::mutex mWorkerLock;
+    mutable std::mutex mQueueLock;
     std::map<pthread_t, std::unique_ptr<Worker>> mWorkers;
     std::queue<std::unique_ptr<std::function<void()>>> mTaskQueue;
     std::condition_variable mQueueCondition;
@@ -107,6 +117,22 @@ bool CachedThreadPool::isTerminated() const {
     return impl->isTerminated();
 }
 
+size_t CachedThreadPool::getPoolSize() const {
+    return impl->getPoolSize();
+}
+
+int CachedThreadPool::getActiveCount() const {
+    return impl->getActiveCount();
+}
+
+size_t CachedThreadPool::getQueueSize() const {
+    return impl->getQueueSize();
+}
+
+uint64_t CachedThreadPool::getCompletedTaskCount() const {
+    return impl->getCompletedTaskCount();
+}
+
 // Worker
 
 class CachedThreadPool::Impl::Worker {
@@ -157,7 +183,15 @@ void CachedThreadPool::Impl::Worker::run(Worker *worker) {
                 task = pool->getTask(allowQuit ? pool->mKeepAliveTime : -1);
             }
             if (task) {
-                task->operator()();
+                pool->mActiveCount.fetch_add(1, std::memory_order_relaxed);
+                try {
+                    task->operator()();
+                } catch (...) {
+                    pool->mActiveCount.fetch_sub(1, std::memory_order_relaxed);
+                    throw;
+                }
+                pool->mActiveCount.fetch_sub(1, std::memory_order_relaxed);
+                pool->mCompletedTaskCount.fetch_add(1, std::memory_order_relaxed);
                 task.reset();
             } else {
                 // getTask() returned nullptr
@@ -220,6 +254,24 @@ size_t CachedThreadPool::Impl::currentWorkerCount() const {
     return mWorkers.size();
 }
 
+size_t CachedThreadPool::Impl::getPoolSize() const {
+    std::scoped_lock<std::mutex> lock(mWorkerLock);
+    return mWorkers.size();
+}
+
+int CachedThreadPool::Impl::getActiveCount() const {
+    return mActiveCount.load(std::memory_order_relaxed);
+}
+
+size_t CachedThreadPool::Impl::getQueueSize() const {
+    std::scoped_lock<std::mutex> lock(mQueueLock);
+    return mTaskQueue.size();
+}
+
+uint64_t CachedThreadPool::Impl::getCompletedTaskCount() const {
+    return mCompletedTaskCount.load(std::memory_order_relaxed);
+}
+
 void CachedThreadPool::Impl::execute(std::unique_ptr<std::function<void()>> task) {
     if (!task || !*task) {
         // ignore nullptr tasks
@@ -7,6 +7,8 @@
 
 #include <functional>
 #include <memory>
+#include <cstddef>
+#include <cstdint>
 
 namespace utils {
 
@@ -43,6 +45,23 @@ public:
 
     [[nodiscard]] bool isTerminated() const;
 
+    /**
+     * Get the current number of worker threads.
+     */
+    [[nodiscard]] size_t getPoolSize() const;
+
+    /**
+     * Get the number of worker threads which are running a task right now.
+     */
+    [[nodiscard]] int getActiveCount() const;
+
+    /**
+     * Get the number of tasks waiting in the queue.
+     */
+    [[nodiscard]] size_t getQueueSize() const;
+
+    [[nodiscard]] uint64_t getCompletedTaskCount() const;
+
 private:
     class Impl;
 
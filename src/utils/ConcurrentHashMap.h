@@ -94,6 +94,20 @@ public:
         }
     }
 
+    /**
+     * Copy the value of a key while holding the lock, unlike get(key) the copy stays valid if the entry is removed.
+     * @return true if the key was present
+     */
+    bool get(const K &key, V &value) const {
+        std::scoped_lock<std::mutex> _(mutex);
+        auto p = backend.find(key);
+        if (p == backend.end()) {
+            return false;
+        }
+        value = *p->second->getValue();
+        return true;
+    }
+
     template<typename... Args>
     void put(const K &key, Args &&...args) {
         auto entry = std::make_shared<Entry>(key, V(std::forward<Args>(args)...));
@@ -114,6 +128,17 @@ public:
         return backend.erase(key) != 0;
     }
 
+    bool remove(const K &key, V &removedValue) {
+        std::scoped_lock<std::mutex> _(mutex);
+        auto p = backend.find(key);
+        if (p == backend.end()) {
+            return false;
+        }
+        removedValue = std::move(*p->second->getValue());
+        backend.erase(p);
+        return true;
+    }
+
     void clear() {
         std::scoped_lock<std::mutex> _(mutex);
         backend.clear();
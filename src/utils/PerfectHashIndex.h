@@ -0,0 +1,112 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_PERFECTHASHINDEX_H
+#define NEOGROUPCAPTCHABOT_PERFECTHASHINDEX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+namespace utils {
+
+/**
+ * A static map from a set of sparse 32-bit keys, e.g. td_api constructor ids, to dense indices [0, n).
+ * The key set is fixed at construction, a multiplier is searched so that every key gets a slot of its own,
+ * so a lookup is a multiply, a shift and one load, without probing.
+ * This class is immutable after construction and may be read from any thread.
+ */
+class PerfectHashIndex {
+public:
+    static constexpr int32_t kNotFound = -1;
+
+    PerfectHashIndex() = default;
+
+    /**
+     * Build the index, the index of a key is its position in keys.
+     * @param keys distinct keys
+     */
+    explicit PerfectHashIndex(const std::vector<int32_t> &keys) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            for (size_t j = i + 1; j < keys.size(); j++) {
+                if (keys[i] == keys[j]) {
+                    throw std::invalid_argument("duplicate key " + std::to_string(keys[i]));
+                }
+            }
+        }
+        // start with a load factor of at most 1/2, grow the table if no collision-free multiplier is found
+        int bits = 1;
+        while ((size_t(1) << bits) < keys.size() * 2) {
+            bits++;
+        }
+        for (; bits <= 20; bits++) {
+            uint32_t multiplier = 0x9E3779B1u;
+            for (int attempt = 0; attempt < kMaxAttemptsPerSize; attempt++) {
+                if (tryBuild(keys, bits, multiplier)) {
+                    return;
+                }
+                // next odd candidate
+                multiplier = multiplier * 0x2C1B3C6Du + 0x297A2D39u;
+                multiplier |= 1u;
+            }
+        }
+        throw std::runtime_error("unable to build a perfect hash for " + std::to_string(keys.size()) + " keys");
+    }
+
+    /**
+     * Get the index of a key.
+     * @return the index, or kNotFound if the key is not in the index
+     */
+    [[nodiscard]] int32_t indexOf(int32_t key) const noexcept {
+        if (mSlots.empty()) {
+            return kNotFound;
+        }
+        const Slot &slot = mSlots[(uint32_t(key) * mMultiplier) >> mShift];
+        return slot.key == key ? slot.index : kNotFound;
+    }
+
+    [[nodiscard]] size_t size() const noexcept {
+        return mSize;
+    }
+
+    [[nodiscard]] size_t tableSize() const noexcept {
+        return mSlots.size();
+    }
+
+private:
+    static constexpr int kMaxAttemptsPerSize = 256;
+
+    struct Slot {
+        int32_t key = 0;
+        int32_t index = kNotFound;
+    };
+
+    bool tryBuild(const std::vector<int32_t> &keys, int bits, uint32_t multiplier) {
+        int shift = 32 - bits;
+        std::vector<Slot> slots(size_t(1) << bits);
+        for (size_t i = 0; i < keys.size(); i++) {
+            Slot &slot = slots[(uint32_t(keys[i]) * multiplier) >> shift];
+            if (slot.index != kNotFound) {
+                return false;
+            }
+            slot.key = keys[i];
+            slot.index = int32_t(i);
+        }
+        mSlots = std::move(slots);
+        mMultiplier = multiplier;
+        mShift = shift;
+        mSize = keys.size();
+        return true;
+    }
+
+    std::vector<Slot> mSlots;
+    uint32_t mMultiplier = 0;
+    int mShift = 32;
+    size_t mSize = 0;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_PERFECTHASHINDEX_H
@@ -175,6 +175,22 @@ std::string getCurrentExecutablePath() {
     return std::string(result, (count > 0) ? count : 0);
 }
 
+uint64_t getCurrentResidentSetSize() noexcept {
+    // /proc/self/statm: size resident shared text lib data dt, in pages
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == nullptr) {
+        return 0;
+    }
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+    int count = fscanf(fp, "%llu %llu", &size, &resident);
+    fclose(fp);
+    if (count != 2) {
+        return 0;
+    }
+    return uint64_t(resident) * uint64_t(sysconf(_SC_PAGESIZE));
+}
+
 int getCurrentProcessArchitecture() noexcept {
 #if defined(__aarch64__) || defined(__arm64__) || defined (_M_ARM64)
     return Architecture::ARCH_AARCH64;
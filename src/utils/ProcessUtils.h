@@ -7,6 +7,7 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
 namespace utils {
 
@@ -52,6 +53,12 @@ int getCurrentProcessArchitecture() noexcept;
 
 std::string getCurrentExecutablePath();
 
+/**
+ * Get the resident set size of the current process.
+ * @return the RSS in bytes, or 0 if it is not available.
+ */
+uint64_t getCurrentResidentSetSize() noexcept;
+
 }
 
 #endif //NCI_HOST_NATIVES_PROCESSUTILS_H
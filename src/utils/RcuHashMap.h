@@ -0,0 +1,167 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_RCUHASHMAP_H
+#define NEOGROUPCAPTCHABOT_RCUHASHMAP_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+
+namespace utils {
+
+/**
+ * A read-mostly hash map, e.g. the registry of sessions which is looked up for every update.
+ * Readers load an immutable snapshot of the map with one atomic load and never block, writers copy the snapshot,
+ * publish the copy and free the old snapshot once no reader can still see it (a grace period).
+ * A reader announces itself with an increment on one of a few striped counters, so readers on different threads
+ * do not share a cache line, and the writer waits until the counters of both epochs have drained.
+ * Values are copied out of the snapshot, a reader never runs user code while it holds a snapshot,
+ * so a writer can't wait on itself.
+ * Writes are serialized and cost a copy of the map, use this only for maps which rarely change.
+ * This class is thread safe.
+ */
+template<typename K, typename V, typename Hash = std::hash<K>, typename Pred = std::equal_to<K>>
+class RcuHashMap {
+public:
+    using Map = std::unordered_map<K, V, Hash, Pred>;
+
+    RcuHashMap() : mSnapshot(new Map()) {}
+
+    ~RcuHashMap() {
+        delete mSnapshot.load(std::memory_order_acquire);
+    }
+
+    RcuHashMap(const RcuHashMap &) = delete;
+
+    RcuHashMap &operator=(const RcuHashMap &) = delete;
+
+    /**
+     * Look up a key, wait-free.
+     * @param key the key
+     * @return a copy of the value, or nothing if the key is absent
+     */
+    [[nodiscard]] std::optional<V> find(const K &key) const {
+        ReadGuard guard(*this);
+        auto it = guard.map().find(key);
+        if (it == guard.map().end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    [[nodiscard]] bool containsKey(const K &key) const {
+        ReadGuard guard(*this);
+        return guard.map().find(key) != guard.map().end();
+    }
+
+    [[nodiscard]] size_t size() const {
+        ReadGuard guard(*this);
+        return guard.map().size();
+    }
+
+    /**
+     * Insert or replace a value, blocks until the previous snapshot can be freed.
+     */
+    void put(const K &key, V value) {
+        std::scoped_lock lock(mWriteMutex);
+        auto copy = std::make_unique<Map>(*mSnapshot.load(std::memory_order_relaxed));
+        copy->insert_or_assign(key, std::move(value));
+        publishLocked(std::move(copy));
+    }
+
+    /**
+     * Remove a value, blocks until the previous snapshot can be freed.
+     * @return true if the key was present
+     */
+    bool remove(const K &key) {
+        std::scoped_lock lock(mWriteMutex);
+        const Map *current = mSnapshot.load(std::memory_order_relaxed);
+        if (current->find(key) == current->end()) {
+            return false;
+        }
+        auto copy = std::make_unique<Map>(*current);
+        copy->erase(key);
+        publishLocked(std::move(copy));
+        return true;
+    }
+
+private:
+    static constexpr size_t kStripeCount = 32;
+
+    struct alignas(64) Stripe {
+        // readers inside a read section, by epoch parity
+        std::atomic_int64_t readers[2] = {0, 0};
+    };
+
+    class ReadGuard {
+    public:
+        explicit ReadGuard(const RcuHashMap &owner) noexcept
+                : mStripe(owner.mStripes[getStripeIndex()]),
+                  mParity(owner.mEpoch.load(std::memory_order_relaxed) & 1u) {
+            // the increment must be visible before the snapshot is loaded, hence seq_cst on both
+            mStripe.readers[mParity].fetch_add(1, std::memory_order_seq_cst);
+            mMap = owner.mSnapshot.load(std::memory_order_seq_cst);
+        }
+
+        ~ReadGuard() {
+            mStripe.readers[mParity].fetch_sub(1, std::memory_order_release);
+        }
+
+        ReadGuard(const ReadGuard &) = delete;
+
+        ReadGuard &operator=(const ReadGuard &) = delete;
+
+        [[nodiscard]] const Map &map() const noexcept {
+            return *mMap;
+        }
+
+    private:
+        Stripe &mStripe;
+        const uint32_t mParity;
+        const Map *mMap = nullptr;
+    };
+
+    static size_t getStripeIndex() noexcept {
+        static std::atomic_size_t sNextIndex = 0;
+        thread_local size_t sIndex = sNextIndex.fetch_add(1, std::memory_order_relaxed) % kStripeCount;
+        return sIndex;
+    }
+
+    void publishLocked(std::unique_ptr<Map> map) {
+        const Map *old = mSnapshot.exchange(map.release(), std::memory_order_seq_cst);
+        // A reader which still sees the old snapshot entered before the exchange and counted itself under either
+        // parity. Flip the epoch so that new readers count under the other parity, then wait for the old one
+        // to drain, twice, which covers both.
+        for (int i = 0; i < 2; ++i) {
+            uint32_t parity = mEpoch.fetch_add(1, std::memory_order_seq_cst) & 1u;
+            waitForReaders(parity);
+        }
+        delete old;
+    }
+
+    void waitForReaders(uint32_t parity) const {
+        for (const auto &stripe: mStripes) {
+            while (stripe.readers[parity].load(std::memory_order_seq_cst) != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    std::atomic<const Map *> mSnapshot;
+    std::atomic_uint32_t mEpoch = 0;
+    mutable Stripe mStripes[kStripeCount];
+    std::mutex mWriteMutex;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_RCUHASHMAP_H
@@ -0,0 +1,125 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_SEQUENCESLOTTABLE_H
+#define NEOGROUPCAPTCHABOT_SEQUENCESLOTTABLE_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+#include "ConcurrentHashMap.h"
+
+namespace utils {
+
+/**
+ * A table of values keyed by a monotonic non-zero sequence number, e.g. a request id.
+ * The value for sequence N lives in slot (N & mask) of a power-of-two ring, each slot is
+ * claimed and released with a single CAS, so neither put() nor remove() takes a lock or
+ * allocates. If the slot is still occupied by an older sequence that never completed,
+ * the value spills into a locked overflow map instead.
+ * A sequence may be put only once and removed only once.
+ */
+template<typename V>
+class SequenceSlotTable {
+public:
+    SequenceSlotTable() = delete;
+
+    explicit SequenceSlotTable(size_t capacity) {
+        size_t cap = 2;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+        mMask = cap - 1;
+        mSlots = std::make_unique<Slot[]>(cap);
+    }
+
+    ~SequenceSlotTable() = default;
+
+    SequenceSlotTable(const SequenceSlotTable &) = delete;
+
+    SequenceSlotTable &operator=(const SequenceSlotTable &) = delete;
+
+    /**
+     * Store the value for a sequence.
+     * @param sequence the sequence number, must not be 0
+     * @param value the value to store
+     */
+    void put(uint64_t sequence, V &&value) {
+        Slot &slot = mSlots[sequence & mMask];
+        uint64_t expected = kFree;
+        if (slot.owner.compare_exchange_strong(expected, kBusy, std::memory_order_acquire, std::memory_order_relaxed)) {
+            slot.value = std::move(value);
+            slot.owner.store(sequence, std::memory_order_release);
+        } else {
+            // the slot is held by an older sequence which is still pending
+            mOverflowCount.fetch_add(1, std::memory_order_relaxed);
+            mOverflow.put(sequence, std::move(value));
+        }
+        mPendingCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Remove the value for a sequence.
+     * @param sequence the sequence number
+     * @param value receives the removed value
+     * @return true if the value was present, false otherwise
+     */
+    bool remove(uint64_t sequence, V &value) {
+        Slot &slot = mSlots[sequence & mMask];
+        uint64_t expected = sequence;
+        if (slot.owner.compare_exchange_strong(expected, kBusy, std::memory_order_acquire, std::memory_order_relaxed)) {
+            value = std::move(slot.value);
+            slot.value = V();
+            slot.owner.store(kFree, std::memory_order_release);
+            mPendingCount.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        if (mOverflowCount.load(std::memory_order_relaxed) != 0 && mOverflow.remove(sequence, value)) {
+            mOverflowCount.fetch_sub(1, std::memory_order_relaxed);
+            mPendingCount.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Get the number of values currently stored.
+     */
+    [[nodiscard]] size_t size() const noexcept {
+        return mPendingCount.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the number of values currently stored in the overflow map.
+     */
+    [[nodiscard]] size_t overflowSize() const noexcept {
+        return mOverflowCount.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] size_t capacity() const noexcept {
+        return mMask + 1;
+    }
+
+private:
+    static constexpr uint64_t kFree = 0;
+    static constexpr uint64_t kBusy = UINT64_MAX;
+
+    struct alignas(64) Slot {
+        std::atomic_uint64_t owner = kFree;
+        V value;
+    };
+
+    std::unique_ptr<Slot[]> mSlots;
+    size_t mMask = 0;
+    std::atomic_size_t mPendingCount = 0;
+    std::atomic_size_t mOverflowCount = 0;
+    ConcurrentHashMap<uint64_t, V> mOverflow;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_SEQUENCESLOTTABLE_H
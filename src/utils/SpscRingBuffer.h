@@ -0,0 +1,110 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_SPSCRINGBUFFER_H
+#define NEOGROUPCAPTCHABOT_SPSCRINGBUFFER_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <utility>
+
+namespace utils {
+
+/**
+ * A bounded lock-free single-producer single-consumer ring buffer.
+ * Only one thread may call offer() and only one thread may call poll() at the same time.
+ * The capacity is rounded up to a power of two.
+ */
+template<typename T>
+class SpscRingBuffer {
+public:
+    SpscRingBuffer() = delete;
+
+    explicit SpscRingBuffer(size_t capacity) {
+        size_t cap = 2;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+        mMask = cap - 1;
+        mSlots = std::make_unique<T[]>(cap);
+    }
+
+    ~SpscRingBuffer() = default;
+
+    SpscRingBuffer(const SpscRingBuffer &) = delete;
+
+    SpscRingBuffer &operator=(const SpscRingBuffer &) = delete;
+
+    /**
+     * Insert an item at the tail, producer thread only.
+     * @param item the item, it is moved from only if this method returns true
+     * @return true on success, false if the buffer is full
+     */
+    bool offer(T &&item) {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mCachedHead > mMask) {
+            mCachedHead = mHead.load(std::memory_order_acquire);
+            if (tail - mCachedHead > mMask) {
+                return false;
+            }
+        }
+        mSlots[tail & mMask] = std::move(item);
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Remove an item from the head, consumer thread only.
+     * @param item receives the removed item
+     * @return true on success, false if the buffer is empty
+     */
+    bool poll(T &item) {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        if (head == mCachedTail) {
+            mCachedTail = mTail.load(std::memory_order_acquire);
+            if (head == mCachedTail) {
+                return false;
+            }
+        }
+        item = std::move(mSlots[head & mMask]);
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Get the approximate number of items in the buffer, may be called from any thread.
+     */
+    [[nodiscard]] size_t size() const noexcept {
+        size_t head = mHead.load(std::memory_order_acquire);
+        size_t tail = mTail.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    [[nodiscard]] bool isEmpty() const noexcept {
+        return size() == 0;
+    }
+
+    [[nodiscard]] bool isFull() const noexcept {
+        return size() > mMask;
+    }
+
+    [[nodiscard]] size_t capacity() const noexcept {
+        return mMask + 1;
+    }
+
+private:
+    std::unique_ptr<T[]> mSlots;
+    size_t mMask = 0;
+    // consumer side
+    alignas(64) std::atomic_size_t mHead = 0;
+    size_t mCachedTail = 0;
+    // producer side
+    alignas(64) std::atomic_size_t mTail = 0;
+    size_t mCachedHead = 0;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_SPSCRINGBUFFER_H
@@ -0,0 +1,211 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_TIMINGWHEEL_H
+#define NEOGROUPCAPTCHABOT_TIMINGWHEEL_H
+
+#include <bit>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+namespace utils {
+
+/**
+ * A hierarchical timing wheel with 4 levels of 64 slots each, schedule and expiry are O(1).
+ * Empty slots are skipped with a bitmap per level, so advancing over a long idle period costs
+ * one step per 4096 ticks rather than one per tick, even if there is a timer far in the future.
+ * Nodes are kept in a pool and recycled, so a steady state does not allocate.
+ * Time is measured in ticks, the caller decides how long a tick is.
+ * This class is not thread safe.
+ */
+template<typename T>
+class TimingWheel {
+public:
+    TimingWheel() = default;
+
+    explicit TimingWheel(uint64_t startTick) : mCurrentTick(startTick) {}
+
+    ~TimingWheel() = default;
+
+    TimingWheel(const TimingWheel &) = delete;
+
+    TimingWheel &operator=(const TimingWheel &) = delete;
+
+    /**
+     * Schedule an item to expire at the given tick.
+     * Ticks in the past expire on the next advance, ticks beyond the range of the wheel are clamped.
+     * @param expireTick the tick at which the item expires
+     * @param item the item
+     */
+    void schedule(uint64_t expireTick, T item) {
+        uint32_t index = allocateNode();
+        Node &node = mNodes[index];
+        node.expireTick = expireTick < mCurrentTick ? mCurrentTick : expireTick;
+        node.item = std::move(item);
+        link(index);
+        mSize++;
+    }
+
+    /**
+     * Advance the wheel up to and including the given tick.
+     * @param nowTick the current tick
+     * @param onExpired called with each expired item, it must not call back into this wheel
+     */
+    template<typename Consumer>
+    void advance(uint64_t nowTick, Consumer &&onExpired) {
+        while (mCurrentTick <= nowTick) {
+            if (mSize == 0) {
+                // nothing to expire, jump directly
+                mCurrentTick = nowTick + 1;
+                return;
+            }
+            uint32_t index = uint32_t(mCurrentTick & kSlotMask);
+            if (index == 0) {
+                // cascade the higher levels down, one level at a time
+                for (int level = 1; level < kLevels; level++) {
+                    uint32_t slot = uint32_t((mCurrentTick >> (kSlotBits * level)) & kSlotMask);
+                    cascade(level, slot);
+                    if (slot != 0) {
+                        break;
+                    }
+                }
+                if (mOccupied[0] == 0) {
+                    // nothing at level 0 for this whole round, go to the next level 1 slot with items
+                    // or the end of the level 1 round, whichever comes first
+                    uint32_t slot1 = uint32_t((mCurrentTick >> kSlotBits) & kSlotMask);
+                    uint64_t roundStart = mCurrentTick - (uint64_t(slot1) << kSlotBits);
+                    uint64_t nextSlot1 = nextOccupiedSlot(1, slot1 + 1);
+                    mCurrentTick = std::min(roundStart + (nextSlot1 << kSlotBits), nowTick + 1);
+                    continue;
+                }
+            } else if ((mOccupied[0] & (uint64_t(1) << index)) == 0) {
+                // nothing expires before the next slot with items or the next cascade
+                mCurrentTick = std::min(mCurrentTick + (nextOccupiedSlot(0, index) - index), nowTick + 1);
+                continue;
+            }
+            mCurrentTick++;
+            uint32_t head = mSlots[0][index];
+            mSlots[0][index] = kNil;
+            mOccupied[0] &= ~(uint64_t(1) << index);
+            while (head != kNil) {
+                Node &node = mNodes[head];
+                uint32_t next = node.next;
+                T item = std::move(node.item);
+                releaseNode(head);
+                mSize--;
+                onExpired(std::move(item));
+                head = next;
+            }
+        }
+    }
+
+    /**
+     * Get the number of scheduled items.
+     */
+    [[nodiscard]] size_t size() const noexcept {
+        return mSize;
+    }
+
+    [[nodiscard]] bool isEmpty() const noexcept {
+        return mSize == 0;
+    }
+
+    /**
+     * Get the next tick that has not been processed yet.
+     */
+    [[nodiscard]] uint64_t getCurrentTick() const noexcept {
+        return mCurrentTick;
+    }
+
+private:
+    static constexpr int kLevels = 4;
+    static constexpr int kSlotBits = 6;
+    static constexpr uint64_t kSlotCount = 1u << kSlotBits;
+    static constexpr uint64_t kSlotMask = kSlotCount - 1;
+    static constexpr uint64_t kMaxDelta = (uint64_t(1) << (kSlotBits * kLevels)) - 1;
+    static constexpr uint32_t kNil = UINT32_MAX;
+
+    struct Node {
+        uint64_t expireTick = 0;
+        uint32_t next = kNil;
+        T item = T();
+    };
+
+    static std::array<uint32_t, kSlotCount> emptyLevel() {
+        std::array<uint32_t, kSlotCount> level = {};
+        level.fill(kNil);
+        return level;
+    }
+
+    uint32_t allocateNode() {
+        if (mFreeHead != kNil) {
+            uint32_t index = mFreeHead;
+            mFreeHead = mNodes[index].next;
+            return index;
+        }
+        mNodes.emplace_back();
+        return uint32_t(mNodes.size() - 1);
+    }
+
+    /**
+     * Get the first slot of a level at or after the given one which has items, or kSlotCount if there is none.
+     */
+    [[nodiscard]] uint64_t nextOccupiedSlot(int level, uint32_t fromSlot) const {
+        if (fromSlot >= kSlotCount) {
+            return kSlotCount;
+        }
+        uint64_t rest = mOccupied[level] >> fromSlot;
+        return rest != 0 ? fromSlot + uint64_t(std::countr_zero(rest)) : kSlotCount;
+    }
+
+    void releaseNode(uint32_t index) {
+        mNodes[index].item = T();
+        mNodes[index].next = mFreeHead;
+        mFreeHead = index;
+    }
+
+    void link(uint32_t index) {
+        Node &node = mNodes[index];
+        uint64_t delta = node.expireTick - mCurrentTick;
+        if (delta > kMaxDelta) {
+            delta = kMaxDelta;
+            node.expireTick = mCurrentTick + kMaxDelta;
+        }
+        int level = 0;
+        while (level < kLevels - 1 && delta >= (uint64_t(1) << (kSlotBits * (level + 1)))) {
+            level++;
+        }
+        uint32_t slot = uint32_t((node.expireTick >> (kSlotBits * level)) & kSlotMask);
+        node.next = mSlots[level][slot];
+        mSlots[level][slot] = index;
+        mOccupied[level] |= uint64_t(1) << slot;
+    }
+
+    void cascade(int level, uint32_t slot) {
+        uint32_t head = mSlots[level][slot];
+        mSlots[level][slot] = kNil;
+        mOccupied[level] &= ~(uint64_t(1) << slot);
+        while (head != kNil) {
+            uint32_t next = mNodes[head].next;
+            link(head);
+            head = next;
+        }
+    }
+
+    uint64_t mCurrentTick = 0;
+    size_t mSize = 0;
+    uint32_t mFreeHead = kNil;
+    std::vector<Node> mNodes;
+    std::array<std::array<uint32_t, kSlotCount>, kLevels> mSlots = {emptyLevel(), emptyLevel(), emptyLevel(), emptyLevel()};
+    // bit N of a level is set if slot N of the level has items
+    std::array<uint64_t, kLevels> mOccupied = {};
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_TIMINGWHEEL_H
@@ -0,0 +1,205 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_TASK_H
+#define NEOGROUPCAPTCHABOT_TASK_H
+
+#include <utility>
+#include <optional>
+#include <exception>
+#include <functional>
+#include <coroutine>
+
+#include "utils/log/Log.h"
+
+namespace utils {
+
+/**
+ * Something that runs a function, e.g. on a thread pool. Coroutines are resumed through an executor.
+ */
+using Executor = std::function<void(std::function<void()>)>;
+
+template<typename T>
+class Task;
+
+namespace detail {
+
+class TaskPromiseBase {
+public:
+    struct FinalAwaiter {
+        [[nodiscard]] bool await_ready() const noexcept {
+            return false;
+        }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            auto &promise = handle.promise();
+            if (promise.mDetached) {
+                if (promise.mException) {
+                    try {
+                        std::rethrow_exception(promise.mException);
+                    } catch (const std::exception &e) {
+                        Log::format(Log::Level::ERROR, "Task", "unhandled exception in detached task: %s", e.what());
+                    } catch (...) {
+                        Log::logBuffer(Log::Level::ERROR, "Task", "unhandled exception in detached task");
+                    }
+                }
+                handle.destroy();
+                return std::noop_coroutine();
+            }
+            if (promise.mContinuation) {
+                return promise.mContinuation;
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    [[nodiscard]] std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+
+    [[nodiscard]] FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    void unhandled_exception() noexcept {
+        mException = std::current_exception();
+    }
+
+protected:
+    template<typename T>
+    friend class utils::Task;
+
+    std::coroutine_handle<> mContinuation = nullptr;
+    std::exception_ptr mException = nullptr;
+    bool mDetached = false;
+};
+
+template<typename T>
+class TaskPromise : public TaskPromiseBase {
+public:
+    Task<T> get_return_object() noexcept;
+
+    template<typename U>
+    void return_value(U &&value) {
+        mValue.emplace(std::forward<U>(value));
+    }
+
+    T takeResult() {
+        if (mException) {
+            std::rethrow_exception(mException);
+        }
+        return std::move(*mValue);
+    }
+
+private:
+    std::optional<T> mValue;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void takeResult() {
+        if (mException) {
+            std::rethrow_exception(mException);
+        }
+    }
+};
+
+}
+
+/**
+ * A lazily started coroutine.
+ * A task either gets awaited by another coroutine, which starts it and receives its result,
+ * or it is started with detach(), after which it owns itself and is destroyed when it finishes.
+ */
+template<typename T = void>
+class [[nodiscard]] Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task() = default;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept: mHandle(handle) {}
+
+    ~Task() {
+        if (mHandle) {
+            mHandle.destroy();
+        }
+    }
+
+    Task(const Task &) = delete;
+
+    Task &operator=(const Task &) = delete;
+
+    Task(Task &&other) noexcept: mHandle(std::exchange(other.mHandle, nullptr)) {}
+
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            if (mHandle) {
+                mHandle.destroy();
+            }
+            mHandle = std::exchange(other.mHandle, nullptr);
+        }
+        return *this;
+    }
+
+    /**
+     * Start the task on the current thread and let it run to completion on its own.
+     * Exceptions escaping a detached task are logged and swallowed.
+     */
+    void detach() && {
+        auto handle = std::exchange(mHandle, nullptr);
+        if (handle) {
+            handle.promise().mDetached = true;
+            handle.resume();
+        }
+    }
+
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            [[nodiscard]] bool await_ready() const noexcept {
+                return !handle || handle.done();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+                handle.promise().mContinuation = continuation;
+                return handle;
+            }
+
+            T await_resume() {
+                return handle.promise().takeResult();
+            }
+        };
+        return Awaiter{mHandle};
+    }
+
+private:
+    std::coroutine_handle<promise_type> mHandle = nullptr;
+};
+
+namespace detail {
+
+template<typename T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+}
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_TASK_H
@@ -0,0 +1,43 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <chrono>
+
+#include "LogSampler.h"
+
+namespace utils {
+
+static int64_t nowMillis() noexcept {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LogSampler::LogSampler(const char *tag, const char *name, uint32_t burst, int64_t intervalMillis) noexcept
+        : mTag(tag), mName(name), mBurst(burst), mIntervalMillis(intervalMillis), mIntervalStartMillis(nowMillis()) {}
+
+bool LogSampler::shouldLog() noexcept {
+    mEventCount.fetch_add(1, std::memory_order_relaxed);
+    int64_t now = nowMillis();
+    int64_t intervalStart = mIntervalStartMillis.load(std::memory_order_relaxed);
+    if (now - intervalStart >= mIntervalMillis
+        && mIntervalStartMillis.compare_exchange_strong(intervalStart, now, std::memory_order_relaxed)) {
+        // only the thread which moved the interval on gets here
+        uint64_t suppressed = mSuppressedCount.exchange(0, std::memory_order_relaxed);
+        mIntervalCount.store(0, std::memory_order_relaxed);
+        if (suppressed != 0) {
+            Log::format(Log::Level::INFO, mTag, "%s: suppressed %llu log lines in the last %lld s", mName,
+                        (unsigned long long) suppressed, (long long) ((now - intervalStart) / 1000));
+        }
+    }
+    if (mIntervalCount.fetch_add(1, std::memory_order_relaxed) < mBurst) {
+        return true;
+    }
+    mSuppressedCount.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+uint64_t LogSampler::getEventCount() const noexcept {
+    return mEventCount.load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,70 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_LOGSAMPLER_H
+#define NEOGROUPCAPTCHABOT_LOGSAMPLER_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "Log.h"
+
+namespace utils {
+
+/**
+ * Caps the log lines of one kind of event, e.g. one update type, so that log volume does not grow with traffic.
+ * In every interval the first burst events are logged, the rest are only counted,
+ * and the first event after the interval logs how many lines were suppressed.
+ * A suppressed line costs a few atomic operations, its arguments are not even evaluated with LOG_SAMPLED.
+ * This class is thread safe and lock free.
+ */
+class LogSampler {
+public:
+    static constexpr uint32_t kDefaultBurst = 10;
+    static constexpr int64_t kDefaultIntervalMillis = 60 * 1000;
+
+    /**
+     * @param tag the log tag of the summary lines
+     * @param name what is being sampled, for the summary lines, e.g. "updateUser"
+     * @param burst how many lines are logged per interval
+     * @param intervalMillis the length of an interval
+     */
+    explicit LogSampler(const char *tag, const char *name, uint32_t burst = kDefaultBurst,
+                        int64_t intervalMillis = kDefaultIntervalMillis) noexcept;
+
+    LogSampler(const LogSampler &) = delete;
+
+    LogSampler &operator=(const LogSampler &) = delete;
+
+    /**
+     * Count an event and decide whether it is logged.
+     * @return true if the caller should log the event
+     */
+    bool shouldLog() noexcept;
+
+    /**
+     * Get how many events were seen in total.
+     */
+    [[nodiscard]] uint64_t getEventCount() const noexcept;
+
+private:
+    const char *mTag;
+    const char *mName;
+    const uint32_t mBurst;
+    const int64_t mIntervalMillis;
+    std::atomic_int64_t mIntervalStartMillis;
+    std::atomic_uint32_t mIntervalCount = 0;
+    std::atomic_uint64_t mSuppressedCount = 0;
+    std::atomic_uint64_t mEventCount = 0;
+};
+
+}
+
+/**
+ * Log through a LogSampler, the arguments are only evaluated if the line is logged, e.g.
+ * <code>LOG_SAMPLED(sampler, Log::Level::INFO, "User: %s", describe(user).c_str());</code>
+ */
+#define LOG_SAMPLED(sampler, level, ...) do { if ((sampler).shouldLog()) { Log::format(level, LOG_TAG, __VA_ARGS__); } } while (0)
+
+#endif //NEOGROUPCAPTCHABOT_LOGSAMPLER_H
@@ -0,0 +1,324 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <cmath>
+#include <charconv>
+#include <algorithm>
+#include <stdexcept>
+
+#include "MetricsRegistry.h"
+
+namespace utils::metrics {
+
+static std::atomic_int sNextThreadShard = 0;
+
+int getThreadShard() noexcept {
+    thread_local int shard = sNextThreadShard.fetch_add(1, std::memory_order_relaxed) % kThreadShards;
+    return shard;
+}
+
+uint64_t Counter::get() const noexcept {
+    uint64_t sum = 0;
+    for (const auto &cell: mCells) {
+        sum += cell.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+Histogram::Histogram(std::vector<double> upperBounds) : mUpperBounds(std::move(upperBounds)) {
+    for (size_t i = 1; i < mUpperBounds.size(); i++) {
+        if (!(mUpperBounds[i - 1] < mUpperBounds[i])) {
+            throw std::invalid_argument("histogram bounds must be strictly increasing");
+        }
+    }
+    for (auto &shard: mShards) {
+        // one extra for +Inf
+        shard.counts = std::make_unique<std::atomic_uint64_t[]>(mUpperBounds.size() + 1);
+    }
+}
+
+void Histogram::observe(double value) noexcept {
+    size_t bucket = std::lower_bound(mUpperBounds.begin(), mUpperBounds.end(), value) - mUpperBounds.begin();
+    Shard &shard = mShards[getThreadShard()];
+    shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::getSnapshot() const {
+    Snapshot snapshot;
+    snapshot.upperBounds = mUpperBounds;
+    snapshot.cumulativeCounts.resize(mUpperBounds.size() + 1);
+    for (const auto &shard: mShards) {
+        for (size_t i = 0; i <= mUpperBounds.size(); i++) {
+            snapshot.cumulativeCounts[i] += shard.counts[i].load(std::memory_order_relaxed);
+        }
+        snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+    }
+    for (size_t i = 1; i < snapshot.cumulativeCounts.size(); i++) {
+        snapshot.cumulativeCounts[i] += snapshot.cumulativeCounts[i - 1];
+    }
+    snapshot.count = snapshot.cumulativeCounts.back();
+    return snapshot;
+}
+
+KeyedCounter::KeyedCounter(size_t capacity) {
+    mCapacity = 2;
+    while (mCapacity < capacity) {
+        mCapacity <<= 1;
+    }
+    mKeys = std::make_unique<std::atomic_int64_t[]>(mCapacity);
+    for (size_t i = 0; i < mCapacity; i++) {
+        mKeys[i].store(kFreeKey, std::memory_order_relaxed);
+    }
+    mCells = std::make_unique<std::atomic_uint64_t[]>(mCapacity * kThreadShards);
+}
+
+void KeyedCounter::increment(int64_t key, uint64_t delta) noexcept {
+    size_t mask = mCapacity - 1;
+    size_t index = size_t((uint64_t(key) * 0x9E3779B97F4A7C15uLL) >> 32) & mask;
+    for (size_t probe = 0; probe < mCapacity; probe++) {
+        size_t slot = (index + probe) & mask;
+        int64_t current = mKeys[slot].load(std::memory_order_acquire);
+        if (current == kFreeKey) {
+            if (mKeys[slot].compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+                current = key;
+            }
+        }
+        if (current == key) {
+            cellOf(getThreadShard(), slot).fetch_add(delta, std::memory_order_relaxed);
+            return;
+        }
+    }
+    mOverflowCount.fetch_add(delta, std::memory_order_relaxed);
+}
+
+std::vector<std::pair<int64_t, uint64_t>> KeyedCounter::getSnapshot() const {
+    std::vector<std::pair<int64_t, uint64_t>> result;
+    for (size_t slot = 0; slot < mCapacity; slot++) {
+        int64_t key = mKeys[slot].load(std::memory_order_acquire);
+        if (key == kFreeKey) {
+            continue;
+        }
+        uint64_t sum = 0;
+        for (int shard = 0; shard < kThreadShards; shard++) {
+            sum += cellOf(shard, slot).load(std::memory_order_relaxed);
+        }
+        result.emplace_back(key, sum);
+    }
+    return result;
+}
+
+uint64_t KeyedCounter::getOverflowCount() const noexcept {
+    return mOverflowCount.load(std::memory_order_relaxed);
+}
+
+static std::string formatValue(double value) {
+    if (std::isnan(value)) {
+        return "NaN";
+    }
+    if (std::isinf(value)) {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+    // the shortest representation which parses back to the same value
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    return {buffer, result.ptr};
+}
+
+static void appendEscaped(std::string &out, const std::string &value, bool escapeQuotes) {
+    for (char c: value) {
+        if (c == '\\') {
+            out += "\\\\";
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '"' && escapeQuotes) {
+            out += "\\\"";
+        } else {
+            out += c;
+        }
+    }
+}
+
+void MetricsWriter::beginFamily(const std::string &name, const std::string &help, const char *type) {
+    if (std::find(mWrittenFamilies.begin(), mWrittenFamilies.end(), name) != mWrittenFamilies.end()) {
+        return;
+    }
+    mWrittenFamilies.push_back(name);
+    mOut += "# HELP ";
+    mOut += name;
+    mOut += ' ';
+    appendEscaped(mOut, help, false);
+    mOut += "\n# TYPE ";
+    mOut += name;
+    mOut += ' ';
+    mOut += type;
+    mOut += '\n';
+}
+
+void MetricsWriter::writeName(const std::string &name, const Labels &labels,
+                              const char *extraLabel, const std::string &extraValue) {
+    mOut += name;
+    if (labels.empty() && extraLabel == nullptr) {
+        return;
+    }
+    mOut += '{';
+    bool first = true;
+    for (const auto &[label, value]: labels) {
+        if (!first) {
+            mOut += ',';
+        }
+        first = false;
+        mOut += label;
+        mOut += "=\"";
+        appendEscaped(mOut, value, true);
+        mOut += '"';
+    }
+    if (extraLabel != nullptr) {
+        if (!first) {
+            mOut += ',';
+        }
+        mOut += extraLabel;
+        mOut += "=\"";
+        mOut += extraValue;
+        mOut += '"';
+    }
+    mOut += '}';
+}
+
+void MetricsWriter::writeSample(const std::string &name, const Labels &labels, double value) {
+    writeName(name, labels, nullptr, {});
+    mOut += ' ';
+    mOut += formatValue(value);
+    mOut += '\n';
+}
+
+void MetricsWriter::writeSample(const std::string &name, const Labels &labels, uint64_t value) {
+    writeName(name, labels, nullptr, {});
+    mOut += ' ';
+    mOut += std::to_string(value);
+    mOut += '\n';
+}
+
+void MetricsWriter::writeHistogram(const std::string &name, const Labels &labels, const Histogram::Snapshot &snapshot) {
+    for (size_t i = 0; i < snapshot.cumulativeCounts.size(); i++) {
+        std::string bound = i < snapshot.upperBounds.size() ? formatValue(snapshot.upperBounds[i]) : "+Inf";
+        writeName(name + "_bucket", labels, "le", bound);
+        mOut += ' ';
+        mOut += std::to_string(snapshot.cumulativeCounts[i]);
+        mOut += '\n';
+    }
+    writeSample(name + "_sum", labels, snapshot.sum);
+    writeSample(name + "_count", labels, snapshot.count);
+}
+
+MetricsRegistry &MetricsRegistry::getInstance() {
+    static MetricsRegistry instance;
+    return instance;
+}
+
+static bool isValidName(const std::string &name) {
+    if (name.empty() || isdigit(static_cast<unsigned char>(name[0]))) {
+        return false;
+    }
+    return std::all_of(name.begin(), name.end(), [](char c) {
+        return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == ':';
+    });
+}
+
+MetricsRegistry::Child &MetricsRegistry::getOrCreateLocked(const std::string &name, const std::string &help,
+                                                           Type type, const Labels &labels) {
+    if (!isValidName(name)) {
+        throw std::invalid_argument("invalid metric name: " + name);
+    }
+    for (const auto &[label, value]: labels) {
+        if (!isValidName(label) || label.find(':') != std::string::npos) {
+            throw std::invalid_argument("invalid label name: " + label);
+        }
+    }
+    auto [it, inserted] = mFamilies.try_emplace(name, Family{help, type, {}});
+    Family &family = it->second;
+    if (family.type != type) {
+        throw std::logic_error("metric " + name + " is already registered with another type");
+    }
+    for (auto &child: family.children) {
+        if (child.labels == labels) {
+            return child;
+        }
+    }
+    family.children.push_back(Child{labels, nullptr, nullptr, nullptr});
+    return family.children.back();
+}
+
+Counter &MetricsRegistry::counter(const std::string &name, const std::string &help, const Labels &labels) {
+    std::scoped_lock lock(mMutex);
+    Child &child = getOrCreateLocked(name, help, Type::COUNTER, labels);
+    if (child.counter == nullptr) {
+        child.counter = std::make_unique<Counter>();
+    }
+    return *child.counter;
+}
+
+Gauge &MetricsRegistry::gauge(const std::string &name, const std::string &help, const Labels &labels) {
+    std::scoped_lock lock(mMutex);
+    Child &child = getOrCreateLocked(name, help, Type::GAUGE, labels);
+    if (child.gauge == nullptr) {
+        child.gauge = std::make_unique<Gauge>();
+    }
+    return *child.gauge;
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name, const std::string &help,
+                                      const std::vector<double> &upperBounds, const Labels &labels) {
+    std::scoped_lock lock(mMutex);
+    Child &child = getOrCreateLocked(name, help, Type::HISTOGRAM, labels);
+    if (child.histogram == nullptr) {
+        child.histogram = std::make_unique<Histogram>(upperBounds);
+    }
+    return *child.histogram;
+}
+
+void MetricsRegistry::addCollector(Collector collector) {
+    if (!collector) {
+        throw std::invalid_argument("collector must not be null");
+    }
+    std::scoped_lock lock(mMutex);
+    mCollectors.emplace_back(std::move(collector));
+}
+
+std::string MetricsRegistry::scrape() const {
+    std::string out;
+    MetricsWriter writer(out);
+    std::scoped_lock lock(mMutex);
+    for (const auto &[name, family]: mFamilies) {
+        switch (family.type) {
+            case Type::COUNTER: {
+                writer.beginFamily(name, family.help, "counter");
+                for (const auto &child: family.children) {
+                    writer.writeSample(name, child.labels, child.counter->get());
+                }
+                break;
+            }
+            case Type::GAUGE: {
+                writer.beginFamily(name, family.help, "gauge");
+                for (const auto &child: family.children) {
+                    writer.writeSample(name, child.labels, child.gauge->get());
+                }
+                break;
+            }
+            case Type::HISTOGRAM: {
+                writer.beginFamily(name, family.help, "histogram");
+                for (const auto &child: family.children) {
+                    writer.writeHistogram(name, child.labels, child.histogram->getSnapshot());
+                }
+                break;
+            }
+        }
+    }
+    for (const auto &collector: mCollectors) {
+        collector(writer);
+    }
+    return out;
+}
+
+}
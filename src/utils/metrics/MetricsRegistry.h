@@ -0,0 +1,260 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_METRICSREGISTRY_H
+#define NEOGROUPCAPTCHABOT_METRICSREGISTRY_H
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <functional>
+
+namespace utils::metrics {
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+// number of per-thread cells of a sharded metric, threads beyond this share cells
+constexpr int kThreadShards = 16;
+
+/**
+ * Get the cell index of the calling thread, threads are assigned cells round-robin on first use.
+ */
+int getThreadShard() noexcept;
+
+/**
+ * A monotonic counter. Each thread increments its own cache line, the cells are summed on scrape.
+ */
+class Counter {
+public:
+    Counter() = default;
+
+    Counter(const Counter &) = delete;
+
+    Counter &operator=(const Counter &) = delete;
+
+    void increment(uint64_t delta = 1) noexcept {
+        mCells[getThreadShard()].value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64_t get() const noexcept;
+
+private:
+    struct alignas(64) Cell {
+        std::atomic_uint64_t value = 0;
+    };
+
+    std::array<Cell, kThreadShards> mCells;
+};
+
+/**
+ * A value which can go up and down, gauges are written rarely, so there is a single cell.
+ */
+class Gauge {
+public:
+    Gauge() = default;
+
+    Gauge(const Gauge &) = delete;
+
+    Gauge &operator=(const Gauge &) = delete;
+
+    void set(double value) noexcept {
+        mValue.store(value, std::memory_order_relaxed);
+    }
+
+    void add(double delta) noexcept {
+        mValue.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] double get() const noexcept {
+        return mValue.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<double> mValue = 0;
+};
+
+/**
+ * A histogram with fixed bucket bounds, each thread counts into its own cells, the cells are summed on scrape.
+ */
+class Histogram {
+public:
+    struct Snapshot {
+        std::vector<double> upperBounds;
+        // cumulative, one more than upperBounds, the last one is the +Inf bucket
+        std::vector<uint64_t> cumulativeCounts;
+        double sum = 0;
+        uint64_t count = 0;
+    };
+
+    /**
+     * @param upperBounds the inclusive upper bounds of the buckets, strictly increasing, +Inf is implicit
+     */
+    explicit Histogram(std::vector<double> upperBounds);
+
+    Histogram(const Histogram &) = delete;
+
+    Histogram &operator=(const Histogram &) = delete;
+
+    void observe(double value) noexcept;
+
+    [[nodiscard]] Snapshot getSnapshot() const;
+
+private:
+    struct alignas(64) Shard {
+        std::unique_ptr<std::atomic_uint64_t[]> counts;
+        std::atomic<double> sum = 0;
+    };
+
+    std::vector<double> mUpperBounds;
+    std::array<Shard, kThreadShards> mShards;
+};
+
+/**
+ * Counters keyed by a sparse integer, e.g. a td_api constructor id, for label sets which are not known upfront.
+ * Keys are claimed with a CAS on first use, so counting takes no lock.
+ */
+class KeyedCounter {
+public:
+    /**
+     * @param capacity the maximum number of distinct keys, further keys are counted in getOverflowCount
+     */
+    explicit KeyedCounter(size_t capacity);
+
+    KeyedCounter(const KeyedCounter &) = delete;
+
+    KeyedCounter &operator=(const KeyedCounter &) = delete;
+
+    void increment(int64_t key, uint64_t delta = 1) noexcept;
+
+    /**
+     * Get the counts of all keys seen so far, in no particular order.
+     */
+    [[nodiscard]] std::vector<std::pair<int64_t, uint64_t>> getSnapshot() const;
+
+    [[nodiscard]] uint64_t getOverflowCount() const noexcept;
+
+private:
+    static constexpr int64_t kFreeKey = INT64_MIN;
+
+    // the cells of one thread shard are contiguous, so threads don't share cache lines except at the row ends
+    std::atomic_uint64_t &cellOf(int shard, size_t slot) const noexcept {
+        return mCells[shard * mCapacity + slot];
+    }
+
+    size_t mCapacity;
+    std::unique_ptr<std::atomic_int64_t[]> mKeys;
+    std::unique_ptr<std::atomic_uint64_t[]> mCells;
+    std::atomic_uint64_t mOverflowCount = 0;
+};
+
+/**
+ * Writes samples in the Prometheus text exposition format, version 0.0.4.
+ */
+class MetricsWriter {
+public:
+    explicit MetricsWriter(std::string &out) : mOut(out) {}
+
+    /**
+     * Start a metric family, the HELP and TYPE lines are written once per name.
+     * @param type counter, gauge, histogram, summary or untyped
+     */
+    void beginFamily(const std::string &name, const std::string &help, const char *type);
+
+    void writeSample(const std::string &name, const Labels &labels, double value);
+
+    void writeSample(const std::string &name, const Labels &labels, uint64_t value);
+
+    /**
+     * Write the _bucket, _sum and _count samples of a histogram.
+     */
+    void writeHistogram(const std::string &name, const Labels &labels, const Histogram::Snapshot &snapshot);
+
+private:
+    void writeName(const std::string &name, const Labels &labels, const char *extraLabel, const std::string &extraValue);
+
+    std::string &mOut;
+    std::vector<std::string> mWrittenFamilies;
+};
+
+/**
+ * The process wide set of metrics, scraped into the Prometheus text format.
+ * <p>
+ * Metrics are created once, e.g. at startup, and the references are kept by the instrumented code,
+ * updating a metric does not touch the registry. Values which already live somewhere else,
+ * e.g. looper statistics, are better exported with a collector which reads them on scrape.
+ */
+class MetricsRegistry {
+public:
+    using Collector = std::function<void(MetricsWriter &)>;
+
+    MetricsRegistry() = default;
+
+    MetricsRegistry(const MetricsRegistry &) = delete;
+
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+    static MetricsRegistry &getInstance();
+
+    /**
+     * Get or create a counter, the reference stays valid for the lifetime of the registry.
+     * Throws std::invalid_argument if the name is not a valid metric name and
+     * std::logic_error if the name is already used by a metric of another type.
+     */
+    Counter &counter(const std::string &name, const std::string &help, const Labels &labels = {});
+
+    Gauge &gauge(const std::string &name, const std::string &help, const Labels &labels = {});
+
+    /**
+     * Get or create a histogram, the bounds are only used when the histogram is created.
+     */
+    Histogram &histogram(const std::string &name, const std::string &help, const std::vector<double> &upperBounds,
+                         const Labels &labels = {});
+
+    /**
+     * Add a collector which writes its own samples on every scrape.
+     * Collectors run with the registry locked, so they must not create metrics.
+     */
+    void addCollector(Collector collector);
+
+    /**
+     * Render every metric and collector in the Prometheus text format.
+     */
+    [[nodiscard]] std::string scrape() const;
+
+private:
+    enum class Type {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM,
+    };
+
+    struct Child {
+        Labels labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    struct Family {
+        std::string help;
+        Type type;
+        std::vector<Child> children;
+    };
+
+    Child &getOrCreateLocked(const std::string &name, const std::string &help, Type type, const Labels &labels);
+
+    mutable std::mutex mMutex;
+    std::map<std::string, Family> mFamilies;
+    std::vector<Collector> mCollectors;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_METRICSREGISTRY_H
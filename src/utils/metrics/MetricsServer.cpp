@@ -0,0 +1,219 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "utils/log/Log.h"
+#include "MetricsRegistry.h"
+
+#include "MetricsServer.h"
+
+static constexpr const char *LOG_TAG = "MetricsServer";
+
+namespace utils::metrics {
+
+// a scrape request is a single line and a few headers
+static constexpr size_t kMaxRequestSize = 8192;
+static constexpr int kClientTimeoutMillis = 2000;
+
+MetricsServer::MetricsServer(MetricsRegistry &registry) : mRegistry(registry) {}
+
+MetricsServer::~MetricsServer() {
+    stop();
+}
+
+static int bindUnixSocket(const std::string &path) {
+    sockaddr_un address = {};
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("unix socket path too long: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("socket: ") + strerror(errno));
+    }
+    // a stale socket file of a previous run
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error("bind " + path + ": " + strerror(err));
+    }
+    return fd;
+}
+
+static int bindLoopbackSocket(const std::string &host, int port) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(uint16_t(port));
+    if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+        throw std::runtime_error("invalid address: " + host);
+    }
+    if ((ntohl(address.sin_addr.s_addr) >> 24) != 127) {
+        throw std::runtime_error("metrics are only served on loopback addresses, got " + host);
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("socket: ") + strerror(errno));
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error("bind " + host + ":" + std::to_string(port) + ": " + strerror(err));
+    }
+    return fd;
+}
+
+void MetricsServer::start(const std::string &endpoint) {
+    std::scoped_lock lock(mStartMutex);
+    if (mThread != 0) {
+        return;
+    }
+    int fd;
+    if (endpoint.rfind("unix:", 0) == 0) {
+        mUnixSocketPath = endpoint.substr(strlen("unix:"));
+        fd = bindUnixSocket(mUnixSocketPath);
+    } else {
+        std::string host = "127.0.0.1";
+        std::string port = endpoint;
+        if (auto colon = endpoint.rfind(':'); colon != std::string::npos) {
+            host = endpoint.substr(0, colon);
+            port = endpoint.substr(colon + 1);
+        }
+        int portNumber = atoi(port.c_str());
+        if (portNumber <= 0 || portNumber > 65535) {
+            throw std::runtime_error("invalid metrics endpoint: " + endpoint);
+        }
+        fd = bindLoopbackSocket(host, portNumber);
+    }
+    if (listen(fd, 16) != 0 || pipe2(mWakeFds, O_CLOEXEC) != 0) {
+        int err = errno;
+        close(fd);
+        if (!mUnixSocketPath.empty()) {
+            unlink(mUnixSocketPath.c_str());
+            mUnixSocketPath.clear();
+        }
+        throw std::runtime_error(std::string("listen: ") + strerror(err));
+    }
+    mListenFd = fd;
+    int rc = pthread_create(&mThread, nullptr, reinterpret_cast<void *(*)(void *)>(&MetricsServer::runServer), this);
+    if (rc != 0) {
+        mThread = 0;
+        close(mListenFd);
+        close(mWakeFds[0]);
+        close(mWakeFds[1]);
+        mListenFd = -1;
+        mWakeFds[0] = mWakeFds[1] = -1;
+        throw std::runtime_error("Failed to create metrics server thread: error code " + std::to_string(rc));
+    }
+    LOGI("serving metrics on %s", endpoint.c_str());
+}
+
+void MetricsServer::stop() {
+    std::scoped_lock lock(mStartMutex);
+    if (mThread == 0) {
+        return;
+    }
+    char wake = 1;
+    (void) !write(mWakeFds[1], &wake, 1);
+    pthread_join(mThread, nullptr);
+    mThread = 0;
+    close(mListenFd);
+    close(mWakeFds[0]);
+    close(mWakeFds[1]);
+    mListenFd = -1;
+    mWakeFds[0] = mWakeFds[1] = -1;
+    if (!mUnixSocketPath.empty()) {
+        unlink(mUnixSocketPath.c_str());
+        mUnixSocketPath.clear();
+    }
+}
+
+void MetricsServer::runServer(MetricsServer *server) {
+    pollfd fds[2] = {{server->mListenFd, POLLIN, 0},
+                     {server->mWakeFds[0], POLLIN, 0}};
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("poll: %s", strerror(errno));
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        if ((fds[0].revents & POLLIN) != 0) {
+            int client = accept4(server->mListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0) {
+                server->serveClient(client);
+                close(client);
+            }
+        }
+    }
+}
+
+static bool writeFully(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= size_t(written);
+    }
+    return true;
+}
+
+void MetricsServer::serveClient(int fd) {
+    timeval timeout = {kClientTimeoutMillis / 1000, (kClientTimeoutMillis % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    std::string request;
+    char buffer[1024];
+    while (request.size() < kMaxRequestSize && request.find("\r\n\r\n") == std::string::npos
+           && request.find("\n\n") == std::string::npos) {
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        if (count <= 0) {
+            break;
+        }
+        request.append(buffer, size_t(count));
+    }
+    std::string status;
+    std::string body;
+    const char *contentType = "text/plain; charset=utf-8";
+    if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET /metrics?", 0) == 0) {
+        status = "200 OK";
+        body = mRegistry.scrape();
+        contentType = "text/plain; version=0.0.4; charset=utf-8";
+    } else if (request.rfind("GET ", 0) == 0) {
+        status = "404 Not Found";
+        body = "not found, try /metrics\n";
+    } else {
+        status = "405 Method Not Allowed";
+        body = "only GET is supported\n";
+    }
+    std::string response = "HTTP/1.0 " + status + "\r\nContent-Type: " + contentType
+                           + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+    if (writeFully(fd, response.data(), response.size())) {
+        writeFully(fd, body.data(), body.size());
+    }
+}
+
+}
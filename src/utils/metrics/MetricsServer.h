@@ -0,0 +1,58 @@
+//
+// Created by kinit on 2026-10-16.
+//
+
+#ifndef NEOGROUPCAPTCHABOT_METRICSSERVER_H
+#define NEOGROUPCAPTCHABOT_METRICSSERVER_H
+
+#include <mutex>
+#include <string>
+#include <pthread.h>
+
+namespace utils::metrics {
+
+class MetricsRegistry;
+
+/**
+ * A minimal HTTP/1.0 server which answers GET /metrics with a scrape of a registry.
+ * It only listens locally: on a Unix domain socket or on a loopback TCP port.
+ * Requests are served one at a time on a single thread, which is plenty for a scraper.
+ */
+class MetricsServer {
+public:
+    explicit MetricsServer(MetricsRegistry &registry);
+
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer &) = delete;
+
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+    /**
+     * Start listening and serving, throws std::runtime_error if the endpoint can't be bound.
+     * @param endpoint "unix:/path/to/socket", "port" or "127.0.0.1:port"
+     */
+    void start(const std::string &endpoint);
+
+    /**
+     * Stop serving and join the server thread, a Unix domain socket file is removed.
+     */
+    void stop();
+
+private:
+    static void runServer(MetricsServer *server);
+
+    void serveClient(int fd);
+
+    MetricsRegistry &mRegistry;
+    std::mutex mStartMutex;
+    int mListenFd = -1;
+    // written by stop() to wake the server thread up
+    int mWakeFds[2] = {-1, -1};
+    std::string mUnixSocketPath;
+    pthread_t mThread = 0;
+};
+
+}
+
+#endif //NEOGROUPCAPTCHABOT_METRICSSERVER_H